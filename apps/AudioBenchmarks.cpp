@@ -0,0 +1,601 @@
+#include <boost/circular_buffer.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <functional>
+#include <mutex>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "../src/AudioRingBuffer.h"
+#include "../src/AudioKernels.h"
+#include "../src/AudioPayload.h"
+#include "../src/AudioReorderBuffer.h"
+#include "../src/AudioTaskScheduler.h"
+
+// Runs a block function repeatedly and reports the average cost per block
+double time_per_block(const std::string& label, size_t iterations, const std::function<void()>& block_fn)
+{
+	// Warm caches before measuring
+	for (size_t idx = 0; idx < iterations / 10 + 1; ++idx)
+		block_fn();
+
+	auto start = std::chrono::steady_clock::now();
+	for (size_t idx = 0; idx < iterations; ++idx)
+		block_fn();
+	auto end = std::chrono::steady_clock::now();
+
+	double ns = std::chrono::duration<double, std::nano>(end - start).count() / double(iterations);
+	printf("%-48s %10.1f ns/block\n", label.c_str(), ns);
+	return ns;
+}
+
+
+// ----------------
+// Ring buffers
+// ----------------
+
+void bench_ring_buffer(size_t frames)
+{
+	const size_t channels = 2;
+	const size_t iterations = 20000;
+	std::vector<float> network_block(frames * channels, 0.5f);
+	std::vector<float> device_block(frames * channels, 0.0f);
+
+	// Previous AudioDevice implementation: one circular buffer per channel and a lock per sample
+	std::mutex lock;
+	boost::circular_buffer<float> left(frames * 8);
+	boost::circular_buffer<float> right(frames * 8);
+	double legacy_ns = time_per_block("circular_buffer + mutex (" + std::to_string(frames) + " frames)", iterations, [&]() {
+		for (size_t channel = 0; channel < channels; ++channel) {
+			auto& in_buf = (channel == 0) ? left : right;
+			for (size_t idx = 0; idx < frames; ++idx) {
+				std::scoped_lock<std::mutex> l(lock);
+				in_buf.push_back(network_block[channel * frames + idx]);
+			}
+		}
+		float* samples = device_block.data();
+		for (size_t channel = 0; channel < channels; ++channel) {
+			auto& out_buf = (channel == 0) ? left : right;
+			for (size_t idx = 0; idx < frames; ++idx) {
+				std::scoped_lock<std::mutex> l(lock);
+				*(samples++) = out_buf.front();
+				out_buf.pop_front();
+			}
+		}
+	});
+
+	AudioRingBuffer<float> ring(channels, frames * 8);
+	double ring_ns = time_per_block("AudioRingBuffer (" + std::to_string(frames) + " frames)", iterations, [&]() {
+		ring.write(network_block.data(), frames, frames);
+		ring.read(device_block.data(), frames, frames);
+	});
+
+	printf("%-48s %10.1fx\n", "speedup", legacy_ns / ring_ns);
+}
+
+
+
+// ----------------
+// Sample conversion
+// ----------------
+
+// Replica of RtAudio's convertBuffer loops for a non-interleaved stream - one sample at a time through per-channel offset tables
+struct RtAudioConvertReplica {
+	RtAudioConvertReplica(size_t channels, size_t frames) : channels(channels), frames(frames), offsets(channels)
+	{
+		for (size_t channel = 0; channel < channels; ++channel)
+			offsets[channel] = channel * frames;
+	}
+
+	template<typename ToFloat>
+	void to_float(float* out, ToFloat sample_at)
+	{
+		float* frame_out = out;
+		for (size_t frame = 0; frame < frames; ++frame) {
+			for (size_t channel = 0; channel < channels; ++channel) {
+				frame_out[offsets[channel]] = sample_at(frame + offsets[channel]);
+			}
+			frame_out++;
+		}
+	}
+
+	size_t channels;
+	size_t frames;
+	std::vector<size_t> offsets;
+};
+
+bool bench_sample_conversion(size_t channels, size_t frames)
+{
+	using namespace AudioKernels;
+	const size_t iterations = 2000;
+	const size_t count = channels * frames;
+
+	std::vector<int16_t> int16_samples(count);
+	std::vector<uint8_t> int24_samples(count * 3);
+	std::vector<int32_t> int32_samples(count);
+	std::vector<float> float_samples(count);
+	std::vector<double> double_samples(count);
+	for (size_t idx = 0; idx < count; ++idx) {
+		float_samples[idx] = float(idx % 2000) / 1000.0f - 1.0f;
+	}
+	from_float(SampleFormat::Int16, float_samples.data(), int16_samples.data(), count);
+	from_float(SampleFormat::Int24, float_samples.data(), int24_samples.data(), count);
+	from_float(SampleFormat::Int32, float_samples.data(), int32_samples.data(), count);
+
+	bool ok = true;
+	RtAudioConvertReplica replica(channels, frames);
+	time_per_block("RtAudio int16 -> float", iterations, [&]() {
+		replica.to_float(float_samples.data(), [&](size_t idx) { return (float(int16_samples[idx]) + 0.5f) / 32767.5f; });
+	});
+	time_per_block("RtAudio int24 -> float", iterations, [&]() {
+		replica.to_float(float_samples.data(), [&](size_t idx) {
+			const uint8_t* s = int24_samples.data() + idx * 3;
+			int32_t value = int32_t(uint32_t(s[0]) | uint32_t(s[1]) << 8 | uint32_t(s[2]) << 16);
+			if (value & 0x800000)
+				value |= ~0xffffff;
+			return (float(value) + 0.5f) / 8388607.5f;
+		});
+	});
+	time_per_block("RtAudio int32 -> float", iterations, [&]() {
+		replica.to_float(float_samples.data(), [&](size_t idx) { return float((double(int32_samples[idx]) + 0.5) / 2147483647.5); });
+	});
+
+	for (auto instruction_set : { InstructionSet::Scalar, InstructionSet::SSE41, InstructionSet::AVX2 }) {
+		if (instruction_set > detected_instruction_set())
+			continue;
+		set_instruction_set(instruction_set);
+		std::string name = instruction_set_name(instruction_set);
+
+		time_per_block(name + " int16 -> float", iterations, [&]() { to_float(SampleFormat::Int16, int16_samples.data(), float_samples.data(), count); });
+		time_per_block(name + " int24 -> float", iterations, [&]() { to_float(SampleFormat::Int24, int24_samples.data(), float_samples.data(), count); });
+		time_per_block(name + " int32 -> float", iterations, [&]() { to_float(SampleFormat::Int32, int32_samples.data(), float_samples.data(), count); });
+		time_per_block(name + " float -> int16", iterations, [&]() { from_float(SampleFormat::Int16, float_samples.data(), int16_samples.data(), count); });
+		time_per_block(name + " float -> int24", iterations, [&]() { from_float(SampleFormat::Int24, float_samples.data(), int24_samples.data(), count); });
+		time_per_block(name + " float -> int32", iterations, [&]() { from_float(SampleFormat::Int32, float_samples.data(), int32_samples.data(), count); });
+		time_per_block(name + " float -> double", iterations, [&]() { to_double(float_samples.data(), double_samples.data(), count); });
+		time_per_block(name + " double -> float", iterations, [&]() { from_double(double_samples.data(), float_samples.data(), count); });
+
+		// Widening is exact, so narrowing again has to give back the same floats. An odd count covers the scalar tails
+		std::vector<float> narrowed(count);
+		to_double(float_samples.data(), double_samples.data(), count - 3);
+		from_double(double_samples.data(), narrowed.data(), count - 3);
+		ok &= std::equal(float_samples.begin(), float_samples.end() - 3, narrowed.begin()) && double_samples[count - 4] == double(float_samples[count - 4]);
+	}
+	set_instruction_set(detected_instruction_set());
+	return ok;
+}
+
+
+
+// ----------------
+// Network payloads
+// ----------------
+
+void bench_payload(size_t channels, size_t frames)
+{
+	using namespace AudioKernels;
+	const size_t iterations = 5000;
+	const size_t count = channels * frames;
+
+	std::vector<float> planar(count);
+	std::vector<const float*> channel_buffers(channels);
+	for (size_t idx = 0; idx < count; ++idx)
+		planar[idx] = float(idx % 2000) / 1000.0f - 1.0f;
+	for (size_t channel = 0; channel < channels; ++channel)
+		channel_buffers[channel] = planar.data() + channel * frames;
+
+	// Previous FloatList payload: channel count followed by the samples, read back one element at a time
+	std::vector<float> float_list(count + 1);
+	std::vector<float> decoded(count);
+	std::function<float(size_t)> float_at = [&](size_t idx) { return float_list[idx]; };
+	printf("%-48s %10zu bytes\n", "FloatList payload", float_list.size() * sizeof(float));
+	time_per_block("FloatList float_at decode", iterations, [&]() {
+		for (size_t idx = 0; idx < count; ++idx)
+			decoded[idx] = float_at(idx + 1);
+	});
+
+	for (auto sample_type : { SampleFormat::Float32, SampleFormat::Int24, SampleFormat::Int16 }) {
+		AudioPayload::Header header;
+		header.sample_type = sample_type;
+		header.channels = uint16_t(channels);
+		header.frames = uint32_t(frames);
+		header.samplerate = 48000;
+
+		std::vector<uint8_t> payload;
+		AudioPayload::encode(header, channel_buffers.data(), payload);
+		std::string name = (sample_type == SampleFormat::Float32) ? "float32" : (sample_type == SampleFormat::Int24) ? "int24" : "int16";
+		printf("%-48s %10zu bytes\n", (name + " payload").c_str(), payload.size());
+
+		time_per_block(name + " encode", iterations, [&]() { AudioPayload::encode(header, channel_buffers.data(), payload); });
+		time_per_block(name + " decode", iterations, [&]() {
+			AudioPayload::Header decoded_header;
+			if (AudioPayload::decode_header(payload.data(), payload.size(), decoded_header))
+				AudioPayload::decode_body(decoded_header, payload.data(), payload.size(), decoded.data());
+		});
+	}
+}
+
+
+// Packs small blocks into batches and splits them again. Messages per second is what batching saves - the plug
+// overhead itself lives in Showtime, so this only shows the packing cost and the bytes each message carries
+bool bench_batching(size_t channels, size_t frames)
+{
+	const size_t iterations = 5000;
+	std::vector<float> planar(channels * frames, 0.25f);
+	std::vector<const float*> channel_buffers(channels);
+	for (size_t channel = 0; channel < channels; ++channel)
+		channel_buffers[channel] = planar.data() + channel * frames;
+
+	AudioPayload::Header header;
+	header.channels = uint16_t(channels);
+	header.frames = uint32_t(frames);
+	header.samplerate = 48000;
+	std::vector<uint8_t> payload;
+	AudioPayload::encode(header, channel_buffers.data(), payload);
+
+	bool ok = true;
+	std::vector<uint8_t> batch;
+	std::vector<AudioPayload::Span> spans;
+	for (size_t blocks : { 1, 4, 16 }) {
+		time_per_block("batch of " + std::to_string(blocks) + " pack", iterations, [&]() {
+			AudioPayload::begin_batch(batch);
+			for (size_t idx = 0; idx < blocks; ++idx)
+				AudioPayload::append_to_batch(batch, payload.data(), payload.size());
+		});
+		time_per_block("batch of " + std::to_string(blocks) + " split", iterations, [&]() { AudioPayload::split_batch(batch.data(), batch.size(), spans); });
+
+		double messages = 48000.0 / double(frames * blocks);
+		printf("%-48s %10zu bytes %8.0f msgs/s\n", ("batch of " + std::to_string(blocks)).c_str(), batch.size(), messages);
+		ok &= spans.size() == blocks && spans.back().size == payload.size();
+	}
+
+	// A truncated batch is dropped whole
+	batch.resize(batch.size() - 1);
+	ok &= !AudioPayload::split_batch(batch.data(), batch.size(), spans) && spans.empty();
+	return ok;
+}
+
+
+// ----------------
+// Reordering and concealment
+// ----------------
+
+// Feeds a stream through the reorder window with a given share of blocks swapped with their neighbour or dropped,
+// and checks every sequence number comes out exactly once and in order
+bool bench_reorder(size_t channels, size_t frames, double swap_rate, double loss_rate)
+{
+	const size_t iterations = 20000;
+	std::vector<float> planar(channels * frames, 0.25f);
+	std::mt19937 rng(42);
+	std::uniform_real_distribution<double> chance(0.0, 1.0);
+
+	// Build the arrival order up front so the timing only covers the reorder buffer
+	std::vector<uint32_t> arrivals;
+	for (uint32_t sequence = 0; sequence < iterations; ++sequence) {
+		if (chance(rng) < loss_rate)
+			continue;
+		arrivals.push_back(sequence);
+		if (arrivals.size() > 1 && chance(rng) < swap_rate)
+			std::swap(arrivals[arrivals.size() - 1], arrivals[arrivals.size() - 2]);
+	}
+
+	AudioReorderBuffer reorder;
+	bool ordered = true;
+	uint32_t expected = 0;
+	auto start = std::chrono::steady_clock::now();
+	for (uint32_t sequence : arrivals) {
+		AudioBlockView block{ planar.data(), channels, frames, 48000, sequence, 0 };
+		reorder.push(block);
+		for (auto out = reorder.pop(); out.frames; out = reorder.pop())
+			ordered &= (out.sequence == expected++);
+	}
+	double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / double(arrivals.size());
+
+	const auto& stats = reorder.stats();
+	char label[64];
+	snprintf(label, sizeof(label), "%.0f%% swapped, %.0f%% lost", swap_rate * 100.0, loss_rate * 100.0);
+	printf("%-48s %10.1f ns/block  lost %llu concealed %llu reordered %llu %s\n", label, ns,
+		(unsigned long long)stats.lost.load(), (unsigned long long)stats.concealed.load(), (unsigned long long)stats.reordered.load(), ordered ? "in order" : "OUT OF ORDER");
+	return ordered;
+}
+
+
+// ----------------
+// Lossless codec
+// ----------------
+
+// Round trips a corpus of signals through the lossless codec, checking every sample survives quantisation unchanged,
+// and reports compression against the uncompressed body of the same sample type
+bool bench_codec(size_t channels, size_t frames)
+{
+	using namespace AudioKernels;
+	const size_t iterations = 2000;
+	const size_t count = channels * frames;
+	const double pi = 3.14159265358979323846;
+
+	std::mt19937 rng(1234);
+	std::uniform_real_distribution<float> noise(-1.0f, 1.0f);
+	std::vector<std::pair<std::string, std::function<float(size_t, size_t)>>> corpus = {
+		{ "silence", [](size_t, size_t) { return 0.0f; } },
+		{ "dc", [](size_t, size_t) { return 0.25f; } },
+		{ "sine 440Hz", [&](size_t channel, size_t n) { return 0.5f * float(std::sin(2.0 * pi * 440.0 * double(n) / 48000.0 + double(channel))); } },
+		{ "two tones", [&](size_t channel, size_t n) { return 0.3f * float(std::sin(2.0 * pi * 220.0 * n / 48000.0) + std::sin(2.0 * pi * (3000.0 + channel * 50.0) * n / 48000.0)); } },
+		{ "sine + quiet noise", [&](size_t, size_t n) { return 0.5f * float(std::sin(2.0 * pi * 1000.0 * n / 48000.0)) + 0.001f * noise(rng); } },
+		{ "square", [](size_t, size_t n) { return ((n / 48) % 2) ? 0.8f : -0.8f; } },
+		{ "impulses", [](size_t, size_t n) { return (n % 100 == 0) ? 1.0f : 0.0f; } },
+		{ "clipped full scale", [&](size_t, size_t n) { return std::max(-1.0f, std::min(1.0f, 4.0f * float(std::sin(2.0 * pi * 100.0 * n / 48000.0)))); } },
+		{ "white noise", [&](size_t, size_t) { return noise(rng); } }
+	};
+
+	bool all_exact = true;
+	std::vector<float> planar(count);
+	std::vector<const float*> channel_buffers(channels);
+	std::vector<float> expected(count);
+	std::vector<float> decoded(count);
+	for (size_t channel = 0; channel < channels; ++channel)
+		channel_buffers[channel] = planar.data() + channel * frames;
+
+	for (auto sample_type : { SampleFormat::Int16, SampleFormat::Int24 }) {
+		std::string type_name = (sample_type == SampleFormat::Int24) ? "int24" : "int16";
+		for (const auto& signal : corpus) {
+			for (size_t channel = 0; channel < channels; ++channel) {
+				for (size_t n = 0; n < frames; ++n)
+					planar[channel * frames + n] = signal.second(channel, n);
+			}
+
+			AudioPayload::Header header;
+			header.sample_type = sample_type;
+			header.channels = uint16_t(channels);
+			header.frames = uint32_t(frames);
+			header.samplerate = 48000;
+
+			// The uncompressed body is the reference the codec has to reproduce exactly
+			std::vector<uint8_t> plain;
+			std::vector<uint8_t> compressed;
+			AudioPayload::Header decoded_header;
+			AudioPayload::encode(header, channel_buffers.data(), plain);
+			AudioPayload::decode_header(plain.data(), plain.size(), decoded_header);
+			AudioPayload::decode_body(decoded_header, plain.data(), plain.size(), expected.data());
+
+			header.codec = AudioPayload::Codec::Lossless;
+			AudioPayload::encode(header, channel_buffers.data(), compressed);
+			bool exact = AudioPayload::decode_header(compressed.data(), compressed.size(), decoded_header) &&
+				decoded_header.codec == AudioPayload::Codec::Lossless &&
+				AudioPayload::decode_body(decoded_header, compressed.data(), compressed.size(), decoded.data()) &&
+				decoded == expected;
+			all_exact &= exact;
+
+			std::string label = type_name + " " + signal.first;
+			printf("%-48s %10zu bytes %6.2fx %s\n", label.c_str(), compressed.size(), double(plain.size()) / double(compressed.size()), exact ? "exact" : "MISMATCH");
+			time_per_block("  encode", iterations, [&]() { AudioPayload::encode(header, channel_buffers.data(), compressed); });
+			time_per_block("  decode", iterations, [&]() { AudioPayload::decode_body(decoded_header, compressed.data(), compressed.size(), decoded.data()); });
+		}
+	}
+
+	// Damaged payloads must be rejected rather than read out of bounds
+	std::vector<uint8_t> truncated;
+	AudioPayload::Header header;
+	header.sample_type = SampleFormat::Int16;
+	header.codec = AudioPayload::Codec::Lossless;
+	header.channels = uint16_t(channels);
+	header.frames = uint32_t(frames);
+	AudioPayload::encode(header, channel_buffers.data(), truncated);
+	truncated.resize(truncated.size() / 2);
+	AudioPayload::Header truncated_header;
+	bool rejected = !(AudioPayload::decode_header(truncated.data(), truncated.size(), truncated_header) &&
+		AudioPayload::decode_body(truncated_header, truncated.data(), truncated.size(), decoded.data()));
+	printf("%-48s %s\n", "truncated payload", rejected ? "rejected" : "ACCEPTED");
+	return all_exact && rejected;
+}
+
+
+// ----------------
+// Graph scheduling
+// ----------------
+
+// Filter passes per node. Stands in for a plugin, costing tens of microseconds per block like a light effect would
+#define BENCH_NODE_PASSES 8
+
+struct BenchGraph {
+	size_t channels;
+	size_t frames;
+	std::vector<std::vector<uint32_t>> inputs;
+	std::vector<std::vector<float>> outputs;
+	std::atomic<uint64_t> renders{ 0 };
+};
+
+void render_bench_node(void* context, uint32_t task)
+{
+	auto& graph = *static_cast<BenchGraph*>(context);
+	std::vector<float>& output = graph.outputs[task];
+	const size_t samples = graph.channels * graph.frames;
+
+	// Roots make up their own signal, everything else sums what feeds it
+	if (graph.inputs[task].empty()) {
+		for (size_t idx = 0; idx < samples; ++idx)
+			output[idx] = float((idx * 7 + task) % 64) / 64.0f - 0.5f;
+	}
+	else {
+		std::fill(output.begin(), output.end(), 0.0f);
+		for (auto input : graph.inputs[task])
+			AudioKernels::mix_add(graph.outputs[input].data(), output.data(), 1.0f, samples);
+	}
+
+	for (size_t pass = 0; pass < BENCH_NODE_PASSES; ++pass) {
+		for (size_t channel = 0; channel < graph.channels; ++channel) {
+			float* samples_in_channel = output.data() + channel * graph.frames;
+			float state = 0.0f;
+			for (size_t frame = 0; frame < graph.frames; ++frame) {
+				state += 0.3f * (samples_in_channel[frame] - state);
+				samples_in_channel[frame] = state;
+			}
+		}
+	}
+	graph.renders.fetch_add(1, std::memory_order_relaxed);
+}
+
+// branches parallel chains of stages nodes each, all merged into one last node
+bool bench_task_scheduler(size_t branches, size_t stages, size_t channels, size_t frames)
+{
+	const size_t iterations = 200;
+	BenchGraph graph;
+	graph.channels = channels;
+	graph.frames = frames;
+	for (size_t branch = 0; branch < branches; ++branch) {
+		for (size_t stage = 0; stage < stages; ++stage) {
+			graph.inputs.push_back(stage ? std::vector<uint32_t>{ uint32_t(graph.inputs.size() - 1) } : std::vector<uint32_t>());
+		}
+	}
+	std::vector<uint32_t> branch_ends;
+	for (size_t branch = 0; branch < branches; ++branch)
+		branch_ends.push_back(uint32_t((branch + 1) * stages - 1));
+	graph.inputs.push_back(branch_ends);
+	graph.outputs.assign(graph.inputs.size(), std::vector<float>(channels * frames, 0.0f));
+
+	AudioTaskScheduler::Graph tasks;
+	tasks.build(graph.inputs);
+	const size_t merge = graph.inputs.size() - 1;
+
+	// Every thread count has to produce exactly what rendering in order on one thread does
+	bool ok = true;
+	std::vector<float> expected;
+	double serial_ns = 0.0;
+	// Goes up to 4 threads even on fewer cores so stealing still gets exercised
+	size_t max_threads = std::max<size_t>(std::thread::hardware_concurrency(), 4);
+	for (size_t threads = 1;; threads = std::min(threads * 2, max_threads)) {
+		AudioTaskScheduler scheduler(threads - 1, tasks.size(), 0);
+		graph.renders = 0;
+		double ns = time_per_block("scheduler, " + std::to_string(threads) + " thread(s)", iterations, [&]() {
+			scheduler.run(tasks, &render_bench_node, &graph);
+		});
+		ok &= graph.renders.load() == (iterations + iterations / 10 + 1) * tasks.size();
+
+		if (threads == 1) {
+			expected = graph.outputs[merge];
+			serial_ns = ns;
+		}
+		ok &= graph.outputs[merge] == expected;
+		printf("%-48s %10.2fx\n", "  speedup", serial_ns / ns);
+		if (threads == max_threads)
+			break;
+	}
+	return ok;
+}
+
+// ----------------
+// Plugin processing lifecycle
+// ----------------
+
+// Synthetic model of a delay plugin that clears its delay line whenever processing is switched on, as many do.
+// The VST SDK isn't linked into the benchmarks, so this measures the cost of the reset itself rather than a
+// real plugin's setProcessing call
+struct BenchDelayPlugin {
+	std::vector<float> line;
+	size_t position = 0;
+	bool processing = false;
+
+	explicit BenchDelayPlugin(size_t delay_frames) : line(delay_frames, 0.0f) {}
+
+	void set_processing(bool state)
+	{
+		if (state && !processing) {
+			std::fill(line.begin(), line.end(), 0.0f);
+			position = 0;
+		}
+		processing = state;
+	}
+
+	void process(const float* input, float* output, size_t frames)
+	{
+		for (size_t frame = 0; frame < frames; ++frame) {
+			output[frame] = line[position];
+			line[position] = input[frame];
+			position = (position + 1) % line.size();
+		}
+	}
+};
+
+bool bench_processing_lifecycle(size_t frames, uint32_t samplerate)
+{
+	const size_t iterations = 2000;
+	const size_t delay_frames = samplerate;
+	std::vector<float> input(frames, 0.0f);
+	std::vector<float> output(frames, 0.0f);
+
+	// Switching processing on and off around every block, as the host used to. Model timings only
+	BenchDelayPlugin toggled(delay_frames);
+	double toggled_ns = time_per_block("processing switched per block", iterations, [&]() {
+		toggled.set_processing(true);
+		toggled.process(input.data(), output.data(), frames);
+		toggled.set_processing(false);
+	});
+
+	// Switched on once and left on
+	BenchDelayPlugin persistent(delay_frames);
+	persistent.set_processing(true);
+	double persistent_ns = time_per_block("processing left on", iterations, [&]() {
+		persistent.process(input.data(), output.data(), frames);
+	});
+	printf("%-48s %10.1f ns/block\n", "  saved", toggled_ns - persistent_ns);
+
+	// An impulse has to come out of the delay one second later. Per-block switching wipes it long before that
+	auto echo_survives = [&](BenchDelayPlugin& plugin, bool switch_per_block) {
+		std::fill(input.begin(), input.end(), 0.0f);
+		input[0] = 1.0f;
+		bool heard = false;
+		for (size_t played = 0; played <= delay_frames; played += frames) {
+			if (switch_per_block)
+				plugin.set_processing(true);
+			plugin.process(input.data(), output.data(), frames);
+			if (switch_per_block)
+				plugin.set_processing(false);
+			input[0] = 0.0f;
+			heard |= std::any_of(output.begin(), output.end(), [](float sample) { return sample != 0.0f; });
+		}
+		return heard;
+	};
+	persistent.set_processing(false);
+	persistent.set_processing(true);
+	bool ok = echo_survives(persistent, false) && !echo_survives(toggled, true);
+	printf("%-48s %s\n", "delay tail across blocks", ok ? "kept" : "lost");
+	return ok;
+}
+
+int main()
+{
+	printf("Ring buffer write+read per block\n");
+	for (size_t frames : { 64, 128, 512 })
+		bench_ring_buffer(frames);
+
+	printf("\nSample conversion, 32 channels x 512 frames\n");
+	bool conversion_ok = bench_sample_conversion(32, 512);
+
+	printf("\nAudio payloads, 2 channels x 512 frames\n");
+	bench_payload(2, 512);
+
+	printf("\nBatching, 2 channels x 64 frames per block\n");
+	bool batching_ok = bench_batching(2, 64);
+
+	printf("\nReorder window and concealment, 2 channels x 128 frames\n");
+	bool reorder_ok = bench_reorder(2, 128, 0.0, 0.0);
+	reorder_ok &= bench_reorder(2, 128, 0.05, 0.0);
+	reorder_ok &= bench_reorder(2, 128, 0.05, 0.02);
+
+	printf("\nLossless codec round trip, 2 channels x 512 frames\n");
+	bool codec_ok = bench_codec(2, 512);
+
+	printf("\nGraph of 16 branches x 4 nodes merged into one, 2 channels x 512 frames\n");
+	bool scheduler_ok = bench_task_scheduler(16, 4, 2, 512);
+
+	printf("\nPlugin processing lifecycle, synthetic delay plugin model (no VST SDK), 1 second delay, 128 frames per block\n");
+	bool lifecycle_ok = bench_processing_lifecycle(128, 48000);
+
+	return (conversion_ok && batching_ok && reorder_ok && codec_ok && scheduler_ok && lifecycle_ok) ? 0 : 1;
+}
@@ -0,0 +1,20 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+typedef float AUDIO_BUFFER_T;
+
+// Read-only view of a planar audio block
+struct AudioBlockView {
+	const AUDIO_BUFFER_T* samples;
+	size_t channels;
+	size_t frames;
+
+	// Taken from the payload header when the block came off the network, otherwise 0
+	uint32_t samplerate;
+	uint32_t sequence;
+	uint64_t timestamp;
+
+	const AUDIO_BUFFER_T* channel(size_t index) const { return samples + index * frames; }
+};
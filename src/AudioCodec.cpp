@@ -0,0 +1,532 @@
+#include "AudioCodec.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <limits>
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+#define SUBFRAME_CONSTANT 0
+#define SUBFRAME_FIXED 1
+#define SUBFRAME_LPC 2
+#define SUBFRAME_VERBATIM 3
+
+// Quotients at or above this are escaped and followed by the raw 32 bit value
+#define RICE_ESCAPE 32
+#define RICE_PARAMETER_BITS 5
+#define RICE_MAX_PARAMETER 30
+
+namespace {
+
+	unsigned highest_bit(uint64_t value)
+	{
+#ifdef _MSC_VER
+		unsigned long index;
+		_BitScanReverse64(&index, value);
+		return unsigned(index);
+#else
+		return 63u - unsigned(__builtin_clzll(value));
+#endif
+	}
+
+	uint32_t zigzag(int32_t value)
+	{
+		return (uint32_t(value) << 1) ^ uint32_t(value >> 31);
+	}
+
+	int32_t unzigzag(uint32_t value)
+	{
+		return int32_t(value >> 1) ^ -int32_t(value & 1);
+	}
+
+	int32_t sign_extend(uint32_t value, unsigned bits)
+	{
+		uint32_t sign = 1u << (bits - 1);
+		value &= (bits == 32) ? 0xffffffffu : ((1u << bits) - 1);
+		return int32_t((value ^ sign) - sign);
+	}
+
+	class BitWriter
+	{
+	public:
+		BitWriter(std::vector<uint8_t>& out) : m_out(out), m_cache(0), m_bits(0) {}
+
+		// Writes the low bits of value, most significant first. bits must be at most 32
+		void put(uint32_t value, unsigned bits)
+		{
+			if (!bits)
+				return;
+			m_cache = (m_cache << bits) | (uint64_t(value) & ((uint64_t(1) << bits) - 1));
+			m_bits += bits;
+			while (m_bits >= 8) {
+				m_bits -= 8;
+				m_out.push_back(uint8_t(m_cache >> m_bits));
+			}
+		}
+
+		void put_unary(uint32_t zeros)
+		{
+			for (; zeros >= 32; zeros -= 32)
+				put(0, 32);
+			put(1, zeros + 1);
+		}
+
+		void flush()
+		{
+			if (m_bits)
+				put(0, 8 - m_bits);
+		}
+
+	private:
+		std::vector<uint8_t>& m_out;
+		uint64_t m_cache;
+		unsigned m_bits;
+	};
+
+	class BitReader
+	{
+	public:
+		BitReader(const uint8_t* data, size_t size) : m_data(data), m_size(size), m_pos(0), m_cache(0), m_bits(0), m_error(false) {}
+
+		uint32_t get(unsigned bits)
+		{
+			if (!bits)
+				return 0;
+			while (m_bits < bits) {
+				if (!refill())
+					return 0;
+			}
+			m_bits -= bits;
+			return uint32_t((m_cache >> m_bits) & ((uint64_t(1) << bits) - 1));
+		}
+
+		// Counts zeros up to the next set bit, giving up past limit
+		uint32_t get_unary(uint32_t limit)
+		{
+			uint32_t zeros = 0;
+			while (true) {
+				if (!m_bits && !refill())
+					return 0;
+				uint64_t window = m_cache & ((uint64_t(1) << m_bits) - 1);
+				if (!window) {
+					zeros += m_bits;
+					m_bits = 0;
+				}
+				else {
+					unsigned lead = m_bits - 1 - highest_bit(window);
+					zeros += lead;
+					m_bits -= lead + 1;
+					break;
+				}
+				if (zeros > limit) {
+					m_error = true;
+					return 0;
+				}
+			}
+			if (zeros > limit)
+				m_error = true;
+			return zeros;
+		}
+
+		bool error() const { return m_error; }
+
+	private:
+		bool refill()
+		{
+			if (m_pos >= m_size) {
+				m_error = true;
+				return false;
+			}
+			m_cache = (m_cache << 8) | m_data[m_pos++];
+			m_bits += 8;
+			return true;
+		}
+
+		const uint8_t* m_data;
+		size_t m_size;
+		size_t m_pos;
+		uint64_t m_cache;
+		unsigned m_bits;
+		bool m_error;
+	};
+
+	// Scratch space reused between blocks on the same thread
+	struct ChannelScratch {
+		std::vector<int32_t> residual;
+		std::vector<int32_t> best_residual;
+		std::vector<double> signal;
+	};
+
+	// Each order is its own loop over plain arrays so the compiler can vectorise them
+	void fixed_residual(const int32_t* x, size_t frames, unsigned order, int32_t* residual)
+	{
+		switch (order) {
+		case 0:
+			for (size_t n = 0; n < frames; ++n)
+				residual[n] = x[n];
+			break;
+		case 1:
+			for (size_t n = 1; n < frames; ++n)
+				residual[n - 1] = x[n] - x[n - 1];
+			break;
+		case 2:
+			for (size_t n = 2; n < frames; ++n)
+				residual[n - 2] = x[n] - 2 * x[n - 1] + x[n - 2];
+			break;
+		case 3:
+			for (size_t n = 3; n < frames; ++n)
+				residual[n - 3] = x[n] - 3 * x[n - 1] + 3 * x[n - 2] - x[n - 3];
+			break;
+		case 4:
+			for (size_t n = 4; n < frames; ++n)
+				residual[n - 4] = x[n] - 4 * x[n - 1] + 6 * x[n - 2] - 4 * x[n - 3] + x[n - 4];
+			break;
+		}
+	}
+
+	// Sums of absolute residuals for every fixed order, over the frames all orders can predict.
+	// One reduction loop per order so each vectorises without storing anything
+	void fixed_abs_sums(const int32_t* x, size_t frames, uint64_t* sums)
+	{
+		for (unsigned order = 0; order <= AUDIO_CODEC_MAX_FIXED_ORDER; ++order)
+			sums[order] = 0;
+		if (frames <= AUDIO_CODEC_MAX_FIXED_ORDER)
+			return;
+
+		uint64_t sum0 = 0, sum1 = 0, sum2 = 0, sum3 = 0, sum4 = 0;
+		for (size_t n = 4; n < frames; ++n)
+			sum0 += uint32_t(std::abs(x[n]));
+		for (size_t n = 4; n < frames; ++n)
+			sum1 += uint32_t(std::abs(x[n] - x[n - 1]));
+		for (size_t n = 4; n < frames; ++n)
+			sum2 += uint32_t(std::abs(x[n] - 2 * x[n - 1] + x[n - 2]));
+		for (size_t n = 4; n < frames; ++n)
+			sum3 += uint32_t(std::abs(x[n] - 3 * x[n - 1] + 3 * x[n - 2] - x[n - 3]));
+		for (size_t n = 4; n < frames; ++n)
+			sum4 += uint32_t(std::abs(x[n] - 4 * x[n - 1] + 6 * x[n - 2] - 4 * x[n - 3] + x[n - 4]));
+		sums[0] = sum0;
+		sums[1] = sum1;
+		sums[2] = sum2;
+		sums[3] = sum3;
+		sums[4] = sum4;
+	}
+
+	bool fits(int64_t value, unsigned bits)
+	{
+		return value >= -(int64_t(1) << (bits - 1)) && value < (int64_t(1) << (bits - 1));
+	}
+
+	// Restoring runs in 64 bits so corrupt residuals can't overflow. Returns false once a sample leaves the bit depth
+	bool fixed_restore(const int32_t* residual, size_t frames, unsigned order, unsigned bits, int32_t* x)
+	{
+		for (size_t n = order; n < frames; ++n) {
+			const int64_t r = residual[n - order];
+			int64_t value = 0;
+			switch (order) {
+			case 0: value = r; break;
+			case 1: value = r + x[n - 1]; break;
+			case 2: value = r + 2 * int64_t(x[n - 1]) - x[n - 2]; break;
+			case 3: value = r + 3 * int64_t(x[n - 1]) - 3 * int64_t(x[n - 2]) + x[n - 3]; break;
+			case 4: value = r + 4 * int64_t(x[n - 1]) - 6 * int64_t(x[n - 2]) + 4 * int64_t(x[n - 3]) - x[n - 4]; break;
+			}
+			if (!fits(value, bits))
+				return false;
+			x[n] = int32_t(value);
+		}
+		return true;
+	}
+
+	// Returns false if a residual doesn't fit in 32 bits
+	bool lpc_residual(const int32_t* x, size_t frames, const int32_t* coefficients, unsigned order, unsigned shift, int32_t* residual)
+	{
+		for (size_t n = order; n < frames; ++n) {
+			int64_t prediction = 0;
+			for (unsigned j = 0; j < order; ++j)
+				prediction += int64_t(coefficients[j]) * x[n - 1 - j];
+			int64_t value = int64_t(x[n]) - (prediction >> shift);
+			if (value > std::numeric_limits<int32_t>::max() / 2 || value < std::numeric_limits<int32_t>::min() / 2)
+				return false;
+			residual[n - order] = int32_t(value);
+		}
+		return true;
+	}
+
+	bool lpc_restore(const int32_t* residual, size_t frames, const int32_t* coefficients, unsigned order, unsigned shift, unsigned bits, int32_t* x)
+	{
+		for (size_t n = order; n < frames; ++n) {
+			int64_t prediction = 0;
+			for (unsigned j = 0; j < order; ++j)
+				prediction += int64_t(coefficients[j]) * x[n - 1 - j];
+			int64_t value = int64_t(residual[n - order]) + (prediction >> shift);
+			if (!fits(value, bits))
+				return false;
+			x[n] = int32_t(value);
+		}
+		return true;
+	}
+
+	// Levinson-Durbin on the block's autocorrelation, then quantised to AUDIO_CODEC_LPC_PRECISION bit coefficients
+	bool compute_lpc(const int32_t* x, size_t frames, unsigned order, ChannelScratch& scratch, int32_t* coefficients, unsigned& shift)
+	{
+		// A Welch window keeps the block edges from skewing the estimate
+		scratch.signal.resize(frames);
+		for (size_t n = 0; n < frames; ++n) {
+			double position = (2.0 * double(n) - double(frames - 1)) / double(frames + 1);
+			scratch.signal[n] = double(x[n]) * (1.0 - position * position);
+		}
+
+		double autocorrelation[AUDIO_CODEC_MAX_LPC_ORDER + 1];
+		for (unsigned lag = 0; lag <= order; ++lag) {
+			double sum = 0.0;
+			for (size_t n = lag; n < frames; ++n)
+				sum += scratch.signal[n] * scratch.signal[n - lag];
+			autocorrelation[lag] = sum;
+		}
+		if (autocorrelation[0] <= 0.0)
+			return false;
+
+		double lpc[AUDIO_CODEC_MAX_LPC_ORDER + 1] = { 0.0 };
+		double previous[AUDIO_CODEC_MAX_LPC_ORDER + 1];
+		double error = autocorrelation[0] * (1.0 + 1e-9);
+		for (unsigned i = 1; i <= order; ++i) {
+			double acc = autocorrelation[i];
+			for (unsigned j = 1; j < i; ++j)
+				acc -= lpc[j] * autocorrelation[i - j];
+			double reflection = acc / error;
+			std::copy(lpc, lpc + order + 1, previous);
+			lpc[i] = reflection;
+			for (unsigned j = 1; j < i; ++j)
+				lpc[j] = previous[j] - reflection * previous[i - j];
+			error *= (1.0 - reflection * reflection);
+			if (error <= 0.0)
+				return false;
+		}
+
+		double max_coefficient = 0.0;
+		for (unsigned j = 1; j <= order; ++j)
+			max_coefficient = std::max(max_coefficient, std::fabs(lpc[j]));
+		if (max_coefficient <= 0.0)
+			return false;
+
+		int exponent;
+		std::frexp(max_coefficient, &exponent);
+		int quantised_shift = int(AUDIO_CODEC_LPC_PRECISION) - 1 - exponent;
+		if (quantised_shift < 0)
+			return false;
+		shift = unsigned(std::min(quantised_shift, 15));
+
+		// Carry the rounding error into the next coefficient
+		const int32_t limit = (1 << (AUDIO_CODEC_LPC_PRECISION - 1)) - 1;
+		double carry = 0.0;
+		for (unsigned j = 0; j < order; ++j) {
+			double value = lpc[j + 1] * double(1 << shift) + carry;
+			int32_t quantised = std::max(-limit - 1, std::min(limit, int32_t(std::lround(value))));
+			carry = value - double(quantised);
+			coefficients[j] = quantised;
+		}
+		return true;
+	}
+
+	unsigned rice_parameter(const int32_t* residual, size_t count)
+	{
+		uint64_t sum = 0;
+		for (size_t n = 0; n < count; ++n)
+			sum += zigzag(residual[n]);
+		unsigned k = 0;
+		while (k < RICE_MAX_PARAMETER && (uint64_t(count) << (k + 1)) < sum)
+			++k;
+		return k;
+	}
+
+	uint64_t rice_bits(const int32_t* residual, size_t count)
+	{
+		uint64_t bits = 0;
+		for (size_t start = 0; start < count; start += AUDIO_CODEC_PARTITION_FRAMES) {
+			size_t length = std::min<size_t>(AUDIO_CODEC_PARTITION_FRAMES, count - start);
+			unsigned k = rice_parameter(residual + start, length);
+			bits += RICE_PARAMETER_BITS;
+			for (size_t n = 0; n < length; ++n) {
+				uint32_t quotient = zigzag(residual[start + n]) >> k;
+				bits += (quotient < RICE_ESCAPE) ? quotient + 1 + k : RICE_ESCAPE + 1 + 32;
+			}
+		}
+		return bits;
+	}
+
+	void write_rice(BitWriter& writer, const int32_t* residual, size_t count)
+	{
+		for (size_t start = 0; start < count; start += AUDIO_CODEC_PARTITION_FRAMES) {
+			size_t length = std::min<size_t>(AUDIO_CODEC_PARTITION_FRAMES, count - start);
+			unsigned k = rice_parameter(residual + start, length);
+			writer.put(k, RICE_PARAMETER_BITS);
+			for (size_t n = 0; n < length; ++n) {
+				uint32_t value = zigzag(residual[start + n]);
+				uint32_t quotient = value >> k;
+				if (quotient < RICE_ESCAPE) {
+					writer.put_unary(quotient);
+					writer.put(value, k);
+				}
+				else {
+					writer.put_unary(RICE_ESCAPE);
+					writer.put(value, 32);
+				}
+			}
+		}
+	}
+
+	bool read_rice(BitReader& reader, int32_t* residual, size_t count)
+	{
+		for (size_t start = 0; start < count; start += AUDIO_CODEC_PARTITION_FRAMES) {
+			size_t length = std::min<size_t>(AUDIO_CODEC_PARTITION_FRAMES, count - start);
+			unsigned k = reader.get(RICE_PARAMETER_BITS);
+			if (k > RICE_MAX_PARAMETER)
+				return false;
+			for (size_t n = 0; n < length; ++n) {
+				uint32_t quotient = reader.get_unary(RICE_ESCAPE);
+				uint32_t value = (quotient < RICE_ESCAPE) ? (quotient << k) | reader.get(k) : reader.get(32);
+				residual[start + n] = unzigzag(value);
+			}
+			if (reader.error())
+				return false;
+		}
+		return true;
+	}
+
+	void encode_channel(BitWriter& writer, const int32_t* x, size_t frames, unsigned bits, ChannelScratch& scratch)
+	{
+		// Silence and DC compress to a single value
+		if (std::all_of(x, x + frames, [x](int32_t sample) { return sample == x[0]; })) {
+			writer.put(SUBFRAME_CONSTANT, 2);
+			writer.put(0, 4);
+			writer.put(uint32_t(x[0]), bits);
+			return;
+		}
+
+		scratch.best_residual.resize(frames);
+
+		// Pick the fixed predictor with the smallest residual, then cost it exactly
+		uint64_t sums[AUDIO_CODEC_MAX_FIXED_ORDER + 1];
+		fixed_abs_sums(x, frames, sums);
+		unsigned best_order = 0;
+		for (unsigned order = 1; order <= AUDIO_CODEC_MAX_FIXED_ORDER && order < frames; ++order) {
+			if (sums[order] < sums[best_order])
+				best_order = order;
+		}
+		fixed_residual(x, frames, best_order, scratch.best_residual.data());
+
+		unsigned best_type = SUBFRAME_FIXED;
+		uint64_t best_bits = uint64_t(best_order) * bits + rice_bits(scratch.best_residual.data(), frames - best_order);
+
+		// Then see whether a fitted predictor beats it
+		scratch.residual.resize(frames);
+		int32_t coefficients[AUDIO_CODEC_MAX_LPC_ORDER];
+		unsigned shift = 0;
+		unsigned lpc_order = unsigned(std::min<size_t>(AUDIO_CODEC_MAX_LPC_ORDER, frames / 8));
+		if (lpc_order && compute_lpc(x, frames, lpc_order, scratch, coefficients, shift) && lpc_residual(x, frames, coefficients, lpc_order, shift, scratch.residual.data())) {
+			uint64_t cost = uint64_t(lpc_order) * (bits + AUDIO_CODEC_LPC_PRECISION) + 4 + rice_bits(scratch.residual.data(), frames - lpc_order);
+			if (cost < best_bits) {
+				best_bits = cost;
+				best_type = SUBFRAME_LPC;
+				best_order = lpc_order;
+				scratch.best_residual.swap(scratch.residual);
+			}
+		}
+
+		// Noise can cost more than the raw samples
+		if (best_bits >= uint64_t(frames) * bits) {
+			best_type = SUBFRAME_VERBATIM;
+			best_order = 0;
+		}
+
+		writer.put(best_type, 2);
+		writer.put(best_order, 4);
+		if (best_type == SUBFRAME_VERBATIM) {
+			for (size_t n = 0; n < frames; ++n)
+				writer.put(uint32_t(x[n]), bits);
+			return;
+		}
+
+		for (unsigned n = 0; n < best_order; ++n)
+			writer.put(uint32_t(x[n]), bits);
+		if (best_type == SUBFRAME_LPC) {
+			writer.put(shift, 4);
+			for (unsigned j = 0; j < best_order; ++j)
+				writer.put(uint32_t(coefficients[j]), AUDIO_CODEC_LPC_PRECISION);
+		}
+		write_rice(writer, scratch.best_residual.data(), frames - best_order);
+	}
+
+	bool decode_channel(BitReader& reader, int32_t* x, size_t frames, unsigned bits, ChannelScratch& scratch)
+	{
+		unsigned type = reader.get(2);
+		unsigned order = reader.get(4);
+		if (reader.error() || order > frames)
+			return false;
+
+		if (type == SUBFRAME_CONSTANT) {
+			std::fill_n(x, frames, sign_extend(reader.get(bits), bits));
+			return !reader.error();
+		}
+		if (type == SUBFRAME_VERBATIM) {
+			for (size_t n = 0; n < frames; ++n)
+				x[n] = sign_extend(reader.get(bits), bits);
+			return !reader.error();
+		}
+		if ((type == SUBFRAME_FIXED && order > AUDIO_CODEC_MAX_FIXED_ORDER) || (type == SUBFRAME_LPC && (order == 0 || order > AUDIO_CODEC_MAX_LPC_ORDER)))
+			return false;
+
+		for (unsigned n = 0; n < order; ++n)
+			x[n] = sign_extend(reader.get(bits), bits);
+
+		int32_t coefficients[AUDIO_CODEC_MAX_LPC_ORDER];
+		unsigned shift = 0;
+		if (type == SUBFRAME_LPC) {
+			shift = reader.get(4);
+			for (unsigned j = 0; j < order; ++j)
+				coefficients[j] = sign_extend(reader.get(AUDIO_CODEC_LPC_PRECISION), AUDIO_CODEC_LPC_PRECISION);
+		}
+
+		scratch.residual.resize(frames);
+		if (!read_rice(reader, scratch.residual.data(), frames - order))
+			return false;
+
+		if (type == SUBFRAME_FIXED)
+			return fixed_restore(scratch.residual.data(), frames, order, bits, x);
+		return lpc_restore(scratch.residual.data(), frames, coefficients, order, shift, bits, x);
+	}
+}
+
+namespace AudioCodec {
+
+	void encode(const int32_t* planar, size_t channels, size_t frames, unsigned bits, std::vector<uint8_t>& out)
+	{
+		thread_local ChannelScratch scratch;
+
+		// A channel never costs more than its verbatim samples, so this is the most the block can take
+		out.reserve(out.size() + channels * ((frames * bits + 7) / 8 + 1));
+		BitWriter writer(out);
+		for (size_t channel = 0; channel < channels; ++channel)
+			encode_channel(writer, planar + channel * frames, frames, bits, scratch);
+		writer.flush();
+	}
+
+	size_t min_encoded_size(size_t channels, unsigned bits)
+	{
+		// A constant subframe is a 2 bit type, a 4 bit order and one sample
+		return (channels * (6 + bits) + 7) / 8;
+	}
+
+	bool decode(const uint8_t* data, size_t size, size_t channels, size_t frames, unsigned bits, int32_t* planar)
+	{
+		thread_local ChannelScratch scratch;
+		BitReader reader(data, size);
+		for (size_t channel = 0; channel < channels; ++channel) {
+			if (!decode_channel(reader, planar + channel * frames, frames, bits, scratch))
+				return false;
+		}
+		return true;
+	}
+}
@@ -0,0 +1,26 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Lossless compression for integer audio in the style of FLAC.
+// Each channel is coded independently as a constant, verbatim samples, a fixed polynomial predictor (order 0-4)
+// or a quantised LPC predictor (up to AUDIO_CODEC_MAX_LPC_ORDER), whichever is smallest.
+// Prediction residuals are Rice coded in partitions of AUDIO_CODEC_PARTITION_FRAMES with their own parameter.
+#define AUDIO_CODEC_MAX_FIXED_ORDER 4
+#define AUDIO_CODEC_MAX_LPC_ORDER 8
+#define AUDIO_CODEC_LPC_PRECISION 12
+#define AUDIO_CODEC_PARTITION_FRAMES 64
+
+namespace AudioCodec {
+
+	// Appends channels * frames planar samples of the given bit depth (at most 24) to out
+	void encode(const int32_t* planar, size_t channels, size_t frames, unsigned bits, std::vector<uint8_t>& out);
+
+	// Smallest body encode can produce for a block, whatever its length. Anything shorter is corrupt
+	size_t min_encoded_size(size_t channels, unsigned bits);
+
+	// Decodes size bytes produced by encode into planar. Returns false if the data is truncated or corrupt
+	bool decode(const uint8_t* data, size_t size, size_t channels, size_t frames, unsigned bits, int32_t* planar);
+}
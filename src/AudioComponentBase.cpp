@@ -1,18 +1,86 @@
 #include "AudioComponentBase.h"
+#include "AudioKernels.h"
+#include <showtime/ZstLogging.h>
+#include <algorithm>
+#include <limits>
+#include <string>
 
 using namespace showtime;
 
+#define LOAD_REPORT_INTERVAL std::chrono::seconds(1)
+#define LINK_STATS_INTERVAL std::chrono::seconds(1)
+
+// A partial batch older than this many times the audio it was expected to cover means the source has stalled
+#define BATCH_STALL_FACTOR 2
+
 AudioComponentBase::AudioComponentBase(const char* component_type, const char* name) : 
 	ZstComponent(component_type, name),
-	m_incoming_network_audio(std::make_shared<ZstInputPlug>("IN_audio", ZstValueType::FloatList, 1)),
-	m_outgoing_network_audio(std::make_shared<ZstOutputPlug>("OUT_audio", ZstValueType::FloatList))
+	m_incoming_network_audio(std::make_shared<ZstInputPlug>("IN_audio", ZstValueType::ByteList, 1)),
+	m_outgoing_network_audio(std::make_shared<ZstOutputPlug>("OUT_audio", ZstValueType::ByteList)),
+	m_outgoing_max_payload(0),
+	m_unpacked_input(0),
+	m_link_stats_out(std::make_shared<ZstOutputPlug>("OUT_link_stats", ZstValueType::IntList)),
+	m_batch_in(std::make_shared<ZstInputPlug>("IN_batch", ZstValueType::FloatList, 1)),
+	m_batch_blocks(1),
+	m_batch_max_latency_ms(0.0),
+	m_batch_max_bytes(0),
+	m_batched_blocks(0),
+	m_batched_frames(0),
+	m_graph_owner(nullptr),
+	m_graph_exclusive(false),
+	m_load_out(std::make_shared<ZstOutputPlug>("OUT_load", ZstValueType::FloatList)),
+	m_dump_load_in(std::make_shared<ZstInputPlug>("IN_dump_load", ZstValueType::IntList, 1)),
+	m_mix_channels(0),
+	m_mix_block_frames(0),
+	m_mix_samplerate(0)
+{
+	m_input_reorder.push_back(std::make_unique<AudioReorderBuffer>());
+}
+
+AudioComponentBase::~AudioComponentBase()
 {
+	leave_graph();
 }
 
 void AudioComponentBase::on_registered()
 {
 	add_child(m_outgoing_network_audio.get());
 	add_child(m_incoming_network_audio.get());
+	add_child(m_load_out.get());
+	add_child(m_dump_load_in.get());
+	add_child(m_batch_in.get());
+	add_child(m_link_stats_out.get());
+	for (auto& input : m_mix_inputs)
+		add_child(input.get());
+	if (m_mix_gain_in)
+		add_child(m_mix_gain_in.get());
+
+	register_tick();
+	AudioGraph::add(this, URI().path());
+}
+
+void AudioComponentBase::on_tick()
+{
+	publish_load();
+	publish_link_stats();
+
+	// Don't let the tail of a stream sit in a partial batch once its source stops publishing
+	if (m_batched_blocks && m_outgoing_header.samplerate) {
+		double expected_ms = (m_batch_max_latency_ms > 0.0) ? m_batch_max_latency_ms :
+			double(m_batched_frames) / m_batched_blocks * m_batch_blocks * 1000.0 / m_outgoing_header.samplerate;
+		if (std::chrono::steady_clock::now() - m_batch_started > std::chrono::duration<double, std::milli>(expected_ms * BATCH_STALL_FACTOR))
+			flush_outgoing_batch();
+	}
+}
+
+void AudioComponentBase::compute(ZstInputPlug* plug)
+{
+	if (plug == m_dump_load_in.get())
+		dump_load_histogram();
+	else if (plug == m_batch_in.get())
+		set_batching(plug);
+	else if (m_mix_gain_in && plug == m_mix_gain_in.get())
+		set_mix_gains(plug);
 }
 
 showtime::ZstInputPlug* AudioComponentBase::incoming_audio()
@@ -24,3 +92,421 @@ showtime::ZstOutputPlug* AudioComponentBase::outgoing_audio()
 {
 	return m_outgoing_network_audio.get();
 }
+
+size_t AudioComponentBase::graph_channels() const
+{
+	return 0;
+}
+
+size_t AudioComponentBase::graph_max_frames() const
+{
+	return 0;
+}
+
+bool AudioComponentBase::is_graph_source() const
+{
+	return false;
+}
+
+uint32_t AudioComponentBase::graph_samplerate() const
+{
+	return 0;
+}
+
+bool AudioComponentBase::set_graph_samplerate(uint32_t)
+{
+	return false;
+}
+
+size_t AudioComponentBase::render_graph_block(const AudioBlockView&, AUDIO_BUFFER_T*, size_t)
+{
+	return 0;
+}
+
+void AudioComponentBase::set_graph_owner(AudioComponentBase* sink, bool exclusive)
+{
+	if (sink != m_graph_owner)
+		Log::entity(Log::Level::debug, "{} {} an in-process graph", URI().path(), sink ? "joined" : "left");
+	m_graph_owner = sink;
+	m_graph_exclusive = sink && exclusive;
+}
+
+AudioComponentBase* AudioComponentBase::graph_owner() const
+{
+	return m_graph_owner;
+}
+
+bool AudioComponentBase::graph_exclusive() const
+{
+	return m_graph_exclusive;
+}
+
+size_t AudioComponentBase::audio_input_count() const
+{
+	return 1 + m_mix_inputs.size();
+}
+
+ZstInputPlug* AudioComponentBase::audio_input(size_t index)
+{
+	return index ? m_mix_inputs[index - 1].get() : m_incoming_network_audio.get();
+}
+
+float AudioComponentBase::mix_gain(size_t index) const
+{
+	return (index < m_mix_sources.size()) ? m_mix_gains[index].load(std::memory_order_relaxed) : 1.0f;
+}
+
+void AudioComponentBase::leave_graph()
+{
+	AudioGraph::remove(this);
+}
+
+
+void AudioComponentBase::prepare_outgoing_audio(size_t channels, size_t max_frames, uint32_t samplerate)
+{
+	m_outgoing_header.samplerate = samplerate;
+	m_outgoing_max_payload = AUDIO_PAYLOAD_HEADER_SIZE + channels * max_frames * sizeof(AUDIO_BUFFER_T);
+	m_outgoing_payload.reserve(m_outgoing_max_payload);
+	m_outgoing_batch.reserve(AUDIO_BATCH_HEADER_SIZE + (m_outgoing_max_payload + 4) * m_batch_blocks);
+	m_outgoing_channels.reserve(channels);
+}
+
+void AudioComponentBase::set_outgoing_batching(size_t batch_blocks, double max_latency_ms, size_t max_bytes)
+{
+	flush_outgoing_batch();
+	m_batch_blocks = std::min<size_t>(std::max<size_t>(batch_blocks, 1), AUDIO_BATCH_MAX_PAYLOADS);
+	m_batch_max_latency_ms = std::max(max_latency_ms, 0.0);
+	m_batch_max_bytes = max_bytes;
+	m_outgoing_batch.reserve(AUDIO_BATCH_HEADER_SIZE + (m_outgoing_max_payload + 4) * m_batch_blocks);
+	Log::entity(Log::Level::debug, "Batching {} blocks per message, max latency {}ms, max bytes {}", m_batch_blocks, m_batch_max_latency_ms, m_batch_max_bytes);
+}
+
+void AudioComponentBase::set_batching(ZstInputPlug* plug)
+{
+	// Blocks per message, then optional max latency in milliseconds and max bytes
+	if (plug->size() < 1)
+		return;
+	size_t blocks = size_t(std::max(1.0f, plug->float_at(0)));
+	double max_latency_ms = (plug->size() > 1) ? double(plug->float_at(1)) : 0.0;
+	size_t max_bytes = (plug->size() > 2) ? size_t(std::max(0.0f, plug->float_at(2))) : 0;
+	set_outgoing_batching(blocks, max_latency_ms, max_bytes);
+}
+
+void AudioComponentBase::set_outgoing_sample_type(AudioKernels::SampleFormat sample_type)
+{
+	m_outgoing_header.sample_type = sample_type;
+}
+
+void AudioComponentBase::set_outgoing_codec(AudioPayload::Codec codec)
+{
+	if (codec != AudioPayload::Codec::None && !AudioPayload::supports_lossless(m_outgoing_header.sample_type))
+		Log::entity(Log::Level::warn, "Lossless payload compression needs an int16 or int24 payload format, sending uncompressed");
+	m_outgoing_header.codec = codec;
+}
+
+void AudioComponentBase::publish_audio(const AUDIO_BUFFER_T* planar, size_t channels, size_t frames, uint64_t timestamp)
+{
+	m_outgoing_channels.resize(channels);
+	for (size_t channel = 0; channel < channels; ++channel)
+		m_outgoing_channels[channel] = planar + channel * frames;
+	publish_audio(m_outgoing_channels.data(), channels, frames, timestamp);
+}
+
+void AudioComponentBase::publish_audio(const AUDIO_BUFFER_T* const* channel_buffers, size_t channels, size_t frames, uint64_t timestamp)
+{
+	m_outgoing_header.channels = uint16_t(channels);
+	m_outgoing_header.frames = uint32_t(frames);
+	m_outgoing_header.timestamp = timestamp ? timestamp : uint64_t(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::system_clock::now().time_since_epoch()).count());
+	AudioPayload::encode(m_outgoing_header, channel_buffers, m_outgoing_payload);
+	m_outgoing_header.sequence++;
+
+	// Unbatched links send plain payloads
+	if (m_batch_blocks <= 1 && m_batch_max_latency_ms <= 0.0) {
+		send_outgoing(m_outgoing_payload);
+		return;
+	}
+
+	// Send what's queued first if this block would push the batch over the byte budget
+	if (m_batched_blocks && m_batch_max_bytes && m_outgoing_batch.size() + 4 + m_outgoing_payload.size() > m_batch_max_bytes)
+		flush_outgoing_batch();
+
+	if (!m_batched_blocks) {
+		AudioPayload::begin_batch(m_outgoing_batch);
+		m_batch_started = std::chrono::steady_clock::now();
+	}
+	m_batched_blocks = AudioPayload::append_to_batch(m_outgoing_batch, m_outgoing_payload.data(), m_outgoing_payload.size());
+	m_batched_frames += frames;
+
+	double batched_ms = m_outgoing_header.samplerate ? double(m_batched_frames) * 1000.0 / m_outgoing_header.samplerate : 0.0;
+	if (m_batched_blocks >= m_batch_blocks || (m_batch_max_latency_ms > 0.0 && batched_ms >= m_batch_max_latency_ms))
+		flush_outgoing_batch();
+}
+
+void AudioComponentBase::flush_outgoing_batch()
+{
+	if (!m_batched_blocks)
+		return;
+	send_outgoing(m_outgoing_batch);
+	m_batched_blocks = 0;
+	m_batched_frames = 0;
+}
+
+void AudioComponentBase::send_outgoing(const std::vector<uint8_t>& payload)
+{
+	outgoing_audio()->raw_value()->assign(payload.data(), payload.size());
+	outgoing_audio()->fire();
+}
+
+size_t AudioComponentBase::unpack_plug_audio(ZstInputPlug* plug)
+{
+	m_unpacked_input = input_index(plug);
+	if (m_unpacked_input >= m_input_reorder.size())
+		return 0;
+
+	return unpack_payload(plug->raw_value()->byte_buffer(), plug->size(), plug);
+}
+
+size_t AudioComponentBase::unpack_payload(const uint8_t* data, size_t size, ZstInputPlug* plug)
+{
+	if (!AudioPayload::split_batch(data, size, m_incoming_spans))
+		Log::entity(Log::Level::warn, "Dropping malformed audio batch on {}", plug->URI().path());
+
+	size_t decoded = 0;
+	AudioReorderBuffer& reorder = *m_input_reorder[m_unpacked_input];
+	for (const auto& span : m_incoming_spans) {
+		AudioPayload::Header header;
+		if (!AudioPayload::decode_header(span.data, span.size, header))
+			continue;
+
+		// Only grows when a bigger block than any before arrives, and decode_header caps that at AUDIO_PAYLOAD_MAX_SAMPLES
+		size_t samples = size_t(header.channels) * header.frames;
+		if (m_incoming_samples.size() < samples)
+			m_incoming_samples.resize(samples);
+		if (!AudioPayload::decode_body(header, span.data, span.size, m_incoming_samples.data()))
+			continue;
+
+		AudioBlockView block{ nullptr, 0, 0, 0, 0, 0 };
+		block.samples = m_incoming_samples.data();
+		block.channels = header.channels;
+		block.frames = header.frames;
+		block.samplerate = header.samplerate;
+		block.sequence = header.sequence;
+		block.timestamp = header.timestamp;
+		reorder.push(block);
+		decoded++;
+	}
+	return decoded;
+}
+
+AudioBlockView AudioComponentBase::next_unpacked_block()
+{
+	if (m_unpacked_input >= m_input_reorder.size())
+		return AudioBlockView{ nullptr, 0, 0, 0, 0, 0 };
+	return m_input_reorder[m_unpacked_input]->pop();
+}
+
+size_t AudioComponentBase::input_index(ZstInputPlug* plug) const
+{
+	// IN_audio is input 0, IN_mix_N is input N. Anything else gets an index past the end
+	if (plug == m_incoming_network_audio.get())
+		return 0;
+	size_t index = 0;
+	while (index < m_mix_inputs.size() && m_mix_inputs[index].get() != plug)
+		++index;
+	return (index < m_mix_inputs.size()) ? index + 1 : m_input_reorder.size();
+}
+
+void AudioComponentBase::enable_mixing(size_t sources)
+{
+	if (sources < 2 || !m_mix_sources.empty())
+		return;
+
+	for (size_t source = 0; source < sources; ++source) {
+		m_mix_sources.push_back(std::make_unique<MixSource>());
+		if (source > 0) {
+			m_input_reorder.push_back(std::make_unique<AudioReorderBuffer>());
+			m_mix_inputs.push_back(std::make_shared<ZstInputPlug>(("IN_mix_" + std::to_string(source)).c_str(), ZstValueType::ByteList, 1));
+		}
+	}
+	m_mix_gain_in = std::make_shared<ZstInputPlug>("IN_mix_gain", ZstValueType::FloatList, 1);
+	m_mix_gains = std::make_unique<std::atomic<float>[]>(sources);
+	for (size_t source = 0; source < sources; ++source)
+		m_mix_gains[source].store(1.0f);
+}
+
+void AudioComponentBase::prepare_mixing(size_t channels, size_t block_frames)
+{
+	if (m_mix_sources.empty())
+		return;
+
+	m_mix_channels = channels;
+	m_mix_block_frames = block_frames;
+	for (auto& source : m_mix_sources) {
+		source->ring.resize(channels, block_frames * (AUDIO_MIX_MAX_LAG_BLOCKS + 1));
+		source->written = source->read = source->loud_until = 0;
+	}
+	m_mix_buffer.assign(channels * block_frames, 0.0f);
+	m_mix_scratch.assign(channels * block_frames, 0.0f);
+}
+
+bool AudioComponentBase::mixing_enabled() const
+{
+	return !m_mix_sources.empty() && m_mix_block_frames;
+}
+
+bool AudioComponentBase::is_audio_input(ZstInputPlug* plug) const
+{
+	if (plug == m_incoming_network_audio.get())
+		return true;
+	for (const auto& input : m_mix_inputs) {
+		if (plug == input.get())
+			return true;
+	}
+	return false;
+}
+
+void AudioComponentBase::queue_mix_source(ZstInputPlug* plug)
+{
+	size_t index = input_index(plug);
+	if (index >= m_mix_sources.size())
+		return;
+
+	unpack_plug_audio(plug);
+	for (auto block = next_unpacked_block(); block.frames; block = next_unpacked_block()) {
+		// Mixed blocks follow IN_audio's cadence, so a change in its block size doesn't add latency or bursts downstream
+		if (index == 0 && block.frames != m_mix_block_frames) {
+			Log::entity(Log::Level::debug, "Mixing in blocks of {} frames to match IN_audio", block.frames);
+			prepare_mixing(m_mix_channels, block.frames);
+		}
+		if (index == 0)
+			m_mix_samplerate = block.samplerate;
+
+		MixSource& source = *m_mix_sources[index];
+		size_t written = source.ring.write(block.samples, block.frames, block.frames, block.channels);
+		source.written += written;
+
+		// Finding a non-zero sample usually stops at the first one, so this is far cheaper than mixing silence
+		const AUDIO_BUFFER_T* end = block.samples + block.frames * std::min(block.channels, m_mix_channels);
+		if (std::find_if(block.samples, end, [](AUDIO_BUFFER_T sample) { return sample != 0.0f; }) != end)
+			source.loud_until = source.written;
+	}
+}
+
+AudioBlockView AudioComponentBase::next_mixed_block()
+{
+	AudioBlockView block{ nullptr, 0, 0, 0, 0, 0 };
+	const size_t frames = m_mix_block_frames;
+	if (!mixing_enabled())
+		return block;
+
+	// IN_audio sets the pace. Other sources only force a block out if it has stopped delivering
+	const bool clocked = m_mix_sources[0]->ring.read_available() >= frames;
+	bool ready = clocked;
+	for (size_t index = 1; index < m_mix_sources.size() && !ready; ++index)
+		ready = m_mix_sources[index]->ring.read_available() >= frames * AUDIO_MIX_MAX_LAG_BLOCKS;
+	if (!ready)
+		return block;
+
+	std::fill(m_mix_buffer.begin(), m_mix_buffer.end(), 0.0f);
+	for (size_t index = 0; index < m_mix_sources.size(); ++index) {
+		MixSource& source = *m_mix_sources[index];
+		size_t available = source.ring.read_available();
+		if (available < frames)
+			continue;
+
+		// Drop the backlog a source has built up behind IN_audio so it lines up with it again
+		if (clocked && available >= frames * AUDIO_MIX_MAX_LAG_BLOCKS)
+			source.read += source.ring.discard(available - frames);
+
+		float gain = m_mix_gains[index].load(std::memory_order_relaxed);
+		bool loud = source.loud_until > source.read;
+		if (!loud || gain == 0.0f) {
+			source.read += source.ring.discard(frames);
+			continue;
+		}
+
+		source.read += source.ring.read(m_mix_scratch.data(), frames, frames);
+		for (size_t channel = 0; channel < m_mix_channels; ++channel)
+			AudioKernels::mix_add(m_mix_scratch.data() + channel * frames, m_mix_buffer.data() + channel * frames, gain, frames);
+	}
+
+	block.samples = m_mix_buffer.data();
+	block.channels = m_mix_channels;
+	block.frames = frames;
+	block.samplerate = m_mix_samplerate;
+	return block;
+}
+
+void AudioComponentBase::set_mix_gains(ZstInputPlug* plug)
+{
+	// One gain per source. A single value applies to every source
+	for (size_t index = 0; index < m_mix_sources.size(); ++index) {
+		if (plug->size() == 1)
+			m_mix_gains[index].store(plug->float_at(0), std::memory_order_relaxed);
+		else if (index < plug->size())
+			m_mix_gains[index].store(plug->float_at(index), std::memory_order_relaxed);
+	}
+}
+
+void AudioComponentBase::publish_load()
+{
+	auto now = std::chrono::steady_clock::now();
+	if (now - m_last_load_report < LOAD_REPORT_INTERVAL)
+		return;
+	m_last_load_report = now;
+
+	auto load = m_load_monitor.summarize_window();
+	if (!load.blocks)
+		return;
+
+	m_load_out->raw_value()->clear();
+	m_load_out->append_float(float(load.p50));
+	m_load_out->append_float(float(load.p99));
+	m_load_out->append_float(float(load.max));
+	m_load_out->append_float(float(load.blocks));
+	m_load_out->fire();
+}
+
+void AudioComponentBase::publish_link_stats()
+{
+	auto now = std::chrono::steady_clock::now();
+	if (now - m_last_link_stats_report < LINK_STATS_INTERVAL)
+		return;
+	m_last_link_stats_report = now;
+
+	// Cumulative blocks received, lost, concealed, reordered, late, duplicated and sequence resyncs
+	uint64_t counters[7] = { 0 };
+	for (const auto& reorder : m_input_reorder) {
+		const auto& stats = reorder->stats();
+		counters[0] += stats.received.load(std::memory_order_relaxed);
+		counters[1] += stats.lost.load(std::memory_order_relaxed);
+		counters[2] += stats.concealed.load(std::memory_order_relaxed);
+		counters[3] += stats.reordered.load(std::memory_order_relaxed);
+		counters[4] += stats.late.load(std::memory_order_relaxed);
+		counters[5] += stats.duplicates.load(std::memory_order_relaxed);
+		counters[6] += stats.resyncs.load(std::memory_order_relaxed);
+	}
+	if (!counters[0])
+		return;
+
+	m_link_stats_out->raw_value()->clear();
+	for (auto counter : counters)
+		m_link_stats_out->append_int(int(std::min<uint64_t>(counter, std::numeric_limits<int>::max())));
+	m_link_stats_out->fire();
+}
+
+void AudioComponentBase::dump_load_histogram()
+{
+	std::vector<uint64_t> counts;
+	m_load_monitor.lifetime_counts(counts);
+
+	uint64_t total = 0;
+	for (auto count : counts)
+		total += count;
+
+	Log::entity(Log::Level::notification, "Load histogram for {}: {} blocks, max {:.2f}%", URI().path(), total, double(m_load_monitor.lifetime_max()) * 100.0 / AUDIO_LOAD_FULL_SCALE);
+	for (size_t bucket = 0; bucket < counts.size(); ++bucket) {
+		if (counts[bucket])
+			Log::entity(Log::Level::notification, "  {:.2f}% - {:.2f}%: {}", AudioLoadMonitor::bucket_lower_percent(bucket), AudioLoadMonitor::bucket_upper_percent(bucket), counts[bucket]);
+	}
+}
@@ -5,19 +5,186 @@
 #include <showtime/entities/ZstPlug.h>
 
 #include <boost/circular_buffer.hpp>
+#include <atomic>
+#include <chrono>
 #include <memory>
+#include <vector>
 
-typedef float AUDIO_BUFFER_T;
+#include "AudioBlock.h"
+#include "AudioGraph.h"
+#include "AudioLoadMonitor.h"
+#include "AudioPayload.h"
+#include "AudioReorderBuffer.h"
+#include "AudioRingBuffer.h"
+
+// A mix source further behind than this many blocks is trimmed back so it stays aligned with the others
+#define AUDIO_MIX_MAX_LAG_BLOCKS 3
 
 class AudioComponentBase : public showtime::ZstComponent
 {
 public:
 	ZST_PLUGIN_EXPORT AudioComponentBase(const char* component_type, const char* name);
+	ZST_PLUGIN_EXPORT virtual ~AudioComponentBase();
 	ZST_PLUGIN_EXPORT virtual void on_registered() override;
+	ZST_PLUGIN_EXPORT virtual void on_tick() override;
 
 	showtime::ZstInputPlug* incoming_audio();
 	showtime::ZstOutputPlug* outgoing_audio();
+
+	// In-process graph (see AudioGraph). Components that can render synchronously inside another device's callback
+	// report how many channels they render and the largest block they take. 0 channels keeps them off the graph
+	virtual size_t graph_channels() const;
+	virtual size_t graph_max_frames() const;
+
+	// Sources have no inputs in the graph and ignore the input they are given
+	virtual bool is_graph_source() const;
+
+	// Samplerate the component renders at, or 0 if it takes whatever it is given. Everything in a graph runs at the
+	// sink's rate, so the tick thread asks a node at another rate to switch before it joins, and leaves it out if it can't
+	virtual uint32_t graph_samplerate() const;
+	virtual bool set_graph_samplerate(uint32_t samplerate);
+
+	// Called from the audio thread of the sink running the graph, or one of its worker threads, once per block. input
+	// is everything feeding the component summed with its mix gains. Renders frames of planar audio into output, which
+	// holds graph_channels() * frames samples, and returns the number of channels rendered
+	virtual size_t render_graph_block(const AudioBlockView& input, AUDIO_BUFFER_T* output, size_t frames);
+
+	// The sink whose graph this component is part of, or nullptr. Exclusive means every outgoing cable leads into
+	// that graph, so there is nothing left to publish. Only set from the tick thread
+	virtual void set_graph_owner(AudioComponentBase* sink, bool exclusive);
+	AudioComponentBase* graph_owner() const;
+	bool graph_exclusive() const;
+
+	// IN_audio is audio input 0, IN_mix_N is audio input N
+	size_t audio_input_count() const;
+	showtime::ZstInputPlug* audio_input(size_t index);
+
+	// Gain IN_mix_gain sets for an audio input, 1 without mixing. Safe to read from any thread
+	float mix_gain(size_t index) const;
+
 protected:
+	virtual void compute(showtime::ZstInputPlug* plug) override;
+
+	// Audio travels as AudioPayload frames in ByteList plugs.
+	// Preallocates the outgoing payload so publishing doesn't allocate
+	void prepare_outgoing_audio(size_t channels, size_t max_frames, uint32_t samplerate);
+
+	// Float32 by default. Int16 and Int24 bodies halve or quarter the bandwidth at the cost of quantisation
+	void set_outgoing_sample_type(AudioKernels::SampleFormat sample_type);
+
+	// Off by default. Lossless compression only applies to Int16 and Int24 payloads - Float32 is always sent as is.
+	// Incoming payloads are decompressed automatically
+	void set_outgoing_codec(AudioPayload::Codec codec);
+
+	// Publishes a block of audio on the outgoing plug, either from one contiguous planar buffer or from per-channel buffers.
+	// timestamp is the system clock time in ns the block's first frame was captured. Receivers add their playout delay
+	// to it to schedule the frame, so pass the capture time when it is known. 0 stamps the block with the current time
+	void publish_audio(const AUDIO_BUFFER_T* planar, size_t channels, size_t frames, uint64_t timestamp = 0);
+	void publish_audio(const AUDIO_BUFFER_T* const* channel_buffers, size_t channels, size_t frames, uint64_t timestamp = 0);
+
+	// Packetizing. Published blocks are held back and sent together once there are batch_blocks of them,
+	// once they cover max_latency_ms of audio or before they would grow past max_bytes. 0 turns a limit off.
+	// One block per message is the default. IN_batch changes the same settings at runtime
+	void set_outgoing_batching(size_t batch_blocks, double max_latency_ms, size_t max_bytes);
+
+	// Decodes every block in the current value of an audio input - several for a batch, otherwise one - into that
+	// input's reorder window. Malformed payloads are skipped. Returns the number of blocks decoded
+	size_t unpack_plug_audio(showtime::ZstInputPlug* plug);
+
+	// Next block of the last unpacked input in sequence order. Blocks that went missing come back concealed once the
+	// reorder window has moved past them. Returns an empty view when nothing more is ready. The view stays valid until the next call
+	AudioBlockView next_unpacked_block();
+
+	// Mixing mode. IN_audio becomes source 0 and IN_mix_1 .. IN_mix_<sources - 1> are added alongside it,
+	// each with its own small ring. IN_mix_gain takes one gain per source. Call enable_mixing from the constructor
+	void enable_mixing(size_t sources);
+	void prepare_mixing(size_t channels, size_t block_frames);
+	bool mixing_enabled() const;
+
+	// True for IN_audio and the mix inputs
+	bool is_audio_input(showtime::ZstInputPlug* plug) const;
+
+	// Queues the current value of an audio input into its source ring. Mixed blocks are the size of IN_audio's blocks,
+	// so the rings are prepared again whenever that changes
+	void queue_mix_source(showtime::ZstInputPlug* plug);
+
+	// Sums the next block once IN_audio has delivered one, or once another source has run AUDIO_MIX_MAX_LAG_BLOCKS ahead.
+	// Sources without a full block yet are late and skipped, silent or muted sources are discarded without mixing.
+	// Mixed blocks carry IN_audio's samplerate. Returns an empty view when no block is ready. The view stays valid until the next call
+	AudioBlockView next_mixed_block();
+
 	std::shared_ptr<showtime::ZstInputPlug> m_incoming_network_audio;
 	std::shared_ptr<showtime::ZstOutputPlug> m_outgoing_network_audio;
+
+	// Takes this component out of every compiled graph. Derived classes call it first thing in their destructor,
+	// before anything a running graph might use is torn down
+	void leave_graph();
+
+	// Processing time per block. Wrap the block processing in an AudioLoadMonitor::Scope to record it
+	AudioLoadMonitor m_load_monitor;
+
+private:
+	void publish_load();
+	void publish_link_stats();
+	size_t input_index(showtime::ZstInputPlug* plug) const;
+	void dump_load_histogram();
+	void set_mix_gains(showtime::ZstInputPlug* plug);
+	void set_batching(showtime::ZstInputPlug* plug);
+	void flush_outgoing_batch();
+	void send_outgoing(const std::vector<uint8_t>& payload);
+	size_t unpack_payload(const uint8_t* data, size_t size, showtime::ZstInputPlug* plug);
+
+	struct MixSource {
+		AudioRingBuffer<AUDIO_BUFFER_T> ring;
+		uint64_t written = 0;
+		uint64_t read = 0;
+
+		// Write position just past the last non-silent block queued
+		uint64_t loud_until = 0;
+	};
+
+	std::vector<uint8_t> m_outgoing_payload;
+	std::vector<const AUDIO_BUFFER_T*> m_outgoing_channels;
+	AudioPayload::Header m_outgoing_header;
+	size_t m_outgoing_max_payload;
+	std::vector<AUDIO_BUFFER_T> m_incoming_samples;
+	std::vector<AudioPayload::Span> m_incoming_spans;
+
+	// Sequence reordering and loss concealment - one window per audio input, IN_audio first
+	std::vector<std::unique_ptr<AudioReorderBuffer>> m_input_reorder;
+	size_t m_unpacked_input;
+
+	// OUT_link_stats carries the reorder counters summed over every audio input
+	std::shared_ptr<showtime::ZstOutputPlug> m_link_stats_out;
+	std::chrono::steady_clock::time_point m_last_link_stats_report;
+
+	// Packetizing - blocks published since the last send
+	std::shared_ptr<showtime::ZstInputPlug> m_batch_in;
+	std::vector<uint8_t> m_outgoing_batch;
+	size_t m_batch_blocks;
+	double m_batch_max_latency_ms;
+	size_t m_batch_max_bytes;
+	size_t m_batched_blocks;
+	size_t m_batched_frames;
+	std::chrono::steady_clock::time_point m_batch_started;
+
+	// Graph membership - only touched from the tick thread
+	AudioComponentBase* m_graph_owner;
+	bool m_graph_exclusive;
+
+	// Load reporting - OUT_load carries p50, p99 and max load in percent of the block period and the number of blocks measured
+	std::shared_ptr<showtime::ZstOutputPlug> m_load_out;
+	std::shared_ptr<showtime::ZstInputPlug> m_dump_load_in;
+	std::chrono::steady_clock::time_point m_last_load_report;
+
+	// Mixing - all of this is only touched from compute, apart from the gains which graphs read from the audio thread
+	std::vector<std::shared_ptr<showtime::ZstInputPlug>> m_mix_inputs;
+	std::shared_ptr<showtime::ZstInputPlug> m_mix_gain_in;
+	std::vector<std::unique_ptr<MixSource>> m_mix_sources;
+	std::unique_ptr<std::atomic<float>[]> m_mix_gains;
+	std::vector<AUDIO_BUFFER_T> m_mix_buffer;
+	std::vector<AUDIO_BUFFER_T> m_mix_scratch;
+	size_t m_mix_channels;
+	size_t m_mix_block_frames;
+	uint32_t m_mix_samplerate;
 };
@@ -1,104 +1,197 @@
 #include "AudioDevice.h"
 #include "RtAudio.h"
 #include <showtime/ZstLogging.h>
+#include <limits>
 
 using namespace showtime;
 using namespace std::placeholders;
 
+#define JITTER_STATUS_INTERVAL std::chrono::milliseconds(250)
+#define STATS_REPORT_INTERVAL std::chrono::seconds(1)
 
-AudioDevice::AudioDevice(const char* name, size_t device_index, size_t num_inputs, size_t num_outputs, unsigned long native_formats_bmask) : 
+
+AudioDevice::AudioDevice(const char* name, std::shared_ptr<AudioStream> stream, size_t first_input, size_t num_inputs, size_t first_output, size_t num_outputs, const AudioDeviceConfig& config) : 
 	AudioComponentBase(AUDIODEVICE_COMPONENT_TYPE, name),
-	m_audio_device(std::make_shared<RtAudio>()),
-	m_num_inputs(num_inputs),
-	m_num_outputs(num_outputs),
-	m_audio_data(std::make_shared<AudioData>()),
-	bLogAmplitude(true)
-{
-	Log::entity(Log::Level::notification, "Creating audio device {} with device ID {} {}", URI().last().path(), device_index, sizeof(AUDIO_BUFFER_T));
-
-	double time = 0.1;
-	unsigned long samplerate = 44100;
-	unsigned int bufferFrames =  512;
-
-	RtAudio::StreamParameters outparams;
-	outparams.deviceId = device_index;
-	outparams.nChannels = num_outputs;
-	
-	RtAudio::StreamParameters inparams;
-	inparams.deviceId = device_index;
-	inparams.nChannels = num_inputs;
-
-	bool supports_byte_format = (native_formats_bmask & RTAUDIO_SINT8) == RTAUDIO_SINT8;
-	RtAudioFormat format = RTAUDIO_FLOAT32;
-	
-	RtAudio::StreamOptions opts;
-	opts.flags = RTAUDIO_NONINTERLEAVED;// | RTAUDIO_MINIMIZE_LATENCY;
-
-	try {
-		RtAudioCallback cb = [](void* outputBuffer, void* inputBuffer, unsigned int nBufferFrames, double streamTime, RtAudioStreamStatus status, void* data) -> int {
-			return ((AudioDevice*)data)->audio_callback(outputBuffer, inputBuffer, nBufferFrames, streamTime, status, data);
-		};
-		m_audio_device->openStream((num_outputs) ? &outparams : nullptr, (num_inputs) ? &inparams : nullptr, format, samplerate, &bufferFrames, cb, (void*)this, &opts);
-	} 
-	catch (RtAudioError& e) {
-		Log::entity(Log::Level::error, e.getMessage().c_str());
-	}
-
-	size_t total_channels = (num_inputs + num_outputs);
-	m_audio_data->read_offset = 0;
-	m_audio_data->write_offset = 0;
-	m_audio_data->bufferBytes = bufferFrames * total_channels * sizeof(AUDIO_BUFFER_T);
-	m_audio_data->totalFrames = (unsigned long)samplerate;
-	m_audio_data->frameCounter = 0;
-	m_audio_data->channels = total_channels;
-	unsigned long totalBytes;
-	totalBytes = m_audio_data->totalFrames * total_channels * sizeof(AUDIO_BUFFER_T);
-	
-	// Allocate the entire data buffer before starting stream.
-	m_audio_data->buffer = boost::circular_buffer< AUDIO_BUFFER_T>(bufferFrames * total_channels);
-	m_received_network_audio_buffer_left = std::make_shared<boost::circular_buffer< AUDIO_BUFFER_T>>(bufferFrames * 4);
-	m_received_network_audio_buffer_right = std::make_shared<boost::circular_buffer< AUDIO_BUFFER_T>>(bufferFrames * 4);
-	for (size_t idx = 0; idx < bufferFrames * 4; ++idx) {
-		m_received_network_audio_buffer_left->push_back(0.0);
-		m_received_network_audio_buffer_right->push_back(0.0);
-	}
-
-	try {
-		m_audio_device->startStream();
-	}
-	catch (RtAudioError& e) {
-		Log::entity(Log::Level::error, e.getMessage().c_str());
+	m_stream(stream),
+	m_idle(false),
+	m_reopen_attempted(false),
+	m_first_input(std::min(first_input, stream->num_inputs())),
+	m_num_inputs(std::min(num_inputs, stream->num_inputs() - m_first_input)),
+	m_first_output(std::min(first_output, stream->num_outputs())),
+	m_num_outputs(std::min(num_outputs, stream->num_outputs() - m_first_output)),
+	m_buffer_frames(stream->buffer_frames()),
+	m_samplerate(stream->samplerate()),
+	bLogAmplitude(true),
+	m_stream_info_published(false),
+	m_capture_epoch_ns(0),
+	m_captured_frames(0),
+	m_published_frames(0),
+	m_graph_tap_enabled(false),
+	m_target_latency_in(std::make_shared<ZstInputPlug>("IN_target_latency", ZstValueType::FloatList, 1)),
+	m_buffer_fill_out(std::make_shared<ZstOutputPlug>("OUT_buffer_fill", ZstValueType::FloatList)),
+	m_drift_ratio_out(std::make_shared<ZstOutputPlug>("OUT_drift_ratio", ZstValueType::FloatList)),
+	m_playout_delay_in(std::make_shared<ZstInputPlug>("IN_playout_delay", ZstValueType::FloatList, 1)),
+	m_schedule_error_out(std::make_shared<ZstOutputPlug>("OUT_schedule_error", ZstValueType::FloatList)),
+	m_stream_info_out(std::make_shared<ZstOutputPlug>("OUT_stream_info", ZstValueType::IntList)),
+	m_monitor_gain_in(std::make_shared<ZstInputPlug>("IN_monitor_gain", ZstValueType::FloatList, 1)),
+	m_monitor_gains(std::make_unique<std::atomic<float>[]>(m_num_outputs)),
+	m_monitor_enabled(false),
+	m_stats_out(std::make_shared<ZstOutputPlug>("OUT_stats", ZstValueType::IntList))
+{
+	Log::entity(Log::Level::notification, "Creating audio device {} on {} with inputs {}-{} and outputs {}-{}", URI().last().path(), m_stream->handle().name.c_str(), 
+		m_first_input, m_first_input + m_num_inputs, m_first_output, m_first_output + m_num_outputs);
+
+	// Allocate all buffers from the negotiated stream before joining it
+	size_t bufferFrames = m_buffer_frames;
+	m_captured_audio.resize(m_num_inputs, std::max<size_t>(m_samplerate / 2, bufferFrames * 16));
+	m_publish_buffer.assign(m_num_inputs * bufferFrames, 0.0f);
+	m_graph_tap.resize(m_num_inputs, bufferFrames * AUDIODEVICE_GRAPH_TAP_BLOCKS);
+	prepare_outgoing_audio(m_num_inputs, bufferFrames, m_samplerate);
+	set_outgoing_sample_type(config.payload_format);
+	set_outgoing_codec(config.payload_codec);
+	set_outgoing_batching(config.batch_blocks, config.batch_max_latency_ms, config.batch_max_bytes);
+	m_graph.set_threads(config.graph_threads, config.schedule_realtime ? std::max(config.priority, 1) : 0);
+	if (m_num_outputs) {
+		enable_mixing(config.mix_inputs);
+		prepare_mixing(m_num_outputs, bufferFrames);
 	}
+	m_received_network_audio.prepare(m_num_outputs, bufferFrames, std::max<size_t>(m_samplerate, bufferFrames * 16), m_samplerate);
+	m_received_network_audio.set_target_latency(bufferFrames * 4);
+	set_playout_delay(config.playout_delay_ms);
+	for (size_t channel = 0; channel < m_num_outputs; ++channel)
+		m_monitor_gains[channel].store(0.0f);
+
+	m_stream->attach(this);
 }
 
 AudioDevice::~AudioDevice()
 {
-	if (m_audio_device) {
-		m_audio_device->closeStream();
+	// Other sinks stop pulling from us before the stream goes, and our own graph can only be dropped once it has
+	leave_graph();
+	m_stream->detach(this);
+	m_graph.clear(this);
+}
+
+void AudioDevice::on_registered()
+{
+	AudioComponentBase::on_registered();
+	add_child(m_target_latency_in.get());
+	add_child(m_buffer_fill_out.get());
+	add_child(m_drift_ratio_out.get());
+	if (m_num_outputs) {
+		add_child(m_playout_delay_in.get());
+		add_child(m_schedule_error_out.get());
+	}
+	add_child(m_stream_info_out.get());
+	add_child(m_stats_out.get());
+
+	// Local monitoring only makes sense when the device can both record and play
+	if (m_num_inputs && m_num_outputs)
+		add_child(m_monitor_gain_in.get());
+}
+
+void AudioDevice::on_tick()
+{
+	AudioComponentBase::on_tick();
+	if (m_idle) {
+		resume();
+		return;
+	}
+	if (!m_stream->handle().present.load()) {
+		go_idle();
+		return;
+	}
+
+	if (!m_stream_info_published) {
+		publish_stream_info();
+		m_stream_info_published = true;
+	}
+	publish_captured_audio();
+	publish_jitter_status();
+	publish_stats();
+	if (m_num_outputs)
+		m_graph.update(this, m_buffer_frames);
+}
+
+void AudioDevice::go_idle()
+{
+	// Stop the stream rather than letting the driver keep failing on missing hardware. The entity stays around but does nothing
+	Log::entity(Log::Level::warn, "Audio device {} was removed, closing its stream", m_stream->handle().name.c_str());
+	m_stream->close();
+	m_idle = true;
+}
+
+void AudioDevice::resume()
+{
+	// Try once each time the hardware comes back. The factory keeps the handle of an unplugged device for when it does
+	if (!m_stream->handle().present.load()) {
+		m_reopen_attempted = false;
+		return;
+	}
+	if (m_reopen_attempted)
+		return;
+
+	m_reopen_attempted = true;
+	if (!m_stream->reopen()) {
+		Log::entity(Log::Level::warn, "Audio device {} is back but its stream could not be reopened", m_stream->handle().name.c_str());
+		return;
+	}
+	Log::entity(Log::Level::notification, "Audio device {} is back, resuming its stream", m_stream->handle().name.c_str());
+	m_idle = false;
+	m_stream_info_published = false;
+}
+
+void AudioDevice::publish_stream_info()
+{
+	// Negotiated stream settings: samplerate, buffer frames, stream latency, inputs, outputs
+	m_stream_info_out->raw_value()->clear();
+	m_stream_info_out->append_int(int(m_samplerate));
+	m_stream_info_out->append_int(int(m_buffer_frames));
+	m_stream_info_out->append_int(int(m_stream->latency()));
+	m_stream_info_out->append_int(int(m_num_inputs));
+	m_stream_info_out->append_int(int(m_num_outputs));
+	m_stream_info_out->fire();
+}
+
+void AudioDevice::publish_captured_audio()
+{
+	// Publish whole device blocks so receivers see the same cadence as the callback
+	while (m_buffer_frames && m_captured_audio.read_available() >= m_buffer_frames) {
+		m_captured_audio.read(m_publish_buffer.data(), m_buffer_frames, m_buffer_frames);
+
+		// Stamp each block with when its first frame was captured on the shared clock
+		int64_t epoch = m_capture_epoch_ns.load(std::memory_order_acquire);
+		uint64_t timestamp = epoch ? uint64_t(epoch + frames_to_ns(m_published_frames, m_samplerate)) : 0;
+		m_published_frames += m_buffer_frames;
+
+		// A graph pulls its own copy, so if that is the only place the audio goes nothing is sent
+		if (graph_exclusive())
+			continue;
+		publish_audio(m_publish_buffer.data(), m_captured_audio.channels(), m_buffer_frames, timestamp);
 	}
 }
 
 void AudioDevice::compute(ZstInputPlug* plug)
 {
-	if (plug == m_incoming_network_audio.get()) {
+	if (is_audio_input(plug)) {
+		// While a graph renders straight into the output the network copy of the same audio isn't needed
+		if (m_idle || m_graph.running())
+			return;
+
 		float total = 0.0;
 		std::string buffer_str;
 		
-		size_t r_channel_offset = floor(abs(incoming_audio()->size()*0.5));
-		Log::entity(Log::Level::error, "Write");
-
-		for (size_t channel = 0; channel < 2; ++channel) {
-			auto in_buf = (channel == 0) ? m_received_network_audio_buffer_left : m_received_network_audio_buffer_right;
-			auto channel_offset = (channel == 0) ? 0 : r_channel_offset;
-			for (size_t idx = 0; idx < r_channel_offset; ++idx) {
-				//float draw_buffer_end = (idx < r_channel_offset - 1) ? m_incoming_network_audio->float_at(((channel == 0) ? 0 : r_channel_offset) + idx) : 1.0;
-				std::scoped_lock<std::mutex> lock(m_incoming_audio_lock);
-				in_buf->push_back(incoming_audio()->float_at(((channel == 0) ? 0 : r_channel_offset) + idx));
-			}
+		// Payload channels map onto device outputs in order. Outputs beyond the payload's channel count play silence
+		if (mixing_enabled()) {
+			queue_mix_source(plug);
+			for (auto block = next_mixed_block(); block.frames; block = next_mixed_block())
+				queue_received_audio(block);
+		}
+		else {
+			unpack_plug_audio(plug);
+			for (auto block = next_unpacked_block(); block.frames; block = next_unpacked_block())
+				queue_received_audio(block);
 		}
-		
-		//m_received_network_audio_buffer_left->assign(m_incoming_network_audio->raw_value()->float_buffer(), m_incoming_network_audio->raw_value()->float_buffer() + r_channel_offset-1);
-		//m_received_network_audio_buffer_right->assign(m_incoming_network_audio->raw_value()->float_buffer() + r_channel_offset, m_incoming_network_audio->raw_value()->float_buffer() + m_incoming_network_audio->size());
 		
 		/*for (size_t idx = 0; idx < m_received_network_audio_buffer->size(); ++idx) {
 			if (bLogAmplitude) {
@@ -117,41 +210,204 @@ void AudioDevice::compute(ZstInputPlug* plug)
 			Log::app(Log::Level::debug, buffer_str.c_str());
 		}*/
 	}
+	else if (plug == m_monitor_gain_in.get()) {
+		set_monitor_gains(plug);
+	}
+	else if (plug == m_playout_delay_in.get()) {
+		if (plug->size() >= 1)
+			set_playout_delay(plug->float_at(0));
+	}
+	else if (plug == m_target_latency_in.get()) {
+		if (plug->size() < 1)
+			return;
+
+		// Target latency arrives in milliseconds
+		size_t target_frames = size_t(std::max(0.0f, plug->float_at(0)) * 0.001 * m_received_network_audio.samplerate());
+		m_received_network_audio.set_target_latency(target_frames);
+		Log::entity(Log::Level::debug, "Jitter buffer target latency set to {} frames", m_received_network_audio.target_latency());
+	}
+	else {
+		AudioComponentBase::compute(plug);
+	}
 }
 
-int AudioDevice::audio_callback(void* outputBuffer, void* inputBuffer, unsigned int nBufferFrames, double streamTime, RtAudioStreamStatus status, void* data)
+void AudioDevice::queue_received_audio(const AudioBlockView& block)
 {
-	AudioDevice* data_this = (AudioDevice*)data;
-	if (outputBuffer) {
-		if (status == RTAUDIO_OUTPUT_UNDERFLOW) {
-			Log::entity(Log::Level::warn, "Output underflow");
-		}
-		else if (status == RTAUDIO_INPUT_OVERFLOW) {
-			Log::entity(Log::Level::warn, "Input overflow");
+	if (!block.frames)
+		return;
+	size_t written = m_received_network_audio.write(block.samples, block.frames, block.frames, block.channels, int64_t(block.timestamp));
+	m_stats.increment(m_stats.dropped_frames, block.frames - written);
+}
+
+void AudioDevice::set_monitor_gains(ZstInputPlug* plug)
+{
+	// One gain per output channel. A single value applies to every output and an empty list turns monitoring off
+	bool enabled = false;
+	for (size_t channel = 0; channel < m_num_outputs; ++channel) {
+		float gain = 0.0f;
+		if (plug->size() == 1)
+			gain = plug->float_at(0);
+		else if (channel < plug->size())
+			gain = plug->float_at(channel);
+		m_monitor_gains[channel].store(gain, std::memory_order_relaxed);
+		enabled |= (gain != 0.0f);
+	}
+	m_monitor_enabled.store(enabled && m_num_inputs, std::memory_order_relaxed);
+}
+
+void AudioDevice::set_playout_delay(double delay_ms)
+{
+	// Every receiver of a stream needs the same delay, long enough to cover the slowest link to any of them
+	m_received_network_audio.set_playout_delay(int64_t(std::max(0.0, delay_ms) * 1000000.0));
+	if (delay_ms > 0.0)
+		Log::entity(Log::Level::debug, "Scheduling playout {}ms after capture", delay_ms);
+}
+
+void AudioDevice::publish_jitter_status()
+{
+	auto now = std::chrono::steady_clock::now();
+	if (now - m_last_jitter_status < JITTER_STATUS_INTERVAL)
+		return;
+	m_last_jitter_status = now;
+
+	m_buffer_fill_out->raw_value()->clear();
+	m_buffer_fill_out->append_float(float(m_received_network_audio.fill() * 1000.0 / m_received_network_audio.samplerate()));
+	m_buffer_fill_out->fire();
+
+	m_drift_ratio_out->raw_value()->clear();
+	m_drift_ratio_out->append_float(float(m_received_network_audio.drift_ratio()));
+	m_drift_ratio_out->fire();
+
+	if (m_received_network_audio.playout_delay()) {
+		m_schedule_error_out->raw_value()->clear();
+		m_schedule_error_out->append_float(float(m_received_network_audio.schedule_error() * 1000.0));
+		m_schedule_error_out->fire();
+	}
+}
+
+void AudioDevice::publish_stats()
+{
+	auto now = std::chrono::steady_clock::now();
+	if (now - m_last_stats_report < STATS_REPORT_INTERVAL)
+		return;
+	m_last_stats_report = now;
+
+	// Cumulative counters followed by the jitter buffer fill range (frames) since the last report:
+	// output underflows, input overflows, empty buffers, dropped frames, duplicated frames, fill min, fill max
+	auto stats = m_stats.snapshot();
+	auto append_counter = [this](uint64_t value) {
+		m_stats_out->append_int(int(std::min<uint64_t>(value, std::numeric_limits<int>::max())));
+	};
+	m_stats_out->raw_value()->clear();
+	append_counter(stats.output_underflows);
+	append_counter(stats.input_overflows);
+	append_counter(stats.empty_buffers);
+	append_counter(stats.dropped_frames);
+	append_counter(stats.duplicated_frames);
+	append_counter((stats.fill_min <= stats.fill_max) ? stats.fill_min : 0);
+	append_counter(stats.fill_max);
+	m_stats_out->fire();
+}
+
+void AudioDevice::process_stream_block(const AUDIO_BUFFER_T* input, AUDIO_BUFFER_T* output, size_t frames, RtAudioStreamStatus status, const AudioStreamTime& time)
+{
+	AudioLoadMonitor::Scope load_scope(m_load_monitor, frames, m_samplerate);
+
+	// Nothing in here may log or allocate - problems are only counted and reported later from on_tick
+	if (status & RTAUDIO_OUTPUT_UNDERFLOW)
+		m_stats.increment(m_stats.output_underflows);
+	if (status & RTAUDIO_INPUT_OVERFLOW)
+		m_stats.increment(m_stats.input_overflows);
+
+	// Publishing happens in on_tick - the callback only hands our channels over
+	const AUDIO_BUFFER_T* input_samples = nullptr;
+	if (input && m_num_inputs) {
+		input_samples = input + m_first_input * frames;
+		size_t captured = m_captured_audio.write(input_samples, frames, frames);
+		m_stats.increment(m_stats.dropped_frames, frames - captured);
+
+		// Re-derive the capture epoch every block so it follows drift between the device and system clocks
+		if (captured) {
+			m_capture_epoch_ns.store(time.input_ns - frames_to_ns(m_captured_frames, m_samplerate), std::memory_order_release);
+			m_captured_frames += captured;
 		}
 
-		float* samples = (float*)outputBuffer;
-		for (size_t channel = 0; channel < m_audio_data->channels; ++channel) {
-			auto channel_buffer = (channel == 0) ? m_received_network_audio_buffer_left : m_received_network_audio_buffer_right;
-
-			if (channel_buffer->size() > nBufferFrames) {
-				for (auto offset = 0; offset < nBufferFrames; ++offset) {
-					std::scoped_lock<std::mutex> lock(m_incoming_audio_lock);
-					*(samples++) = channel_buffer->front(); //read_offset
-					channel_buffer->pop_front();
-				}
-				if (!channel_buffer->size()) {
-					Log::entity(Log::Level::warn, "Audio in buffer empty!");
-				}
-			}
+		if (m_graph_tap_enabled.load(std::memory_order_acquire))
+			m_graph_tap.write(input_samples, frames, frames);
+	}
+
+	if (output && m_num_outputs) {
+		AUDIO_BUFFER_T* output_samples = output + m_first_output * frames;
+		if (m_graph.render(output_samples, m_num_outputs, frames)) {
+			if (input_samples && m_monitor_enabled.load(std::memory_order_relaxed))
+				mix_monitor(input_samples, output_samples, frames);
+			return;
 		}
+
+		auto result = m_received_network_audio.read(output_samples, frames, frames, time.output_ns);
+
+		// Drift correction shows up as frames the resampler stretched or skipped over
+		if (!result.played)
+			m_stats.increment(m_stats.empty_buffers);
+		else if (result.consumed < frames)
+			m_stats.increment(m_stats.duplicated_frames, frames - result.consumed);
+		else
+			m_stats.increment(m_stats.dropped_frames, result.consumed - frames);
+		m_stats.increment(m_stats.dropped_frames, result.discarded);
+		m_stats.record_fill(result.fill);
+
+		if (input_samples && m_monitor_enabled.load(std::memory_order_relaxed))
+			mix_monitor(input_samples, output_samples, frames);
 	}
+}
+
+size_t AudioDevice::graph_channels() const
+{
+	return m_idle ? 0 : m_num_inputs;
+}
+
+size_t AudioDevice::graph_max_frames() const
+{
+	return m_graph_tap.capacity() / 2;
+}
 
-	if (inputBuffer) {
-		float* samples = (float*)inputBuffer;
-		outgoing_audio()->raw_value()->assign(samples, m_audio_data->channels * nBufferFrames);
-		outgoing_audio()->fire();
+bool AudioDevice::is_graph_source() const
+{
+	return m_num_inputs > 0;
+}
+
+uint32_t AudioDevice::graph_samplerate() const
+{
+	return m_samplerate;
+}
+
+size_t AudioDevice::render_graph_block(const AudioBlockView& input, AUDIO_BUFFER_T* output, size_t frames)
+{
+	// When this device's clock runs ahead of the sink's the backlog is trimmed, when it falls behind the sink hears silence
+	size_t available = m_graph_tap.read_available();
+	if (available > frames * 2)
+		available -= m_graph_tap.discard(available - frames);
+	if (available < frames) {
+		std::fill_n(output, m_num_inputs * frames, 0.0f);
+		m_stats.increment(m_stats.empty_buffers);
+		return m_num_inputs;
 	}
+	m_graph_tap.read(output, frames, frames);
+	return m_num_inputs;
+}
 
-	return 0;
+void AudioDevice::set_graph_owner(AudioComponentBase* sink, bool exclusive)
+{
+	AudioComponentBase::set_graph_owner(sink, exclusive);
+	m_graph_tap_enabled.store(sink != nullptr, std::memory_order_release);
+}
+
+void AudioDevice::mix_monitor(const AUDIO_BUFFER_T* input, AUDIO_BUFFER_T* output, size_t frames)
+{
+	// Output channel c hears input channel c, wrapping when there are fewer inputs than outputs
+	for (size_t channel = 0; channel < m_num_outputs; ++channel) {
+		float gain = m_monitor_gains[channel].load(std::memory_order_relaxed);
+		if (gain != 0.0f)
+			AudioKernels::mix_add(input + (channel % m_num_inputs) * frames, output + channel * frames, gain, frames);
+	}
 }
@@ -2,49 +2,120 @@
 
 #include <showtime/entities/ZstComponent.h>
 #include <showtime/entities/ZstPlug.h>
-#include <boost/circular_buffer.hpp>
 #include "RtAudio.h"
 #include "../AudioComponentBase.h"
+#include "../AudioKernels.h"
+#include "../AudioRingBuffer.h"
+#include "AudioJitterBuffer.h"
+#include "AudioDeviceConfig.h"
+#include "AudioDeviceStats.h"
+#include "AudioStream.h"
+#include "AudioStreamClock.h"
+#include <atomic>
+#include <chrono>
+#include <vector>
 
 #define AUDIODEVICE_COMPONENT_TYPE "audiodevice"
 
+// Blocks of capture held for a graph running in another device's callback. Any more than half of it is dropped
+#define AUDIODEVICE_GRAPH_TAP_BLOCKS 4
+
 // Forwards
 class RtAudio;
 
-
-struct AudioData {
-	//DEVICE_BUFFER_T* buffer;
-	boost::circular_buffer< AUDIO_BUFFER_T> buffer;
-	unsigned long read_offset;
-	unsigned long write_offset;
-	unsigned long bufferBytes;
-	unsigned long totalFrames;
-	unsigned long frameCounter;
-	unsigned int channels;
-};
-
-
 class AudioDevice :
 	public AudioComponentBase
 {
 public:
-	ZST_PLUGIN_EXPORT AudioDevice(const char* name, size_t device_index, size_t num_inputs, size_t num_outputs, unsigned long native_formats_bmask);
+	// Handles inputs [first_input, first_input + num_inputs) and outputs [first_output, first_output + num_outputs) of the shared stream.
+	// Ranges are clamped to the channels the stream actually has. The config supplies the payload format and mixing inputs
+	ZST_PLUGIN_EXPORT AudioDevice(const char* name, std::shared_ptr<AudioStream> stream, size_t first_input, size_t num_inputs, size_t first_output, size_t num_outputs, const AudioDeviceConfig& config);
 	ZST_PLUGIN_EXPORT ~AudioDevice();
+	ZST_PLUGIN_EXPORT virtual void on_registered() override;
+	ZST_PLUGIN_EXPORT virtual void on_tick() override;
+
+	// Called by AudioStream from the audio thread with the whole device's planar input and output.
+	// Output channels arrive silent, input is nullptr for output-only devices and output is nullptr for input-only devices.
+	// time gives the system clock times of the block's first input and output frames
+	void process_stream_block(const AUDIO_BUFFER_T* input, AUDIO_BUFFER_T* output, size_t frames, RtAudioStreamStatus status, const AudioStreamTime& time);
+
+	// As a graph source the device hands its capture to the sink's callback directly
+	size_t graph_channels() const override;
+	size_t graph_max_frames() const override;
+	bool is_graph_source() const override;
+	uint32_t graph_samplerate() const override;
+	size_t render_graph_block(const AudioBlockView& input, AUDIO_BUFFER_T* output, size_t frames) override;
+	void set_graph_owner(AudioComponentBase* sink, bool exclusive) override;
 
 private:
 	virtual void compute(showtime::ZstInputPlug* plug) override;
-	int audio_callback(void* outputBuffer, void* inputBuffer, unsigned int nBufferFrames, double streamTime, RtAudioStreamStatus status, void* data);
+	void go_idle();
+	void resume();
+	void publish_stream_info();
+	void publish_captured_audio();
+	void publish_jitter_status();
+	void publish_stats();
+	void queue_received_audio(const AudioBlockView& block);
+	void set_monitor_gains(showtime::ZstInputPlug* plug);
+	void set_playout_delay(double delay_ms);
+	void mix_monitor(const AUDIO_BUFFER_T* input, AUDIO_BUFFER_T* output, size_t frames);
+
+	// Stream shared with every other entity on the same hardware
+	std::shared_ptr<AudioStream> m_stream;
 
-	std::shared_ptr<RtAudio> m_audio_device;
+	// Set while the hardware is gone and the stream is closed. A reopen is tried once per reappearance
+	bool m_idle;
+	bool m_reopen_attempted;
 	
+	size_t m_first_input;
 	size_t m_num_inputs;
+	size_t m_first_output;
 	size_t m_num_outputs;
+	size_t m_buffer_frames;
+	unsigned int m_samplerate;
 
 	bool bLogAmplitude;
+	bool m_stream_info_published;
+
+	// Device input waiting to be published, one planar region per input channel. Written by the audio callback, read by on_tick
+	AudioRingBuffer<AUDIO_BUFFER_T> m_captured_audio;
+	std::vector<AUDIO_BUFFER_T> m_publish_buffer;
+
+	// System clock time of captured frame 0, kept up to date by the callback so published blocks carry their capture time
+	std::atomic<int64_t> m_capture_epoch_ns;
+	uint64_t m_captured_frames;
+	uint64_t m_published_frames;
+
+	// Capture for a graph this device is the source of. Written by this device's callback, read by the sink's
+	AudioRingBuffer<AUDIO_BUFFER_T> m_graph_tap;
+	std::atomic<bool> m_graph_tap_enabled;
+
+	// Runs the in-process graph feeding the audio inputs, in place of the jitter buffer, while there is one
+	AudioGraph::Executor m_graph;
+
+	// Network audio waiting to be played, one planar region per output channel. Written by compute, read by the audio callback
+	AudioJitterBuffer m_received_network_audio;
+
+	// Jitter buffer tuning
+	std::shared_ptr<showtime::ZstInputPlug> m_target_latency_in;
+	std::shared_ptr<showtime::ZstOutputPlug> m_buffer_fill_out;
+	std::shared_ptr<showtime::ZstOutputPlug> m_drift_ratio_out;
+
+	// Scheduled playout - received frames play at their timestamp plus this delay (ms), reported as how late they are (ms)
+	std::shared_ptr<showtime::ZstInputPlug> m_playout_delay_in;
+	std::shared_ptr<showtime::ZstOutputPlug> m_schedule_error_out;
+	std::chrono::steady_clock::time_point m_last_jitter_status;
+
+	// Negotiated stream settings
+	std::shared_ptr<showtime::ZstOutputPlug> m_stream_info_out;
 
-	std::shared_ptr<AudioData> m_audio_data;
-	std::mutex m_incoming_audio_lock;
+	// Local monitoring - device input mixed straight into the output inside the callback
+	std::shared_ptr<showtime::ZstInputPlug> m_monitor_gain_in;
+	std::unique_ptr<std::atomic<float>[]> m_monitor_gains;
+	std::atomic<bool> m_monitor_enabled;
 
-	std::shared_ptr< boost::circular_buffer< AUDIO_BUFFER_T> > m_received_network_audio_buffer_left;
-	std::shared_ptr< boost::circular_buffer< AUDIO_BUFFER_T> > m_received_network_audio_buffer_right;
+	// Xrun and buffer health counters. Updated from the callback, reported from on_tick
+	AudioDeviceStats m_stats;
+	std::shared_ptr<showtime::ZstOutputPlug> m_stats_out;
+	std::chrono::steady_clock::time_point m_last_stats_report;
 };
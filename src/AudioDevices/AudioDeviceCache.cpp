@@ -0,0 +1,115 @@
+#include "AudioDeviceCache.h"
+
+#include <boost/property_tree/ptree.hpp>
+#include <boost/property_tree/json_parser.hpp>
+#include <showtime/ZstLogging.h>
+
+using namespace showtime;
+namespace pt = boost::property_tree;
+
+AudioDeviceCache::AudioDeviceCache() :
+	m_valid(false),
+	m_device_count(0)
+{
+}
+
+bool AudioDeviceCache::load(const std::string& path)
+{
+	pt::ptree root;
+	try {
+		pt::read_json(path, root);
+		m_api = root.get<std::string>("api");
+		m_device_count = root.get<unsigned int>("device_count");
+
+		m_devices.clear();
+		for (const auto& entry : root.get_child("devices")) {
+			const auto& device = entry.second;
+			DiscoveredAudioDevice discovered;
+			discovered.index = device.get<unsigned int>("index");
+			discovered.info.probed = true;
+			discovered.info.name = device.get<std::string>("name");
+			discovered.info.outputChannels = device.get<unsigned int>("output_channels");
+			discovered.info.inputChannels = device.get<unsigned int>("input_channels");
+			discovered.info.duplexChannels = device.get<unsigned int>("duplex_channels");
+			discovered.info.isDefaultOutput = device.get<bool>("default_output");
+			discovered.info.isDefaultInput = device.get<bool>("default_input");
+			discovered.info.preferredSampleRate = device.get<unsigned int>("preferred_samplerate");
+			discovered.info.nativeFormats = device.get<RtAudioFormat>("native_formats");
+			for (const auto& rate : device.get_child("samplerates"))
+				discovered.info.sampleRates.push_back(rate.second.get_value<unsigned int>());
+			m_devices.push_back(discovered);
+		}
+	}
+	catch (pt::ptree_error& e) {
+		Log::app(Log::Level::warn, "Ignoring audio device cache {}: {}", path.c_str(), e.what());
+		m_valid = false;
+		m_devices.clear();
+		return false;
+	}
+
+	m_valid = true;
+	return true;
+}
+
+bool AudioDeviceCache::save(const std::string& path) const
+{
+	pt::ptree root;
+	root.put("api", m_api);
+	root.put("device_count", m_device_count);
+
+	pt::ptree devices;
+	for (const auto& discovered : m_devices) {
+		pt::ptree device;
+		device.put("index", discovered.index);
+		device.put("name", discovered.info.name);
+		device.put("output_channels", discovered.info.outputChannels);
+		device.put("input_channels", discovered.info.inputChannels);
+		device.put("duplex_channels", discovered.info.duplexChannels);
+		device.put("default_output", discovered.info.isDefaultOutput);
+		device.put("default_input", discovered.info.isDefaultInput);
+		device.put("preferred_samplerate", discovered.info.preferredSampleRate);
+		device.put("native_formats", discovered.info.nativeFormats);
+
+		pt::ptree rates;
+		for (auto rate : discovered.info.sampleRates) {
+			pt::ptree value;
+			value.put_value(rate);
+			rates.push_back(std::make_pair("", value));
+		}
+		device.add_child("samplerates", rates);
+		devices.push_back(std::make_pair("", device));
+	}
+	root.add_child("devices", devices);
+
+	try {
+		pt::write_json(path, root);
+	}
+	catch (pt::ptree_error& e) {
+		Log::app(Log::Level::warn, "Could not write audio device cache {}: {}", path.c_str(), e.what());
+		return false;
+	}
+	return true;
+}
+
+bool AudioDeviceCache::matches(const std::string& api, unsigned int device_count) const
+{
+	return m_valid && m_api == api && m_device_count == device_count;
+}
+
+void AudioDeviceCache::reset(const std::string& api, unsigned int device_count)
+{
+	m_valid = true;
+	m_api = api;
+	m_device_count = device_count;
+	m_devices.clear();
+}
+
+void AudioDeviceCache::add(const DiscoveredAudioDevice& device)
+{
+	m_devices.push_back(device);
+}
+
+const std::vector<DiscoveredAudioDevice>& AudioDeviceCache::devices() const
+{
+	return m_devices;
+}
@@ -0,0 +1,37 @@
+#pragma once
+
+#include "RtAudio.h"
+#include <string>
+#include <vector>
+
+#define AUDIO_DEVICE_CACHE_FILE "audio_device_cache.json"
+
+// A device found during enumeration, along with the RtAudio index needed to open it
+struct DiscoveredAudioDevice {
+	unsigned int index;
+	RtAudio::DeviceInfo info;
+};
+
+// Probed device capabilities persisted between runs so a warm start doesn't have to probe every device again.
+// The cache is only trusted while the API and the device count still match what RtAudio reports. It is only saved after
+// a scan that probed every device, so a device busy at the time is never left out of it.
+class AudioDeviceCache
+{
+public:
+	AudioDeviceCache();
+
+	bool load(const std::string& path);
+	bool save(const std::string& path) const;
+
+	bool matches(const std::string& api, unsigned int device_count) const;
+	void reset(const std::string& api, unsigned int device_count);
+
+	void add(const DiscoveredAudioDevice& device);
+	const std::vector<DiscoveredAudioDevice>& devices() const;
+
+private:
+	bool m_valid;
+	std::string m_api;
+	unsigned int m_device_count;
+	std::vector<DiscoveredAudioDevice> m_devices;
+};
@@ -0,0 +1,112 @@
+#include "AudioDeviceConfig.h"
+
+#include <boost/property_tree/ptree.hpp>
+#include <boost/property_tree/json_parser.hpp>
+#include <showtime/ZstLogging.h>
+
+using namespace showtime;
+namespace pt = boost::property_tree;
+
+namespace {
+	AudioKernels::SampleFormat parse_payload_format(const std::string& name, AudioKernels::SampleFormat fallback)
+	{
+		if (name == "float32")
+			return AudioKernels::SampleFormat::Float32;
+		if (name == "int24")
+			return AudioKernels::SampleFormat::Int24;
+		if (name == "int16")
+			return AudioKernels::SampleFormat::Int16;
+		if (!name.empty())
+			Log::app(Log::Level::warn, "Unknown payload_format {}", name.c_str());
+		return fallback;
+	}
+
+	AudioPayload::Codec parse_payload_codec(const std::string& name, AudioPayload::Codec fallback)
+	{
+		if (name == "none")
+			return AudioPayload::Codec::None;
+		if (name == "lossless")
+			return AudioPayload::Codec::Lossless;
+		if (!name.empty())
+			Log::app(Log::Level::warn, "Unknown payload_codec {}", name.c_str());
+		return fallback;
+	}
+
+	// Subdevices are only read for a device's own entry. Under "default" they would appear on every unlisted device
+	AudioDeviceConfig parse_config(const pt::ptree& tree, const AudioDeviceConfig& defaults, bool read_subdevices)
+	{
+		AudioDeviceConfig config;
+		config.samplerate = tree.get<unsigned int>("samplerate", defaults.samplerate);
+		config.buffer_frames = tree.get<unsigned int>("buffer_frames", defaults.buffer_frames);
+		config.number_of_buffers = tree.get<unsigned int>("number_of_buffers", defaults.number_of_buffers);
+		config.minimize_latency = tree.get<bool>("minimize_latency", defaults.minimize_latency);
+		config.schedule_realtime = tree.get<bool>("schedule_realtime", defaults.schedule_realtime);
+		config.priority = tree.get<int>("priority", defaults.priority);
+		config.mix_inputs = tree.get<unsigned int>("mix_inputs", defaults.mix_inputs);
+		config.payload_format = parse_payload_format(tree.get<std::string>("payload_format", ""), defaults.payload_format);
+		config.payload_codec = parse_payload_codec(tree.get<std::string>("payload_codec", ""), defaults.payload_codec);
+		config.batch_blocks = tree.get<unsigned int>("batch_blocks", defaults.batch_blocks);
+		config.batch_max_latency_ms = tree.get<double>("batch_max_latency_ms", defaults.batch_max_latency_ms);
+		config.batch_max_bytes = tree.get<unsigned int>("batch_max_bytes", defaults.batch_max_bytes);
+		config.playout_delay_ms = tree.get<double>("playout_delay_ms", defaults.playout_delay_ms);
+		config.graph_threads = tree.get<unsigned int>("graph_threads", defaults.graph_threads);
+
+		auto subdevices = tree.get_child_optional("subdevices");
+		if (subdevices && !read_subdevices) {
+			Log::app(Log::Level::warn, "Ignoring subdevices outside a device entry");
+		}
+		else if (subdevices) {
+			for (const auto& entry : *subdevices) {
+				AudioSubDeviceConfig subdevice;
+				subdevice.name = entry.second.get<std::string>("name");
+				subdevice.first_input = entry.second.get<unsigned int>("first_input", 0);
+				subdevice.inputs = entry.second.get<unsigned int>("inputs", 0);
+				subdevice.first_output = entry.second.get<unsigned int>("first_output", 0);
+				subdevice.outputs = entry.second.get<unsigned int>("outputs", 0);
+				config.subdevices.push_back(subdevice);
+			}
+		}
+		return config;
+	}
+}
+
+bool AudioDeviceConfigs::load(const std::string& path)
+{
+	pt::ptree root;
+	try {
+		pt::read_json(path, root);
+	}
+	catch (pt::ptree_error& e) {
+		Log::app(Log::Level::error, "Could not read audio device config {}: {}", path.c_str(), e.what());
+		return false;
+	}
+
+	// Parse everything before applying any of it, so a bad entry leaves the previous config in place
+	AudioDeviceConfig default_config = m_default;
+	std::unordered_map<std::string, AudioDeviceConfig> device_configs = m_devices;
+	try {
+		if (auto defaults = root.get_child_optional("default"))
+			default_config = parse_config(*defaults, default_config, false);
+
+		if (auto devices = root.get_child_optional("devices")) {
+			for (const auto& device : *devices) {
+				device_configs[device.first] = parse_config(device.second, default_config, true);
+			}
+		}
+	}
+	catch (pt::ptree_error& e) {
+		Log::app(Log::Level::error, "Invalid audio device config {}: {}", path.c_str(), e.what());
+		return false;
+	}
+	m_default = default_config;
+	m_devices.swap(device_configs);
+
+	Log::app(Log::Level::notification, "Loaded audio device config {} with {} device entries", path.c_str(), m_devices.size());
+	return true;
+}
+
+AudioDeviceConfig AudioDeviceConfigs::get(const std::string& device_name) const
+{
+	auto config = m_devices.find(device_name);
+	return (config != m_devices.end()) ? config->second : m_default;
+}
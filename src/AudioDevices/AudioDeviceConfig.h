@@ -0,0 +1,71 @@
+#pragma once
+
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "../AudioKernels.h"
+#include "../AudioPayload.h"
+
+#define AUDIO_DEVICE_CONFIG_FILE "audio_devices.json"
+
+// A named range of a device's channels exposed as its own entity
+struct AudioSubDeviceConfig {
+	std::string name;
+	unsigned int first_input = 0;
+	unsigned int inputs = 0;
+	unsigned int first_output = 0;
+	unsigned int outputs = 0;
+};
+
+// Stream settings for a single audio device
+struct AudioDeviceConfig {
+	// 0 uses the device's preferred sample rate
+	unsigned int samplerate = 0;
+	unsigned int buffer_frames = 512;
+
+	// 0 lets the driver choose
+	unsigned int number_of_buffers = 0;
+	bool minimize_latency = false;
+	bool schedule_realtime = false;
+	int priority = 0;
+
+	// Audio inputs summed into the device's outputs. 1 is the plain IN_audio plug
+	unsigned int mix_inputs = 1;
+
+	// Sample type of published audio payloads - "float32", "int24" or "int16"
+	AudioKernels::SampleFormat payload_format = AudioKernels::SampleFormat::Float32;
+
+	// Compression of published payloads - "none" or "lossless" (int16 and int24 payloads only)
+	AudioPayload::Codec payload_codec = AudioPayload::Codec::None;
+
+	// Captured blocks sent per message, and the latency (ms) and size (bytes) a message may grow to. 0 is unlimited
+	unsigned int batch_blocks = 1;
+	double batch_max_latency_ms = 0.0;
+	unsigned int batch_max_bytes = 0;
+
+	// Plays received audio this long (ms) after it was captured, on the system clock, so every receiver with the
+	// same delay plays in step. 0 plays as soon as the jitter buffer reaches its target latency
+	double playout_delay_ms = 0.0;
+
+	// Threads an in-process graph rendered by this device may use, its callback included. 1 renders every node in the
+	// callback, 0 uses one per core but one where the graph has branches to spread over them
+	unsigned int graph_threads = 0;
+
+	// Extra entities sharing the device's stream. Only read from a device's own entry - ignored under "default"
+	std::vector<AudioSubDeviceConfig> subdevices;
+};
+
+// Per-device stream settings loaded from the plugin data path.
+// The file holds an optional "default" object and a "devices" object keyed by device name, e.g.
+// { "default": { "samplerate": 48000 }, "devices": { "Speakers": { "buffer_frames": 64, "schedule_realtime": true } } }
+// Devices can also list subdevices, e.g. "subdevices": [ { "name": "Mics 1-2", "first_input": 0, "inputs": 2 } ]
+class AudioDeviceConfigs
+{
+public:
+	bool load(const std::string& path);
+	AudioDeviceConfig get(const std::string& device_name) const;
+
+private:
+	AudioDeviceConfig m_default;
+	std::unordered_map<std::string, AudioDeviceConfig> m_devices;
+};
@@ -0,0 +1,90 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <limits>
+
+// Buffer health counters for an AudioDevice.
+// Counters are cumulative and only ever incremented with relaxed atomics so the audio callback never waits.
+// The fill range is tracked by the callback and restarted whenever the reporter takes a snapshot.
+class AudioDeviceStats
+{
+public:
+	struct Snapshot {
+		uint64_t output_underflows;
+		uint64_t input_overflows;
+		uint64_t empty_buffers;
+		uint64_t dropped_frames;
+		uint64_t duplicated_frames;
+		uint64_t fill_min;
+		uint64_t fill_max;
+	};
+
+	AudioDeviceStats() :
+		output_underflows(0),
+		input_overflows(0),
+		empty_buffers(0),
+		dropped_frames(0),
+		duplicated_frames(0),
+		m_fill_min(0),
+		m_fill_max(0),
+		m_fill_epoch(0),
+		m_callback_epoch(0),
+		m_callback_fill_min(std::numeric_limits<uint64_t>::max()),
+		m_callback_fill_max(0)
+	{
+	}
+
+	void increment(std::atomic<uint64_t>& counter, uint64_t amount = 1)
+	{
+		if (amount)
+			counter.fetch_add(amount, std::memory_order_relaxed);
+	}
+
+	// Audio thread only
+	void record_fill(uint64_t fill)
+	{
+		// The reporter bumps the epoch to ask for a fresh range
+		uint64_t epoch = m_fill_epoch.load(std::memory_order_acquire);
+		if (epoch != m_callback_epoch) {
+			m_callback_epoch = epoch;
+			m_callback_fill_min = std::numeric_limits<uint64_t>::max();
+			m_callback_fill_max = 0;
+		}
+		m_callback_fill_min = (fill < m_callback_fill_min) ? fill : m_callback_fill_min;
+		m_callback_fill_max = (fill > m_callback_fill_max) ? fill : m_callback_fill_max;
+		m_fill_min.store(m_callback_fill_min, std::memory_order_relaxed);
+		m_fill_max.store(m_callback_fill_max, std::memory_order_relaxed);
+	}
+
+	// Reporter thread only. Returns the counters and the fill range since the previous snapshot
+	Snapshot snapshot()
+	{
+		Snapshot snap;
+		snap.output_underflows = output_underflows.load(std::memory_order_relaxed);
+		snap.input_overflows = input_overflows.load(std::memory_order_relaxed);
+		snap.empty_buffers = empty_buffers.load(std::memory_order_relaxed);
+		snap.dropped_frames = dropped_frames.load(std::memory_order_relaxed);
+		snap.duplicated_frames = duplicated_frames.load(std::memory_order_relaxed);
+		snap.fill_min = m_fill_min.load(std::memory_order_relaxed);
+		snap.fill_max = m_fill_max.load(std::memory_order_relaxed);
+		m_fill_epoch.fetch_add(1, std::memory_order_release);
+		return snap;
+	}
+
+	std::atomic<uint64_t> output_underflows;
+	std::atomic<uint64_t> input_overflows;
+	std::atomic<uint64_t> empty_buffers;
+	std::atomic<uint64_t> dropped_frames;
+	std::atomic<uint64_t> duplicated_frames;
+
+private:
+	std::atomic<uint64_t> m_fill_min;
+	std::atomic<uint64_t> m_fill_max;
+	std::atomic<uint64_t> m_fill_epoch;
+
+	// Owned by the audio thread
+	uint64_t m_callback_epoch;
+	uint64_t m_callback_fill_min;
+	uint64_t m_callback_fill_max;
+};
@@ -2,17 +2,101 @@
 #include "AudioDevice.h"
 #include <RtAudio.h>
 #include <showtime/ZstLogging.h>
+#include <algorithm>
+#include <cstdio>
 #include <fstream>
 #include <memory>
+#include <unordered_set>
 
 using namespace showtime;
 
+namespace {
+	// Index and name of every device a scan managed to probe
+	std::vector<std::pair<unsigned int, std::string>> probed_devices(const std::vector<DiscoveredAudioDevice>& devices)
+	{
+		std::vector<std::pair<unsigned int, std::string>> probed;
+		for (const auto& device : devices) {
+			if (device.info.probed)
+				probed.emplace_back(device.index, device.info.name);
+		}
+		return probed;
+	}
+
+	// A scan that couldn't probe a device (usually one held open elsewhere) would cache the device set without it
+	bool all_probed(const std::vector<DiscoveredAudioDevice>& devices)
+	{
+		return std::all_of(devices.begin(), devices.end(), [](const DiscoveredAudioDevice& device) { return device.info.probed; });
+	}
+}
+
 AudioFactory::AudioFactory(const char* name) : 
 	showtime::ZstEntityFactory(name),
-	m_query_audio(std::make_shared<RtAudio>())
+	m_stop_enumeration(false),
+	m_device_list_changed(false)
+{
+}
+
+AudioFactory::~AudioFactory()
+{
+	// A device probe can't be interrupted, but the thread stops before starting the next one or while waiting to poll
+	m_stop_enumeration = true;
+	m_enumeration_thread.interrupt();
+	if (m_enumeration_thread.joinable())
+		m_enumeration_thread.join();
+}
+
+void AudioFactory::on_registered()
+{
+	register_tick();
+
+	// Probing devices can take seconds on some hosts so keep it off the plugin load path
+	m_enumeration_thread = boost::thread(&AudioFactory::enumerate_devices, this);
+}
+
+void AudioFactory::on_tick()
+{
+	bool device_list_changed = false;
+	{
+		std::lock_guard<std::mutex> lock(m_discovered_mtx);
+		if (m_discovered.empty() && !m_device_list_changed)
+			return;
+		// A full device list supersedes anything discovered before it
+		if (m_device_list_changed) {
+			m_registering.swap(m_device_list);
+			m_device_list.clear();
+			m_discovered.clear();
+			device_list_changed = true;
+			m_device_list_changed = false;
+		}
+		else {
+			m_registering.swap(m_discovered);
+		}
+	}
+
+	if (device_list_changed) {
+		apply_device_list(m_registering);
+	}
+	else {
+		for (const auto& device : m_registering)
+			add_device_creatable(device);
+	}
+	m_registering.clear();
+	update_creatables();
+}
+
+void AudioFactory::load_device_config(const std::string& data_path)
 {
+	fs::path config_path = fs::path(data_path) / AUDIO_DEVICE_CONFIG_FILE;
+	if (fs::exists(config_path))
+		m_device_configs.load(config_path.string());
+	m_cache_path = (fs::path(data_path) / AUDIO_DEVICE_CACHE_FILE).string();
+}
+
+void AudioFactory::enumerate_devices()
+{
+	std::unique_ptr<RtAudio> query_audio;
 	try {
-		m_query_audio = std::make_shared<RtAudio>();
+		query_audio = std::make_unique<RtAudio>();
 	}
 	catch (RtAudioError& error) {
 		Log::app(Log::Level::error, "Audio construction failed: {}", error.getMessage().c_str());
@@ -20,26 +104,201 @@ AudioFactory::AudioFactory(const char* name) :
 	}
 
 	// Determine the number of devices available
-	int devices = m_query_audio->getDeviceCount();
+	std::string api = RtAudio::getApiName(query_audio->getCurrentApi());
+	unsigned int devices = query_audio->getDeviceCount();
 
+	// Warm start - the API and device count match the cache, so register the cached devices without probing anything
+	AudioDeviceCache cache;
+	std::vector<DiscoveredAudioDevice> found;
+	if (!m_cache_path.empty() && fs::exists(m_cache_path) && cache.load(m_cache_path) && cache.matches(api, devices)) {
+		Log::app(Log::Level::notification, "Using cached audio devices for {} ({} devices)", api.c_str(), devices);
+		found = cache.devices();
+		for (const auto& device : found)
+			queue_discovered(device);
+	}
+	else {
+		// Only a complete scan where every device answered is worth caching
+		cache.reset(api, devices);
+		if (probe_devices(*query_audio, cache, true, found) && all_probed(found))
+			save_cache(cache);
+		else
+			discard_cache();
+	}
+	if (m_stop_enumeration)
+		return;
+
+	// Watch for hot-plugged devices. RtAudio has no change notification so poll the device count, which is cheap, and
+	// only probe everything when it changes. Probing at any other time would hit devices our own streams hold open.
+	// Removals and additions are then found by comparing names, which survives indices shifting around them
+	std::vector<DiscoveredAudioDevice> scanned;
+	try {
+		while (!m_stop_enumeration) {
+			boost::this_thread::sleep_for(AUDIO_DEVICE_POLL_INTERVAL);
+			unsigned int current_devices = query_audio->getDeviceCount();
+			if (current_devices == devices)
+				continue;
+
+			// A partial scan would look like every device after the failed one had gone. Try again at the next poll
+			cache.reset(api, current_devices);
+			if (!probe_devices(*query_audio, cache, false, scanned))
+				continue;
+			devices = current_devices;
+
+			// Devices our streams hold open can't be probed. Rather than cache the set without them, or keep a cache
+			// that could match again once the count goes back, leave the next start to probe everything
+			if (all_probed(scanned))
+				save_cache(cache);
+			else
+				discard_cache();
+			if (probed_devices(scanned) == probed_devices(found))
+				continue;
+
+			Log::app(Log::Level::notification, "Audio devices for {} changed, updating", api.c_str());
+			found.swap(scanned);
+			queue_device_list(found);
+		}
+	}
+	catch (boost::thread_interrupted&) {
+	}
+}
+
+bool AudioFactory::probe_devices(RtAudio& query_audio, AudioDeviceCache& cache, bool stream_results, std::vector<DiscoveredAudioDevice>& found)
+{
 	// Scan through devices for various capabilities
-	RtAudio::DeviceInfo info;
+	found.clear();
+	unsigned int devices = query_audio.getDeviceCount();
+	for (unsigned int device_idx = 0; device_idx < devices; device_idx++) {
+		if (m_stop_enumeration)
+			return false;
 
-	for (size_t device_idx = 0; device_idx < devices; device_idx++) {
+		DiscoveredAudioDevice device;
+		device.index = device_idx;
 		try {
-			info = m_query_audio->getDeviceInfo(device_idx);
+			device.info = query_audio.getDeviceInfo(device_idx);
 		}
 		catch (RtAudioError& error) {
+			// Whatever was probed so far is still registered, but a cache missing the rest would be trusted next start
 			error.printMessage();
-			break;
+			return false;
 		}
 
-		// Print, for example, the maximum number of output channels for each device
-		Log::app(Log::Level::notification, "Device:{} Name:{}, I/O channels:{}|{}, SampleRate:{}", device_idx, info.name.c_str()
-			, info.inputChannels, info.outputChannels, info.preferredSampleRate);
+		// Devices another stream holds open may not probe. They are still there, so the list keeps them
+		found.push_back(device);
+		if (!device.info.probed)
+			continue;
+
+		cache.add(device);
+		if (stream_results)
+			queue_discovered(device);
+	}
+	return true;
+}
+
+void AudioFactory::save_cache(const AudioDeviceCache& cache)
+{
+	if (!m_cache_path.empty())
+		cache.save(m_cache_path);
+}
+
+void AudioFactory::discard_cache()
+{
+	if (!m_cache_path.empty())
+		std::remove(m_cache_path.c_str());
+}
+
+void AudioFactory::queue_discovered(const DiscoveredAudioDevice& device)
+{
+	std::lock_guard<std::mutex> lock(m_discovered_mtx);
+	m_discovered.push_back(device);
+}
+
+void AudioFactory::queue_device_list(const std::vector<DiscoveredAudioDevice>& devices)
+{
+	std::lock_guard<std::mutex> lock(m_discovered_mtx);
+	m_device_list = devices;
+	m_device_list_changed = true;
+}
+
+void AudioFactory::apply_device_list(const std::vector<DiscoveredAudioDevice>& devices)
+{
+	// Add new devices and refresh the index of ones we already know, which may have shifted
+	std::unordered_set<std::string> present;
+	bool unidentified = false;
+	for (const auto& device : devices) {
+		if (device.info.name.empty()) {
+			unidentified = true;
+			continue;
+		}
+		present.insert(device.info.name);
+		auto known = m_known_devices.find(device.info.name);
+		if (known == m_known_devices.end()) {
+			if (device.info.probed)
+				add_device_creatable(device);
+			continue;
+		}
+		known->second.handle->index = device.index;
+	}
+
+	// Anything missing has been unplugged. Running AudioDevices see the handle change and go idle.
+	// A device that couldn't even be named might be one of ours held open by its stream, so nothing goes then
+	for (auto known = m_known_devices.begin(); known != m_known_devices.end() && !unidentified;) {
+		if (present.count(known->first)) {
+			++known;
+			continue;
+		}
+		Log::app(Log::Level::notification, "Audio device {} removed", known->first.c_str());
+		known->second.handle->present = false;
+		for (const auto& creatable : known->second.creatables)
+			remove_creatable(creatable);
+		m_removed_devices[known->first] = known->second.handle;
+		known = m_known_devices.erase(known);
+	}
+}
+
+void AudioFactory::add_device_creatable(const DiscoveredAudioDevice& device)
+{
+	// Print, for example, the maximum number of output channels for each device
+	Log::app(Log::Level::notification, "Device:{} Name:{}, I/O channels:{}|{}, SampleRate:{}", device.index, device.info.name.c_str()
+		, device.info.inputChannels, device.info.outputChannels, device.info.preferredSampleRate);
+
+	// Devices that share a name can't be told apart, so the most recent one wins
+	auto known = m_known_devices.find(device.info.name);
+	if (known != m_known_devices.end()) {
+		known->second.handle->index = device.index;
+		return;
+	}
+
+	// A device plugged back in gets its old handle, which brings back the entities still holding it
+	auto info = device.info;
+	std::shared_ptr<AudioDeviceHandle> handle;
+	auto removed = m_removed_devices.find(info.name);
+	if (removed != m_removed_devices.end()) {
+		Log::app(Log::Level::notification, "Audio device {} is back", info.name.c_str());
+		handle = removed->second;
+		handle->index = device.index;
+		handle->present = true;
+		m_removed_devices.erase(removed);
+	}
+	else {
+		handle = std::make_shared<AudioDeviceHandle>(info.name, device.index);
+	}
+	auto config = m_device_configs.get(info.name);
+	KnownDevice known_device{ handle, {} };
+
+	known_device.creatables.push_back(this->add_creatable(info.name.c_str(), [this, info, handle](const char* e_name) -> std::unique_ptr<ZstEntityBase> {
+		auto config = m_device_configs.get(info.name);
+		auto stream = m_streams.acquire(handle, info, config);
+		return std::make_unique<AudioDevice>(e_name, stream, 0, info.inputChannels, 0, info.outputChannels, config);
+	}));
 
-		this->add_creatable(info.name.c_str(), [info, device_idx](const char* e_name) -> std::unique_ptr<ZstEntityBase> {
-			return std::make_unique<AudioDevice>(e_name, device_idx, info.inputChannels, info.outputChannels, info.nativeFormats);
-		});
+	// Subdevices open nothing themselves - they attach to the same stream as the whole device
+	for (const auto& subdevice : config.subdevices) {
+		std::string creatable_name = info.name + " - " + subdevice.name;
+		known_device.creatables.push_back(this->add_creatable(creatable_name.c_str(), [this, info, handle, subdevice](const char* e_name) -> std::unique_ptr<ZstEntityBase> {
+			auto config = m_device_configs.get(info.name);
+			auto stream = m_streams.acquire(handle, info, config);
+			return std::make_unique<AudioDevice>(e_name, stream, subdevice.first_input, subdevice.inputs, subdevice.first_output, subdevice.outputs, config);
+		}));
 	}
+	m_known_devices[info.name] = known_device;
 }
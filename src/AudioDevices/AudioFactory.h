@@ -4,6 +4,18 @@
 #include <showtime/entities/ZstEntityFactory.h>
 #include <showtime/ZstURI.h>
 #include <showtime/ZstFilesystemUtils.h>
+#include "AudioDeviceConfig.h"
+#include "AudioDeviceCache.h"
+#include "AudioStream.h"
+
+#include <atomic>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+#include <boost/thread.hpp>
+
+// How often the watcher checks whether devices have been plugged in or removed
+#define AUDIO_DEVICE_POLL_INTERVAL boost::chrono::seconds(2)
 
 
 // Forwards
@@ -14,6 +26,53 @@ class ZST_CLASS_EXPORTED AudioFactory : public showtime::ZstEntityFactory
 {
 public:
 	AudioFactory(const char* name);
+	~AudioFactory();
+
+	virtual void on_registered() override;
+	virtual void on_tick() override;
+
+	// Loads per-device stream settings from the plugin data path and keeps the device cache there. Applies to devices created afterwards
+	void load_device_config(const std::string& data_path);
 private:
-	std::shared_ptr<RtAudio> m_query_audio;
+	// Runs on m_enumeration_thread. Probes devices (or reads them from the cache when it still matches) and queues
+	// them for on_tick to register, then polls the device count and, when it changes, probes again and queues a fresh
+	// device list if the probed devices differ from the last ones
+	void enumerate_devices();
+
+	// Probes every device RtAudio reports into found, in index order, including ones that couldn't be probed. Only probed
+	// devices go into the cache. Returns false if a probe failed or enumeration was stopped, leaving found incomplete
+	bool probe_devices(RtAudio& query_audio, AudioDeviceCache& cache, bool stream_results, std::vector<DiscoveredAudioDevice>& found);
+	void save_cache(const AudioDeviceCache& cache);
+	void discard_cache();
+	void queue_discovered(const DiscoveredAudioDevice& device);
+	void queue_device_list(const std::vector<DiscoveredAudioDevice>& devices);
+
+	// Poll thread side
+	void add_device_creatable(const DiscoveredAudioDevice& device);
+	void apply_device_list(const std::vector<DiscoveredAudioDevice>& devices);
+
+	AudioDeviceConfigs m_device_configs;
+	std::string m_cache_path;
+
+	boost::thread m_enumeration_thread;
+	std::atomic<bool> m_stop_enumeration;
+	std::mutex m_discovered_mtx;
+	std::vector<DiscoveredAudioDevice> m_discovered;
+	std::vector<DiscoveredAudioDevice> m_device_list;
+	bool m_device_list_changed;
+
+	// Devices with registered creatables (the whole device plus any configured subdevices), keyed by device name. Only touched from on_tick
+	struct KnownDevice {
+		std::shared_ptr<AudioDeviceHandle> handle;
+		std::vector<showtime::ZstURI> creatables;
+	};
+	std::unordered_map<std::string, KnownDevice> m_known_devices;
+
+	// Handles of unplugged devices. Entities and streams created on one keep it, so a device plugged back in under the
+	// same name gets the same handle and they pick up where they left off
+	std::unordered_map<std::string, std::shared_ptr<AudioDeviceHandle>> m_removed_devices;
+	std::vector<DiscoveredAudioDevice> m_registering;
+
+	// Entities on the same hardware share one open stream
+	AudioStreamManager m_streams;
 };
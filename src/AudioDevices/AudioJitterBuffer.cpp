@@ -0,0 +1,301 @@
+#include "AudioJitterBuffer.h"
+
+#include <algorithm>
+#include <cmath>
+
+// Fill level controller. Errors are measured in seconds of buffered audio.
+#define JITTER_FILL_SMOOTHING_SECONDS 1.0
+#define JITTER_PROPORTIONAL_GAIN 0.1
+#define JITTER_INTEGRAL_GAIN 0.003
+#define JITTER_MAX_RATIO_DEVIATION 0.005
+
+// Scheduled audio further out than this is moved into place at once rather than steered there
+#define JITTER_SCHEDULE_SNAP_SECONDS 0.02
+
+// Lowpass cutoff of the interpolation kernel relative to Nyquist
+#define JITTER_RESAMPLER_CUTOFF 0.95
+
+namespace {
+	const double PI = 3.14159265358979323846;
+}
+
+AudioJitterBuffer::AudioJitterBuffer() :
+	m_history_stride(0),
+	m_max_block_frames(0),
+	m_phase(0.0),
+	m_ratio(1.0),
+	m_drift_integral(0.0),
+	m_fill_average(0.0),
+	m_priming(true),
+	m_samplerate(44100.0),
+	m_target_frames(0),
+	m_reported_fill(0.0),
+	m_reported_drift(1.0),
+	m_anchors(JITTER_SCHEDULE_ANCHORS),
+	m_anchor_write(0),
+	m_anchor_read(0),
+	m_frames_written(0),
+	m_frames_read(0),
+	m_current_anchor{ 0, 0 },
+	m_has_anchor(false),
+	m_playout_delay(0),
+	m_reported_schedule_error(0.0)
+{
+}
+
+void AudioJitterBuffer::prepare(size_t channels, size_t max_block_frames, size_t capacity_frames, double samplerate)
+{
+	m_samplerate = samplerate;
+	m_max_block_frames = max_block_frames;
+	m_ring.resize(channels, capacity_frames);
+
+	// Each channel keeps the kernel history followed by room for the most input a block can consume
+	size_t max_consumed = size_t(std::ceil(max_block_frames * (1.0 + JITTER_MAX_RATIO_DEVIATION))) + 1;
+	m_history_stride = JITTER_RESAMPLER_TAPS + max_consumed;
+	m_history.assign(channels * m_history_stride, 0.0f);
+
+	// Blackman windowed sinc table with one extra row so phase interpolation never wraps
+	m_coefficients.assign((JITTER_RESAMPLER_PHASES + 1) * JITTER_RESAMPLER_TAPS, 0.0f);
+	for (size_t phase = 0; phase <= JITTER_RESAMPLER_PHASES; ++phase) {
+		float* row = m_coefficients.data() + phase * JITTER_RESAMPLER_TAPS;
+		double frac = double(phase) / JITTER_RESAMPLER_PHASES;
+		double sum = 0.0;
+		for (size_t tap = 0; tap < JITTER_RESAMPLER_TAPS; ++tap) {
+			double x = double(tap) - double(JITTER_RESAMPLER_HALF_TAPS - 1) - frac;
+			double sinc = (x == 0.0) ? 1.0 : std::sin(PI * x * JITTER_RESAMPLER_CUTOFF) / (PI * x * JITTER_RESAMPLER_CUTOFF);
+			double u = x / JITTER_RESAMPLER_HALF_TAPS;
+			double window = (std::abs(u) >= 1.0) ? 0.0 : 0.42 + 0.5 * std::cos(PI * u) + 0.08 * std::cos(2.0 * PI * u);
+			row[tap] = float(sinc * window);
+			sum += row[tap];
+		}
+		// Normalise for unity gain at DC
+		for (size_t tap = 0; tap < JITTER_RESAMPLER_TAPS; ++tap)
+			row[tap] = float(row[tap] / sum);
+	}
+
+	m_target_frames = std::min(m_target_frames.load(), max_target_latency());
+	m_anchor_write = m_anchor_read = 0;
+	m_frames_written = m_frames_read = 0;
+	m_has_anchor = false;
+	restart_priming();
+	m_drift_integral = 0.0;
+	m_reported_drift = 1.0;
+}
+
+size_t AudioJitterBuffer::write(const AUDIO_BUFFER_T* src, size_t frames, size_t src_stride, size_t src_channels, int64_t timestamp)
+{
+	// Anchors are only dropped if the consumer has stopped reading, in which case nothing is being scheduled anyway
+	size_t anchor_write = m_anchor_write.load(std::memory_order_relaxed);
+	if (timestamp && anchor_write - m_anchor_read.load(std::memory_order_acquire) < m_anchors.size()) {
+		m_anchors[anchor_write % m_anchors.size()] = { m_frames_written, timestamp };
+		m_anchor_write.store(anchor_write + 1, std::memory_order_release);
+	}
+
+	size_t written = m_ring.write(src, frames, src_stride, src_channels);
+	m_frames_written += written;
+	return written;
+}
+
+AudioJitterBuffer::ReadResult AudioJitterBuffer::read(AUDIO_BUFFER_T* dst, size_t frames, size_t dst_stride, int64_t output_ns)
+{
+	const size_t channels = m_ring.channels();
+	frames = std::min(frames, m_max_block_frames);
+	size_t available = m_ring.read_available();
+	size_t target = m_target_frames.load(std::memory_order_relaxed);
+	ReadResult result = { false, 0, 0, available };
+
+	// Scheduled playout measures how late the next frame would play instead of how full the buffer is
+	double lateness = 0.0;
+	bool scheduled = output_ns && m_playout_delay.load(std::memory_order_relaxed) && scheduled_lateness(output_ns, lateness);
+	if (scheduled && std::abs(lateness) > JITTER_SCHEDULE_SNAP_SECONDS) {
+		if (lateness > 0.0) {
+			// Too late to steer - skip ahead to the frame that should be playing now
+			result.discarded = discard(std::min(available, size_t(lateness * m_samplerate)));
+			available -= result.discarded;
+			scheduled_lateness(output_ns, lateness);
+		}
+		else if (!m_priming) {
+			// Far too early, so wait for its time in silence
+			restart_priming();
+		}
+	}
+
+	// Hold off playback until the buffer has filled to the target latency, or until the next frame is due
+	if (m_priming) {
+		// Starting within half a block of the due time keeps the first frame as close to it as block granularity allows
+		bool ready = scheduled ? (lateness > -0.5 * double(frames) / m_samplerate && available) : (available >= std::max<size_t>(target, 1));
+		if (!ready) {
+			for (size_t channel = 0; channel < channels; ++channel)
+				std::fill_n(dst + channel * dst_stride, frames, 0.0f);
+			m_reported_fill.store(double(available), std::memory_order_relaxed);
+			result.fill = available;
+			return result;
+		}
+		m_priming = false;
+		m_fill_average = double(available);
+	}
+
+	// Far too much audio queued (sender restarted or a long stall upstream) - skip straight back to the target
+	if (!scheduled && available > target * 2 + frames) {
+		result.discarded = discard(available - target);
+		available -= result.discarded;
+		m_fill_average = double(available);
+	}
+
+	update_ratio(frames, scheduled, lateness);
+
+	// Number of new input frames the resampler steps over for this block
+	double end_position = m_phase + double(frames) * m_ratio;
+	size_t consumed = size_t(std::floor(end_position));
+	if (consumed > available) {
+		restart_priming();
+		for (size_t channel = 0; channel < channels; ++channel)
+			std::fill_n(dst + channel * dst_stride, frames, 0.0f);
+		result.fill = available;
+		return result;
+	}
+
+	m_ring.read(m_history.data() + JITTER_RESAMPLER_TAPS, consumed, m_history_stride);
+	m_frames_read += consumed;
+
+	for (size_t channel = 0; channel < channels; ++channel) {
+		const AUDIO_BUFFER_T* history = m_history.data() + channel * m_history_stride;
+		AUDIO_BUFFER_T* out = dst + channel * dst_stride;
+		double position = m_phase;
+		for (size_t frame = 0; frame < frames; ++frame, position += m_ratio) {
+			size_t index = size_t(position);
+			double table_position = (position - double(index)) * JITTER_RESAMPLER_PHASES;
+			size_t row = size_t(table_position);
+			float blend = float(table_position - double(row));
+			const float* c0 = m_coefficients.data() + row * JITTER_RESAMPLER_TAPS;
+			const float* c1 = c0 + JITTER_RESAMPLER_TAPS;
+			const AUDIO_BUFFER_T* x = history + index;
+
+			float acc0 = 0.0f;
+			float acc1 = 0.0f;
+			for (size_t tap = 0; tap < JITTER_RESAMPLER_TAPS; ++tap) {
+				acc0 += x[tap] * c0[tap];
+				acc1 += x[tap] * c1[tap];
+			}
+			out[frame] = acc0 + (acc1 - acc0) * blend;
+		}
+
+		// Keep the most recent taps as history for the next block
+		AUDIO_BUFFER_T* channel_history = m_history.data() + channel * m_history_stride;
+		std::copy(channel_history + consumed, channel_history + consumed + JITTER_RESAMPLER_TAPS, channel_history);
+	}
+
+	m_phase = end_position - double(consumed);
+	m_reported_fill.store(m_fill_average, std::memory_order_relaxed);
+	result.played = true;
+	result.consumed = consumed;
+	result.fill = available - consumed;
+	return result;
+}
+
+void AudioJitterBuffer::update_ratio(size_t frames, bool scheduled, double schedule_error)
+{
+	double block_seconds = double(frames) / m_samplerate;
+	double alpha = std::min(1.0, block_seconds / JITTER_FILL_SMOOTHING_SECONDS);
+	m_fill_average += (double(m_ring.read_available()) - m_fill_average) * alpha;
+
+	// Positive error means too much audio is queued, or it is playing late, so the consumer needs to read faster
+	double error = scheduled ? schedule_error : (m_fill_average - double(m_target_frames.load(std::memory_order_relaxed))) / m_samplerate;
+	m_reported_schedule_error.store(scheduled ? schedule_error : 0.0, std::memory_order_relaxed);
+	m_drift_integral = std::clamp(m_drift_integral + error * JITTER_INTEGRAL_GAIN * block_seconds, -JITTER_MAX_RATIO_DEVIATION, JITTER_MAX_RATIO_DEVIATION);
+	m_ratio = std::clamp(1.0 + m_drift_integral + error * JITTER_PROPORTIONAL_GAIN, 1.0 - JITTER_MAX_RATIO_DEVIATION, 1.0 + JITTER_MAX_RATIO_DEVIATION);
+	m_reported_drift.store(1.0 + m_drift_integral, std::memory_order_relaxed);
+}
+
+size_t AudioJitterBuffer::discard(size_t frames)
+{
+	size_t discarded = m_ring.discard(frames);
+	m_frames_read += discarded;
+	return discarded;
+}
+
+bool AudioJitterBuffer::scheduled_lateness(int64_t output_ns, double& lateness)
+{
+	// Output frame 0 is centred on this frame of the producer's count, which sits behind the read position by the
+	// resampler's half width. Before the first frame has played it is a virtual frame ahead of the real ones
+	double next_frame = double(m_frames_read) + m_phase - double(JITTER_RESAMPLER_HALF_TAPS) - 1.0;
+
+	// Use the latest anchor at or before that frame, or extrapolate back from the first one
+	size_t anchor_read = m_anchor_read.load(std::memory_order_relaxed);
+	size_t anchor_write = m_anchor_write.load(std::memory_order_acquire);
+	while (anchor_read != anchor_write && double(m_anchors[anchor_read % m_anchors.size()].frame) <= next_frame) {
+		m_current_anchor = m_anchors[anchor_read % m_anchors.size()];
+		m_has_anchor = true;
+		++anchor_read;
+	}
+	m_anchor_read.store(anchor_read, std::memory_order_release);
+	if (!m_has_anchor && anchor_read != anchor_write) {
+		m_current_anchor = m_anchors[anchor_read % m_anchors.size()];
+		m_has_anchor = true;
+	}
+	if (!m_has_anchor)
+		return false;
+
+	double due_ns = double(m_current_anchor.timestamp) + (next_frame - double(m_current_anchor.frame)) * 1e9 / m_samplerate + double(m_playout_delay.load(std::memory_order_relaxed));
+	lateness = (double(output_ns) - due_ns) * 1e-9;
+	return true;
+}
+
+void AudioJitterBuffer::set_playout_delay(int64_t delay_ns)
+{
+	m_playout_delay.store(std::max<int64_t>(delay_ns, 0), std::memory_order_relaxed);
+}
+
+int64_t AudioJitterBuffer::playout_delay() const
+{
+	return m_playout_delay.load(std::memory_order_relaxed);
+}
+
+double AudioJitterBuffer::schedule_error() const
+{
+	return m_reported_schedule_error.load(std::memory_order_relaxed);
+}
+
+void AudioJitterBuffer::restart_priming()
+{
+	m_priming = true;
+	m_phase = 0.0;
+	m_ratio = 1.0;
+	std::fill(m_history.begin(), m_history.end(), 0.0f);
+}
+
+void AudioJitterBuffer::set_target_latency(size_t frames)
+{
+	m_target_frames.store(std::min(frames, max_target_latency()), std::memory_order_relaxed);
+}
+
+size_t AudioJitterBuffer::target_latency() const
+{
+	return m_target_frames.load(std::memory_order_relaxed);
+}
+
+size_t AudioJitterBuffer::max_target_latency() const
+{
+	// Leave headroom above the target for bursts from the network
+	return m_ring.capacity() / 2;
+}
+
+double AudioJitterBuffer::fill() const
+{
+	return m_reported_fill.load(std::memory_order_relaxed);
+}
+
+double AudioJitterBuffer::drift_ratio() const
+{
+	return m_reported_drift.load(std::memory_order_relaxed);
+}
+
+size_t AudioJitterBuffer::channels() const
+{
+	return m_ring.channels();
+}
+
+double AudioJitterBuffer::samplerate() const
+{
+	return m_samplerate;
+}
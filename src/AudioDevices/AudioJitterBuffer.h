@@ -0,0 +1,105 @@
+#pragma once
+
+#include <atomic>
+#include <vector>
+#include "../AudioComponentBase.h"
+#include "../AudioRingBuffer.h"
+
+// Number of input samples each side of the interpolation point used by the fractional resampler
+#define JITTER_RESAMPLER_HALF_TAPS 8
+#define JITTER_RESAMPLER_TAPS (JITTER_RESAMPLER_HALF_TAPS * 2)
+#define JITTER_RESAMPLER_PHASES 512
+
+// Presentation timestamps remembered for the audio waiting in the buffer
+#define JITTER_SCHEDULE_ANCHORS 64
+
+// Adaptive jitter buffer between a network producer and an audio device consumer.
+// The consumer tracks the average fill level and steers a windowed-sinc fractional resampler
+// so that the fill level converges on the target latency, compensating for drift between the two clocks.
+// With a playout delay set, blocks written with a timestamp are scheduled instead: the controller steers each frame
+// to leave the device at its timestamp plus the delay, so every receiver with the same delay plays in step.
+// write() must only be called from the producer thread, read() only from the consumer (audio) thread.
+class AudioJitterBuffer
+{
+public:
+	AudioJitterBuffer();
+
+	// Allocates all buffers. Not thread safe - only call before the stream starts.
+	void prepare(size_t channels, size_t max_block_frames, size_t capacity_frames, double samplerate);
+
+	// Producer side. Channels missing from src are written as silence. Returns the number of frames accepted.
+	// timestamp is the system clock time in ns of the block's first frame at its source, or 0 if unknown
+	size_t write(const AUDIO_BUFFER_T* src, size_t frames, size_t src_stride, size_t src_channels, int64_t timestamp = 0);
+
+	// What happened to the buffer during a single read, for health reporting
+	struct ReadResult {
+		bool played;		// false if the block was silence because the buffer was priming or ran dry
+		size_t consumed;	// buffered frames the resampler stepped over
+		size_t discarded;	// frames thrown away to bring an overfull buffer back to the target
+		size_t fill;		// frames left in the buffer afterwards
+	};
+
+	// Consumer side. Always fills frames samples per channel, outputting silence while the buffer is priming.
+	// output_ns is the system clock time the first frame of dst will leave the device, used for scheduled playout
+	ReadResult read(AUDIO_BUFFER_T* dst, size_t frames, size_t dst_stride, int64_t output_ns = 0);
+
+	// Delay in ns from a frame's timestamp to when it should be played. 0 turns scheduling off
+	void set_playout_delay(int64_t delay_ns);
+	int64_t playout_delay() const;
+
+	// How late scheduled audio is playing in seconds, negative when early. 0 when not scheduled
+	double schedule_error() const;
+
+	void set_target_latency(size_t frames);
+	size_t target_latency() const;
+	size_t max_target_latency() const;
+
+	// Smoothed number of frames waiting to be played
+	double fill() const;
+
+	// Estimated ratio between the producer and consumer clocks
+	double drift_ratio() const;
+
+	size_t channels() const;
+	double samplerate() const;
+
+private:
+	struct Anchor {
+		uint64_t frame;
+		int64_t timestamp;
+	};
+
+	void update_ratio(size_t frames, bool scheduled, double schedule_error);
+	void restart_priming();
+	size_t discard(size_t frames);
+	bool scheduled_lateness(int64_t output_ns, double& lateness);
+
+	AudioRingBuffer<AUDIO_BUFFER_T> m_ring;
+
+	// Resampler state, only touched by the consumer
+	std::vector<float> m_coefficients;
+	std::vector<AUDIO_BUFFER_T> m_history;
+	size_t m_history_stride;
+	size_t m_max_block_frames;
+	double m_phase;
+	double m_ratio;
+	double m_drift_integral;
+	double m_fill_average;
+	bool m_priming;
+
+	double m_samplerate;
+	std::atomic<size_t> m_target_frames;
+	std::atomic<double> m_reported_fill;
+	std::atomic<double> m_reported_drift;
+
+	// Scheduling. Anchors pair a frame index on the producer's count with the timestamp of that frame
+	std::vector<Anchor> m_anchors;
+	std::atomic<size_t> m_anchor_write;
+	std::atomic<size_t> m_anchor_read;
+	uint64_t m_frames_written;
+	uint64_t m_frames_read;
+	Anchor m_current_anchor;
+	bool m_has_anchor;
+	std::atomic<int64_t> m_playout_delay;
+	std::atomic<double> m_reported_schedule_error;
+};
@@ -0,0 +1,279 @@
+#include "AudioStream.h"
+#include "AudioDevice.h"
+#include <showtime/ZstLogging.h>
+#include <algorithm>
+#include <chrono>
+
+using namespace showtime;
+
+
+AudioStream::AudioStream(std::shared_ptr<AudioDeviceHandle> device_handle, const RtAudio::DeviceInfo& info, const AudioDeviceConfig& config) :
+	m_audio_device(std::make_unique<RtAudio>()),
+	m_device_handle(device_handle),
+	m_info(info),
+	m_config(config),
+	m_num_inputs(info.inputChannels),
+	m_num_outputs(info.outputChannels),
+	m_buffer_frames(0),
+	m_samplerate(0),
+	m_output_latency_ns(0),
+	m_device_format(AudioKernels::SampleFormat::Float32)
+{
+	open();
+	start();
+}
+
+void AudioStream::open()
+{
+	unsigned int device_index = m_device_handle->index.load();
+	unsigned int samplerate = choose_samplerate(m_info, m_config.samplerate);
+	unsigned int bufferFrames = (m_config.buffer_frames) ? m_config.buffer_frames : 512;
+
+	RtAudio::StreamParameters outparams;
+	outparams.deviceId = device_index;
+	outparams.nChannels = m_num_outputs;
+	
+	RtAudio::StreamParameters inparams;
+	inparams.deviceId = device_index;
+	inparams.nChannels = m_num_inputs;
+
+	RtAudioFormat format = choose_format(m_info.nativeFormats, m_device_format);
+	
+	RtAudio::StreamOptions opts;
+	opts.flags = RTAUDIO_NONINTERLEAVED;
+	if (m_config.minimize_latency)
+		opts.flags |= RTAUDIO_MINIMIZE_LATENCY;
+	if (m_config.schedule_realtime)
+		opts.flags |= RTAUDIO_SCHEDULE_REALTIME;
+	opts.numberOfBuffers = m_config.number_of_buffers;
+	opts.priority = m_config.priority;
+
+	try {
+		RtAudioCallback cb = [](void* outputBuffer, void* inputBuffer, unsigned int nBufferFrames, double streamTime, RtAudioStreamStatus status, void* data) -> int {
+			return ((AudioStream*)data)->audio_callback(outputBuffer, inputBuffer, nBufferFrames, streamTime, status);
+		};
+		m_audio_device->openStream((m_num_outputs) ? &outparams : nullptr, (m_num_inputs) ? &inparams : nullptr, format, samplerate, &bufferFrames, cb, (void*)this, &opts);
+	} 
+	catch (RtAudioError& e) {
+		Log::app(Log::Level::error, e.getMessage().c_str());
+	}
+
+	// RtAudio writes the buffer size it settled on back into bufferFrames
+	m_buffer_frames = bufferFrames;
+	m_samplerate = samplerate;
+	if (m_audio_device->isStreamOpen()) {
+		m_samplerate = m_audio_device->getStreamSampleRate();
+		m_output_latency_ns = int64_t(m_audio_device->getStreamLatency()) * 1000000000 / m_samplerate;
+		Log::app(Log::Level::notification, "Opened {} at {}Hz with {} frame buffers ({} buffers requested), stream latency {} frames", m_info.name.c_str(), m_samplerate, m_buffer_frames, opts.numberOfBuffers, m_audio_device->getStreamLatency());
+	}
+
+	// Allocate all buffers from the negotiated stream before starting it
+	if (m_device_format != AudioKernels::SampleFormat::Float32) {
+		m_input_conversion.assign(m_num_inputs * bufferFrames, 0.0f);
+		m_output_conversion.assign(m_num_outputs * bufferFrames, 0.0f);
+	}
+	m_clients.reserve(16);
+}
+
+void AudioStream::start()
+{
+	try {
+		if (m_audio_device->isStreamOpen())
+			m_audio_device->startStream();
+	}
+	catch (RtAudioError& e) {
+		Log::app(Log::Level::error, e.getMessage().c_str());
+	}
+}
+
+AudioStream::~AudioStream()
+{
+	close();
+}
+
+unsigned int AudioStream::choose_samplerate(const RtAudio::DeviceInfo& info, unsigned int requested)
+{
+	unsigned int fallback = (info.preferredSampleRate) ? info.preferredSampleRate : 44100;
+	if (!requested)
+		return fallback;
+	if (info.sampleRates.empty() || std::find(info.sampleRates.begin(), info.sampleRates.end(), requested) != info.sampleRates.end())
+		return requested;
+
+	// Use the closest rate the device reports instead
+	unsigned int closest = *std::min_element(info.sampleRates.begin(), info.sampleRates.end(), [requested](unsigned int a, unsigned int b) {
+		return std::abs(long(a) - long(requested)) < std::abs(long(b) - long(requested));
+	});
+	Log::app(Log::Level::warn, "{} doesn't support {}Hz, using {}Hz", info.name.c_str(), requested, closest);
+	return closest;
+}
+
+RtAudioFormat AudioStream::choose_format(RtAudioFormat native_formats, AudioKernels::SampleFormat& kernel_format)
+{
+	// Float devices need no conversion. Otherwise open the widest native integer format and convert it ourselves
+	const std::pair<RtAudioFormat, AudioKernels::SampleFormat> preferred[] = {
+		{ RTAUDIO_FLOAT32, AudioKernels::SampleFormat::Float32 },
+		{ RTAUDIO_SINT32, AudioKernels::SampleFormat::Int32 },
+		{ RTAUDIO_SINT24, AudioKernels::SampleFormat::Int24 },
+		{ RTAUDIO_SINT16, AudioKernels::SampleFormat::Int16 }
+	};
+	for (const auto& format : preferred) {
+		if (native_formats & format.first) {
+			kernel_format = format.second;
+			Log::app(Log::Level::debug, "Using native sample format {} with {} conversion", format.first, AudioKernels::instruction_set_name(AudioKernels::active_instruction_set()));
+			return format.first;
+		}
+	}
+
+	// No format we can convert natively, so leave it to RtAudio
+	kernel_format = AudioKernels::SampleFormat::Float32;
+	return RTAUDIO_FLOAT32;
+}
+
+void AudioStream::attach(AudioDevice* client)
+{
+	std::lock_guard<std::mutex> lock(m_clients_mtx);
+	m_clients.push_back(client);
+}
+
+void AudioStream::detach(AudioDevice* client)
+{
+	std::lock_guard<std::mutex> lock(m_clients_mtx);
+	m_clients.erase(std::remove(m_clients.begin(), m_clients.end(), client), m_clients.end());
+}
+
+void AudioStream::close()
+{
+	try {
+		if (m_audio_device->isStreamRunning())
+			m_audio_device->abortStream();
+		if (m_audio_device->isStreamOpen())
+			m_audio_device->closeStream();
+	}
+	catch (RtAudioError& e) {
+		Log::app(Log::Level::error, e.getMessage().c_str());
+	}
+}
+
+bool AudioStream::reopen()
+{
+	if (m_audio_device->isStreamOpen())
+		return true;
+
+	// Entities sized everything for the stream they first got, so it has to come back the same or not at all
+	size_t buffer_frames = m_buffer_frames;
+	unsigned int samplerate = m_samplerate;
+	open();
+	if (m_audio_device->isStreamOpen()) {
+		if (m_buffer_frames == buffer_frames && m_samplerate == samplerate) {
+			start();
+			if (m_audio_device->isStreamRunning())
+				return true;
+		}
+		else {
+			Log::app(Log::Level::warn, "{} came back at {}Hz with {} frame buffers instead of {}Hz with {}, leaving it closed", m_info.name.c_str(), m_samplerate, m_buffer_frames, samplerate, buffer_frames);
+		}
+	}
+
+	close();
+	m_buffer_frames = buffer_frames;
+	m_samplerate = samplerate;
+	return false;
+}
+
+bool AudioStream::is_open() const
+{
+	return m_audio_device->isStreamOpen();
+}
+
+const AudioDeviceHandle& AudioStream::handle() const
+{
+	return *m_device_handle;
+}
+
+size_t AudioStream::num_inputs() const
+{
+	return m_num_inputs;
+}
+
+size_t AudioStream::num_outputs() const
+{
+	return m_num_outputs;
+}
+
+size_t AudioStream::buffer_frames() const
+{
+	return m_buffer_frames;
+}
+
+unsigned int AudioStream::samplerate() const
+{
+	return m_samplerate;
+}
+
+long AudioStream::latency() const
+{
+	return m_audio_device->isStreamOpen() ? m_audio_device->getStreamLatency() : 0;
+}
+
+int AudioStream::audio_callback(void* outputBuffer, void* inputBuffer, unsigned int nBufferFrames, double streamTime, RtAudioStreamStatus status)
+{
+	// Planar device input and output - each channel is a contiguous run of nBufferFrames samples
+	const float* input_samples = nullptr;
+	if (inputBuffer) {
+		input_samples = (const float*)inputBuffer;
+		if (m_device_format != AudioKernels::SampleFormat::Float32) {
+			AudioKernels::to_float(m_device_format, inputBuffer, m_input_conversion.data(), m_num_inputs * nBufferFrames);
+			input_samples = m_input_conversion.data();
+		}
+	}
+
+	float* output_samples = nullptr;
+	if (outputBuffer) {
+		output_samples = (m_device_format == AudioKernels::SampleFormat::Float32) ? (float*)outputBuffer : m_output_conversion.data();
+
+		// Channels no client covers stay silent
+		std::fill_n(output_samples, m_num_outputs * nBufferFrames, 0.0f);
+	}
+
+	// Input was captured over the block before this callback, output plays once the device's latency has passed
+	int64_t now = int64_t(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::system_clock::now().time_since_epoch()).count());
+	int64_t callback_ns = m_clock.update(streamTime, now);
+	AudioStreamTime time;
+	time.input_ns = callback_ns - int64_t(nBufferFrames) * 1000000000 / m_samplerate;
+	time.output_ns = callback_ns + m_output_latency_ns;
+
+	// Skip the clients rather than wait while one is being attached or detached
+	if (m_clients_mtx.try_lock()) {
+		for (auto client : m_clients)
+			client->process_stream_block(input_samples, output_samples, nBufferFrames, status, time);
+		m_clients_mtx.unlock();
+	}
+
+	if (outputBuffer && m_device_format != AudioKernels::SampleFormat::Float32)
+		AudioKernels::from_float(m_device_format, output_samples, outputBuffer, m_num_outputs * nBufferFrames);
+
+	return 0;
+}
+
+std::shared_ptr<AudioStream> AudioStreamManager::acquire(std::shared_ptr<AudioDeviceHandle> device_handle, const RtAudio::DeviceInfo& info, const AudioDeviceConfig& config)
+{
+	// Drop streams whose entities have all gone
+	for (auto stream = m_streams.begin(); stream != m_streams.end();) {
+		if (stream->second.expired())
+			stream = m_streams.erase(stream);
+		else
+			++stream;
+	}
+
+	auto existing = m_streams.find(device_handle.get());
+	if (existing != m_streams.end()) {
+		// A re-plugged device keeps its handle, so the stream its remaining entities closed comes back here
+		auto stream = existing->second.lock();
+		stream->reopen();
+		return stream;
+	}
+
+	auto stream = std::make_shared<AudioStream>(device_handle, info, config);
+	m_streams[device_handle.get()] = stream;
+	return stream;
+}
@@ -0,0 +1,97 @@
+#pragma once
+
+#include "RtAudio.h"
+#include "../AudioComponentBase.h"
+#include "../AudioKernels.h"
+#include "AudioDeviceConfig.h"
+#include "AudioStreamClock.h"
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Forwards
+class AudioDevice;
+
+// Links a physical device to the entities using it. Shared between AudioFactory, its creatables and AudioStreams.
+// The factory's watcher updates it when the device list changes
+struct AudioDeviceHandle {
+	AudioDeviceHandle(const std::string& device_name, unsigned int device_index) : name(device_name), index(device_index), present(true) {}
+
+	const std::string name;
+
+	// RtAudio index, which shifts when devices before this one are removed
+	std::atomic<unsigned int> index;
+	std::atomic<bool> present;
+};
+
+// One open RtAudio stream covering every channel of a device.
+// Any number of AudioDevice entities attach to it, each handling its own range of input and output channels inside the shared callback.
+class AudioStream
+{
+public:
+	AudioStream(std::shared_ptr<AudioDeviceHandle> device_handle, const RtAudio::DeviceInfo& info, const AudioDeviceConfig& config);
+	~AudioStream();
+
+	// Clients are called from the audio thread between attach and detach. Both may block briefly - never call from the callback
+	void attach(AudioDevice* client);
+	void detach(AudioDevice* client);
+
+	// Stops the stream once the hardware has gone. Safe to call more than once
+	void close();
+
+	// Opens a closed stream again at the handle's current index once the hardware is back. Fails, leaving the stream
+	// closed, if it can't be opened with the samplerate and buffer size it had before
+	bool reopen();
+
+	bool is_open() const;
+	const AudioDeviceHandle& handle() const;
+	size_t num_inputs() const;
+	size_t num_outputs() const;
+	size_t buffer_frames() const;
+	unsigned int samplerate() const;
+	long latency() const;
+
+private:
+	static RtAudioFormat choose_format(RtAudioFormat native_formats, AudioKernels::SampleFormat& kernel_format);
+	static unsigned int choose_samplerate(const RtAudio::DeviceInfo& info, unsigned int requested);
+	void open();
+	void start();
+	int audio_callback(void* outputBuffer, void* inputBuffer, unsigned int nBufferFrames, double streamTime, RtAudioStreamStatus status);
+
+	std::unique_ptr<RtAudio> m_audio_device;
+	std::shared_ptr<AudioDeviceHandle> m_device_handle;
+	RtAudio::DeviceInfo m_info;
+	AudioDeviceConfig m_config;
+
+	size_t m_num_inputs;
+	size_t m_num_outputs;
+	size_t m_buffer_frames;
+	unsigned int m_samplerate;
+
+	// Stream time to system clock mapping, and how long output takes to reach the hardware once handed over
+	AudioStreamClock m_clock;
+	int64_t m_output_latency_ns;
+
+	// Sample format the device was opened with and the float scratch buffers used to convert it
+	AudioKernels::SampleFormat m_device_format;
+	std::vector<AUDIO_BUFFER_T> m_input_conversion;
+	std::vector<AUDIO_BUFFER_T> m_output_conversion;
+
+	// The callback only try-locks this, so attaching or detaching costs at most one silent block
+	std::mutex m_clients_mtx;
+	std::vector<AudioDevice*> m_clients;
+};
+
+// Hands out one AudioStream per physical device, opening it on first use. Streams close when the last entity using them is destroyed.
+// Only used from the thread that creates entities
+class AudioStreamManager
+{
+public:
+	std::shared_ptr<AudioStream> acquire(std::shared_ptr<AudioDeviceHandle> device_handle, const RtAudio::DeviceInfo& info, const AudioDeviceConfig& config);
+
+private:
+	std::unordered_map<AudioDeviceHandle*, std::weak_ptr<AudioStream>> m_streams;
+};
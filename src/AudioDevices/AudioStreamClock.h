@@ -0,0 +1,63 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+
+// Length of each window the clock offset minimum is tracked over
+#define AUDIO_STREAM_CLOCK_WINDOW_SECONDS 2.0
+
+// System clock times for the samples of one callback, in nanoseconds since the system clock epoch
+struct AudioStreamTime {
+	// When the first input frame was captured
+	int64_t input_ns;
+
+	// When the first output frame will leave the device
+	int64_t output_ns;
+};
+
+// Duration of a frame count in nanoseconds. Whole seconds are split off first so the multiply
+// can't overflow, however long the stream has been running
+inline int64_t frames_to_ns(uint64_t frames, uint32_t samplerate)
+{
+	return int64_t(frames / samplerate) * 1000000000 + int64_t((frames % samplerate) * 1000000000 / samplerate);
+}
+
+// Maps a stream's sample clock (RtAudio's streamTime) onto the system clock, which is assumed to be shared
+// between machines by NTP or PTP. Callbacks can only run late, never early, so the smallest offset between the
+// system clock and the stream time seen recently is the best estimate of the true offset.
+// Keeping the minimum over two alternating windows lets it follow drift between the clocks in either direction.
+// Audio thread only.
+class AudioStreamClock
+{
+public:
+	AudioStreamClock() : m_started(false), m_window_start(0.0), m_current_min(0), m_previous_min(0) {}
+
+	// Returns the system time that corresponds to stream_time
+	int64_t update(double stream_time, int64_t system_now_ns)
+	{
+		int64_t stream_ns = int64_t(stream_time * 1e9);
+		int64_t offset = system_now_ns - stream_ns;
+
+		// Start over if the stream was restarted
+		if (!m_started || stream_time < m_window_start) {
+			m_started = true;
+			m_window_start = stream_time;
+			m_current_min = m_previous_min = offset;
+		}
+		else if (stream_time - m_window_start >= AUDIO_STREAM_CLOCK_WINDOW_SECONDS) {
+			m_window_start = stream_time;
+			m_previous_min = m_current_min;
+			m_current_min = offset;
+		}
+		else {
+			m_current_min = std::min(m_current_min, offset);
+		}
+		return stream_ns + std::min(m_current_min, m_previous_min);
+	}
+
+private:
+	bool m_started;
+	double m_window_start;
+	int64_t m_current_min;
+	int64_t m_previous_min;
+};
@@ -0,0 +1,444 @@
+#include "AudioGraph.h"
+#include "AudioComponentBase.h"
+#include "AudioKernels.h"
+#include <showtime/entities/ZstPlug.h>
+#include <algorithm>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+
+using namespace showtime;
+
+// Cables can change without any component coming or going, so graphs are recompiled this often regardless
+#define AUDIO_GRAPH_COMPILE_INTERVAL std::chrono::milliseconds(500)
+
+namespace {
+	struct Registry {
+		std::mutex mtx;
+		std::unordered_map<std::string, AudioComponentBase*> nodes;
+		std::atomic<uint64_t> generation{ 1 };
+
+		// Every plan that exists, published or not, so remove() can stop the ones using a component
+		std::vector<AudioGraph::Plan*> plans;
+	};
+
+	Registry& registry()
+	{
+		static Registry instance;
+		return instance;
+	}
+
+	AudioComponentBase* find(const std::string& path)
+	{
+		auto& reg = registry();
+		std::lock_guard<std::mutex> lock(reg.mtx);
+		auto node = reg.nodes.find(path);
+		return (node != reg.nodes.end()) ? node->second : nullptr;
+	}
+
+	bool registered_locked(const Registry& reg, AudioComponentBase* node)
+	{
+		return std::any_of(reg.nodes.begin(), reg.nodes.end(), [node](const auto& entry) { return entry.second == node; });
+	}
+
+	bool registered(AudioComponentBase* node)
+	{
+		auto& reg = registry();
+		std::lock_guard<std::mutex> lock(reg.mtx);
+		return registered_locked(reg, node);
+	}
+
+	// Starts tracking a freshly prepared plan. Anything removed since it was compiled leaves it invalid from the start
+	void track(AudioGraph::Plan* plan)
+	{
+		auto& reg = registry();
+		std::lock_guard<std::mutex> lock(reg.mtx);
+		for (auto node : plan->topology.nodes) {
+			if (!registered_locked(reg, node))
+				plan->valid.store(false);
+		}
+		reg.plans.push_back(plan);
+	}
+
+	bool add_node(AudioGraph::Topology& topology, AudioComponentBase* node, AudioComponentBase* sink, size_t frames, std::vector<AudioComponentBase*>& visiting, size_t& index);
+
+	// Follows the cable into each of receiver's audio inputs. Unconnected inputs are skipped
+	bool add_inputs(AudioGraph::Topology& topology, AudioComponentBase* receiver, AudioComponentBase* sink, size_t frames, std::vector<AudioGraph::Edge>& inputs, std::vector<AudioComponentBase*>& visiting)
+	{
+		for (size_t source = 0; source < receiver->audio_input_count(); ++source) {
+			ZstCableBundle upstream;
+			receiver->audio_input(source)->get_child_cables(upstream);
+			if (!upstream.size())
+				continue;
+			if (upstream.size() != 1)
+				return false;
+
+			// Components in another process aren't registered here, so these edges stay on the network
+			auto node = find(upstream.item_at(0)->get_address().get_output_URI().parent().path());
+			size_t index = 0;
+			if (!node || !add_node(topology, node, sink, frames, visiting, index))
+				return false;
+			inputs.push_back(AudioGraph::Edge{ index, source });
+		}
+		return true;
+	}
+
+	// Adds node after everything feeding it, or finds it if another branch already did
+	bool add_node(AudioGraph::Topology& topology, AudioComponentBase* node, AudioComponentBase* sink, size_t frames, std::vector<AudioComponentBase*>& visiting, size_t& index)
+	{
+		auto existing = std::find(topology.nodes.begin(), topology.nodes.end(), node);
+		if (existing != topology.nodes.end()) {
+			index = size_t(existing - topology.nodes.begin());
+			return true;
+		}
+		if (std::find(visiting.begin(), visiting.end(), node) != visiting.end())
+			return false;
+		if (topology.nodes.size() + visiting.size() >= AUDIO_GRAPH_MAX_NODES)
+			return false;
+		if (!node->graph_channels() || node->graph_max_frames() < frames)
+			return false;
+		if (node->graph_owner() && node->graph_owner() != sink)
+			return false;
+
+		// Everything in a graph runs at the sink's samplerate. A node that isn't in a graph yet is set up again for it,
+		// anything else at another rate is left out
+		uint32_t samplerate = sink->graph_samplerate();
+		uint32_t node_samplerate = node->graph_samplerate();
+		if (samplerate && node_samplerate && node_samplerate != samplerate && (node->graph_owner() || !node->set_graph_samplerate(samplerate)))
+			return false;
+
+		// A device can be the sink and a source of its own graph, but nothing else may loop back
+		bool source = node->is_graph_source();
+		if (node == sink && !source)
+			return false;
+
+		std::vector<AudioGraph::Edge> inputs;
+		if (!source) {
+			visiting.push_back(node);
+			bool complete = add_inputs(topology, node, sink, frames, inputs, visiting);
+			visiting.pop_back();
+
+			// A processor with nothing feeding it only ever runs when a message arrives
+			if (!complete || inputs.empty())
+				return false;
+		}
+
+		index = topology.nodes.size();
+		topology.nodes.push_back(node);
+		topology.exclusive.push_back(false);
+		topology.inputs.push_back(inputs);
+		return true;
+	}
+
+	// Sums what feeds a node, or the sink, with the receiver's mix gains. A lone input at unity gain is passed straight through
+	AudioBlockView gather_inputs(const AudioGraph::Plan& plan, AudioComponentBase* receiver, const std::vector<AudioGraph::Edge>& inputs, std::vector<AUDIO_BUFFER_T>& mix)
+	{
+		AudioBlockView block{ nullptr, 0, 0, 0, 0, 0 };
+		if (inputs.empty())
+			return block;
+
+		const size_t frames = plan.frames;
+		block.frames = frames;
+		if (inputs.size() == 1 && receiver->mix_gain(inputs[0].source) == 1.0f) {
+			block.samples = plan.outputs[inputs[0].node].data();
+			block.channels = plan.channels[inputs[0].node];
+			return block;
+		}
+
+		size_t channels = 0;
+		for (const auto& input : inputs)
+			channels = std::max(channels, plan.channels[input.node]);
+		std::fill_n(mix.data(), channels * frames, 0.0f);
+		for (const auto& input : inputs) {
+			float gain = receiver->mix_gain(input.source);
+			if (gain == 0.0f)
+				continue;
+			const AUDIO_BUFFER_T* samples = plan.outputs[input.node].data();
+			for (size_t channel = 0; channel < plan.channels[input.node]; ++channel)
+				AudioKernels::mix_add(samples + channel * frames, mix.data() + channel * frames, gain, frames);
+		}
+		block.samples = mix.data();
+		block.channels = channels;
+		return block;
+	}
+
+	// AudioTaskScheduler::TaskFunction running one node of a plan
+	void render_node(void* context, uint32_t task)
+	{
+		auto& plan = *static_cast<AudioGraph::Plan*>(context);
+		AudioComponentBase* node = plan.topology.nodes[task];
+		AudioBlockView input = gather_inputs(plan, node, plan.topology.inputs[task], plan.mixes[task]);
+		size_t rendered = node->render_graph_block(input, plan.outputs[task].data(), plan.frames);
+		plan.channels[task] = std::min(rendered, plan.outputs[task].size() / plan.frames);
+	}
+}
+
+namespace AudioGraph {
+
+	void add(AudioComponentBase* node, const std::string& path)
+	{
+		auto& reg = registry();
+		std::lock_guard<std::mutex> lock(reg.mtx);
+		reg.nodes[path] = node;
+		reg.generation++;
+	}
+
+	void remove(AudioComponentBase* node)
+	{
+		auto& reg = registry();
+		std::lock_guard<std::mutex> lock(reg.mtx);
+		auto entry = std::find_if(reg.nodes.begin(), reg.nodes.end(), [node](const auto& entry) { return entry.second == node; });
+		if (entry == reg.nodes.end())
+			return;
+		reg.nodes.erase(entry);
+		reg.generation++;
+
+		std::vector<Plan*> affected;
+		for (auto plan : reg.plans) {
+			if (std::find(plan->topology.nodes.begin(), plan->topology.nodes.end(), node) != plan->topology.nodes.end()) {
+				plan->valid.store(false);
+				affected.push_back(plan);
+			}
+		}
+
+		// Callbacks that got in before the plan was invalidated may still be using the node. Later ones back off.
+		// Holding the lock keeps the tick thread from freeing the plans meanwhile, and render never takes it
+		for (auto plan : affected) {
+			while (plan->executing.load())
+				std::this_thread::yield();
+		}
+	}
+
+	uint64_t generation()
+	{
+		return registry().generation.load();
+	}
+
+	Plan::~Plan()
+	{
+		auto& reg = registry();
+		std::lock_guard<std::mutex> lock(reg.mtx);
+		reg.plans.erase(std::remove(reg.plans.begin(), reg.plans.end(), this), reg.plans.end());
+	}
+
+	bool Topology::operator==(const Topology& other) const
+	{
+		return nodes == other.nodes && exclusive == other.exclusive && inputs == other.inputs && sink_inputs == other.sink_inputs;
+	}
+
+	Executor::Executor() :
+		m_pending(nullptr),
+		m_active(nullptr),
+		m_retired(nullptr),
+		m_published_generation(0),
+		m_threads(0),
+		m_priority(0),
+		m_running(false)
+	{
+	}
+
+	Executor::~Executor()
+	{
+		// Owners call clear first, which has already released every node
+		delete m_pending.exchange(nullptr);
+		delete m_retired.exchange(nullptr);
+		delete m_active;
+	}
+
+	void Executor::update(AudioComponentBase* sink, size_t frames)
+	{
+		collect_retired(sink);
+
+		auto now = std::chrono::steady_clock::now();
+		uint64_t current_generation = generation();
+		if (now - m_last_compile < AUDIO_GRAPH_COMPILE_INTERVAL && current_generation == m_published_generation)
+			return;
+		m_last_compile = now;
+
+		// An empty topology still gets published when a graph was running, so the audio thread stops using it
+		Topology topology;
+		if (!compile(sink, frames, topology))
+			topology = Topology();
+		if (topology == m_published && current_generation == m_published_generation)
+			return;
+
+		bool was_running = !m_published.nodes.empty();
+		if (topology.nodes.empty() && !was_running) {
+			m_published_generation = current_generation;
+			return;
+		}
+		auto plan = prepare(sink, topology, frames);
+
+		// Claim the new graph's nodes before the audio thread can run it. Nodes only in the old one are released once
+		// the audio thread hands it back
+		for (size_t idx = 0; idx < topology.nodes.size(); ++idx)
+			topology.nodes[idx]->set_graph_owner(sink, topology.exclusive[idx]);
+
+		m_published = std::move(topology);
+		m_published_generation = current_generation;
+		m_running.store(!m_published.nodes.empty(), std::memory_order_relaxed);
+
+		// Whatever the audio thread never picked up can go straight away
+		Plan* superseded = m_pending.exchange(plan.release(), std::memory_order_acq_rel);
+		release(superseded, sink);
+		delete superseded;
+	}
+
+	void Executor::clear(AudioComponentBase* sink)
+	{
+		Plan* plans[3] = { m_pending.exchange(nullptr), m_retired.exchange(nullptr), m_active };
+		m_active = nullptr;
+		m_published = Topology();
+		for (Plan* plan : plans) {
+			release(plan, sink);
+			delete plan;
+		}
+		m_running.store(false, std::memory_order_relaxed);
+	}
+
+	void Executor::set_threads(size_t threads, int priority)
+	{
+		m_threads = threads;
+		m_priority = priority;
+		m_published_generation = 0;
+	}
+
+	bool Executor::render(AUDIO_BUFFER_T* output, size_t channels, size_t frames)
+	{
+		// Only swap once the tick thread has taken the previous plan back, so retiring never has to free anything here
+		if (!m_retired.load(std::memory_order_acquire)) {
+			Plan* next = m_pending.exchange(nullptr, std::memory_order_acq_rel);
+			if (next) {
+				m_retired.store(m_active, std::memory_order_release);
+				m_active = next;
+			}
+		}
+
+		Plan* plan = m_active;
+		if (!plan || plan->topology.nodes.empty() || plan->frames != frames)
+			return false;
+
+		plan->executing.fetch_add(1);
+		if (!plan->valid.load()) {
+			plan->executing.fetch_sub(1);
+			return false;
+		}
+
+		if (plan->scheduler) {
+			plan->scheduler->run(plan->tasks, &render_node, plan);
+		}
+		else {
+			for (uint32_t task = 0; task < plan->topology.nodes.size(); ++task)
+				render_node(plan, task);
+		}
+		AudioBlockView block = gather_inputs(*plan, plan->sink, plan->topology.sink_inputs, plan->sink_mix);
+		plan->executing.fetch_sub(1);
+
+		// Output channels beyond the graph's stay as they were
+		size_t copied = std::min(block.channels, channels);
+		std::copy(block.samples, block.samples + copied * frames, output);
+		return true;
+	}
+
+	bool Executor::running() const
+	{
+		return m_running.load(std::memory_order_relaxed);
+	}
+
+	bool Executor::compile(AudioComponentBase* sink, size_t frames, Topology& topology) const
+	{
+		if (!frames)
+			return false;
+
+		// Walk upstream from every audio input of the sink, giving up on anything that can't run in this callback
+		std::vector<AudioComponentBase*> visiting;
+		if (!add_inputs(topology, sink, sink, frames, topology.sink_inputs, visiting) || topology.sink_inputs.empty())
+			return false;
+
+		// Every cable into the sink or a processor in the graph is an edge of it. Sources don't render their inputs here,
+		// so cables into them aren't
+		for (size_t idx = 0; idx < topology.nodes.size(); ++idx) {
+			AudioComponentBase* node = topology.nodes[idx];
+			ZstCableBundle downstream;
+			node->outgoing_audio()->get_child_cables(downstream);
+			bool exclusive = true;
+			for (auto cable : downstream) {
+				auto receiver = find(cable->get_address().get_input_URI().parent().path());
+				auto member = std::find(topology.nodes.begin(), topology.nodes.end(), receiver);
+				if (receiver != sink && (member == topology.nodes.end() || receiver->is_graph_source()))
+					exclusive = false;
+			}
+
+			// Processors render inside this callback, so they have no other way to reach anything else they feed
+			if (!exclusive && !node->is_graph_source())
+				return false;
+			topology.exclusive[idx] = exclusive;
+		}
+		return true;
+	}
+
+	std::unique_ptr<Plan> Executor::prepare(AudioComponentBase* sink, const Topology& topology, size_t frames) const
+	{
+		auto plan = std::make_unique<Plan>();
+		plan->topology = topology;
+		plan->sink = sink;
+		plan->frames = frames;
+
+		const size_t count = topology.nodes.size();
+		auto widest_input = [&topology](const std::vector<Edge>& inputs) {
+			size_t widest = 0;
+			for (const auto& input : inputs)
+				widest = std::max(widest, topology.nodes[input.node]->graph_channels());
+			return widest;
+		};
+
+		// Nodes at the same depth never depend on each other, so the busiest depth bounds how many threads can help
+		std::vector<std::vector<uint32_t>> predecessors(count);
+		std::vector<size_t> depths(count, 0);
+		std::vector<size_t> widths(count, 0);
+		plan->outputs.resize(count);
+		plan->mixes.resize(count);
+		plan->channels.assign(count, 0);
+		for (size_t idx = 0; idx < count; ++idx) {
+			plan->outputs[idx].assign(topology.nodes[idx]->graph_channels() * frames, 0.0f);
+			plan->mixes[idx].assign(widest_input(topology.inputs[idx]) * frames, 0.0f);
+			for (const auto& input : topology.inputs[idx]) {
+				predecessors[idx].push_back(uint32_t(input.node));
+				depths[idx] = std::max(depths[idx], depths[input.node] + 1);
+			}
+			widths[depths[idx]]++;
+		}
+		plan->sink_mix.assign(widest_input(topology.sink_inputs) * frames, 0.0f);
+		plan->tasks.build(predecessors);
+
+		size_t cores = std::thread::hardware_concurrency();
+		size_t threads = m_threads ? m_threads : std::max<size_t>(cores, 2) - 1;
+		size_t width = count ? *std::max_element(widths.begin(), widths.end()) : 1;
+		size_t workers = std::min(threads, width) - 1;
+		if (workers)
+			plan->scheduler = std::make_unique<AudioTaskScheduler>(workers, count, m_priority);
+		track(plan.get());
+		return plan;
+	}
+
+	void Executor::collect_retired(AudioComponentBase* sink)
+	{
+		Plan* retired = m_retired.exchange(nullptr, std::memory_order_acq_rel);
+		release(retired, sink);
+		delete retired;
+	}
+
+	void Executor::release(Plan* plan, AudioComponentBase* sink)
+	{
+		if (!plan)
+			return;
+
+		// Nodes destroyed since the plan was compiled are gone from the registry and must not be touched
+		for (auto node : plan->topology.nodes) {
+			if (std::find(m_published.nodes.begin(), m_published.nodes.end(), node) != m_published.nodes.end())
+				continue;
+			if (registered(node) && node->graph_owner() == sink)
+				node->set_graph_owner(nullptr, false);
+		}
+	}
+}
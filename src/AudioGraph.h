@@ -0,0 +1,135 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+#include "AudioBlock.h"
+#include "AudioTaskScheduler.h"
+
+// Most components compiled into one callback, sources and processors included
+#define AUDIO_GRAPH_MAX_NODES 64
+
+// Forwards
+class AudioComponentBase;
+
+// In-process audio graph.
+// Every audio component in the process registers here under its URI path. A sink device compiles the cables feeding
+// its audio inputs into an Executor, and runs the whole graph synchronously inside its own callback instead of
+// waiting for each hop to arrive as a message. Branches meet at mix inputs, where they are summed with the mix gains,
+// and a node may feed several others in the same graph. Branches that don't depend on each other run side by side on
+// an AudioTaskScheduler. Only graphs made entirely of components in this process are compiled. Anything else - a cable
+// from another performer, a processor that also feeds something outside the graph - leaves the sink on its normal
+// network path.
+namespace AudioGraph {
+
+	// Called when a component is registered and destroyed. remove() stops every plan the component is part of, and
+	// doesn't return until no callback can still be running one of them. Other plans carry on undisturbed
+	void add(AudioComponentBase* node, const std::string& path);
+	void remove(AudioComponentBase* node);
+
+	// Bumped whenever a component comes or goes, so executors recompile straight away rather than at their next interval
+	uint64_t generation();
+
+	// A cable between two nodes, seen from the receiving end. source is the receiver's audio input, 0 for IN_audio
+	struct Edge {
+		size_t node;
+		size_t source;
+		bool operator==(const Edge& other) const { return node == other.node && source == other.source; }
+	};
+
+	// What a graph is made of. Recompiling the same topology doesn't republish it
+	struct Topology {
+		// Every node after all of the nodes feeding it
+		std::vector<AudioComponentBase*> nodes;
+
+		// Whether every outgoing cable of the node leads into the graph, so it needn't publish at all
+		std::vector<bool> exclusive;
+
+		// What feeds each node, and what feeds the sink
+		std::vector<std::vector<Edge>> inputs;
+		std::vector<Edge> sink_inputs;
+
+		bool operator==(const Topology& other) const;
+	};
+
+	struct Plan {
+		Plan() = default;
+		Plan(const Plan&) = delete;
+		Plan& operator=(const Plan&) = delete;
+		~Plan();
+
+		Topology topology;
+		AudioComponentBase* sink = nullptr;
+
+		// Each node's output, and the sum of its inputs where there is more than one, preallocated for the widest case
+		std::vector<std::vector<AUDIO_BUFFER_T>> outputs;
+		std::vector<std::vector<AUDIO_BUFFER_T>> mixes;
+		std::vector<AUDIO_BUFFER_T> sink_mix;
+		std::vector<size_t> channels;
+
+		// Only graphs with branches to spread get worker threads
+		AudioTaskScheduler::Graph tasks;
+		std::unique_ptr<AudioTaskScheduler> scheduler;
+		size_t frames = 0;
+
+		// Cleared once one of the plan's nodes leaves the process. Audio threads stop running the plan from then on
+		std::atomic<bool> valid{ true };
+
+		// Audio threads currently inside the plan
+		std::atomic<int> executing{ 0 };
+	};
+
+	// Runs a sink's graph. The tick thread compiles and publishes plans, the sink's audio thread renders them.
+	// Plans are handed to the audio thread and back without locks, and only ever freed on the tick thread
+	class Executor
+	{
+	public:
+		Executor();
+		~Executor();
+
+		// Tick thread. Recompiles the graph feeding sink every so often, or straight away once a component comes or goes,
+		// and hands it over if it changed
+		void update(AudioComponentBase* sink, size_t frames);
+
+		// Tick thread, once the sink's stream can no longer call render. Drops every plan and releases its nodes
+		void clear(AudioComponentBase* sink);
+
+		// Tick thread. Threads a graph may use, the sink's audio thread included. 1 renders every node in the callback,
+		// 0 uses one per core but one, leaving that for the rest of the process. priority is the real-time priority of the
+		// sink's audio thread, or 0 if it isn't real-time. Takes effect the next time the graph is compiled
+		void set_threads(size_t threads, int priority);
+
+		// Audio thread. Renders a block of the graph into planar output. Returns false, leaving output untouched,
+		// when there is no graph to run
+		bool render(AUDIO_BUFFER_T* output, size_t channels, size_t frames);
+
+		// Whether the sink's audio currently comes from a graph rather than the network
+		bool running() const;
+
+	private:
+		bool compile(AudioComponentBase* sink, size_t frames, Topology& topology) const;
+		std::unique_ptr<Plan> prepare(AudioComponentBase* sink, const Topology& topology, size_t frames) const;
+		void collect_retired(AudioComponentBase* sink);
+		void release(Plan* plan, AudioComponentBase* sink);
+
+		// Published by the tick thread, picked up by the audio thread
+		std::atomic<Plan*> m_pending;
+
+		// Owned by the audio thread while it runs it
+		Plan* m_active;
+
+		// Handed back by the audio thread for the tick thread to free
+		std::atomic<Plan*> m_retired;
+
+		// Tick thread's copy of the topology last published
+		Topology m_published;
+		uint64_t m_published_generation;
+		size_t m_threads;
+		int m_priority;
+		std::chrono::steady_clock::time_point m_last_compile;
+		std::atomic<bool> m_running;
+	};
+}
@@ -0,0 +1,569 @@
+#include "AudioKernels.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define AUDIO_KERNELS_X86 1
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#endif
+
+// GCC and Clang need per-function target attributes to emit instructions above the build baseline. MSVC doesn't.
+#if defined(AUDIO_KERNELS_X86) && !defined(_MSC_VER)
+#define AUDIO_KERNEL_TARGET(x) __attribute__((target(x)))
+#else
+#define AUDIO_KERNEL_TARGET(x)
+#endif
+
+// Integer scaling used by RtAudio: float = (int + 0.5) / (max + 0.5)
+#define INT16_SCALE 32767.5f
+#define INT24_SCALE 8388607.5f
+#define INT32_SCALE 2147483647.5
+
+#define INT24_MIN -8388608
+#define INT24_MAX 8388607
+
+// Largest float that converts to an int32 without overflowing
+#define INT32_MAX_FLOAT 2147483520.0f
+
+namespace AudioKernels {
+
+	// ----------------
+	// Scalar kernels
+	// ----------------
+
+	namespace scalar {
+		inline float clamp_unit(float value)
+		{
+			return std::min(1.0f, std::max(-1.0f, value));
+		}
+
+		inline int32_t read_int24(const uint8_t* src)
+		{
+			int32_t value = int32_t(uint32_t(src[0]) << 8 | uint32_t(src[1]) << 16 | uint32_t(src[2]) << 24);
+			return value >> 8;
+		}
+
+		inline void write_int24(int32_t value, uint8_t* dst)
+		{
+			dst[0] = uint8_t(value);
+			dst[1] = uint8_t(value >> 8);
+			dst[2] = uint8_t(value >> 16);
+		}
+
+		void int16_to_float(const int16_t* src, float* dst, size_t count)
+		{
+			for (size_t idx = 0; idx < count; ++idx)
+				dst[idx] = (float(src[idx]) + 0.5f) / INT16_SCALE;
+		}
+
+		void float_to_int16(const float* src, int16_t* dst, size_t count)
+		{
+			for (size_t idx = 0; idx < count; ++idx)
+				dst[idx] = int16_t(clamp_unit(src[idx]) * INT16_SCALE - 0.5f);
+		}
+
+		void int24_to_float(const uint8_t* src, float* dst, size_t count)
+		{
+			for (size_t idx = 0; idx < count; ++idx)
+				dst[idx] = (float(read_int24(src + idx * 3)) + 0.5f) / INT24_SCALE;
+		}
+
+		void float_to_int24(const float* src, uint8_t* dst, size_t count)
+		{
+			for (size_t idx = 0; idx < count; ++idx) {
+				int32_t value = int32_t(clamp_unit(src[idx]) * INT24_SCALE - 0.5f);
+				write_int24(std::min(INT24_MAX, std::max(INT24_MIN, value)), dst + idx * 3);
+			}
+		}
+
+		void int32_to_float(const int32_t* src, float* dst, size_t count)
+		{
+			for (size_t idx = 0; idx < count; ++idx)
+				dst[idx] = float((double(src[idx]) + 0.5) / INT32_SCALE);
+		}
+
+		void float_to_int32(const float* src, int32_t* dst, size_t count)
+		{
+			for (size_t idx = 0; idx < count; ++idx)
+				dst[idx] = int32_t(std::min(double(INT32_MAX_FLOAT), double(clamp_unit(src[idx])) * INT32_SCALE - 0.5));
+		}
+
+		void float_to_double(const float* src, double* dst, size_t count)
+		{
+			for (size_t idx = 0; idx < count; ++idx)
+				dst[idx] = double(src[idx]);
+		}
+
+		void double_to_float(const double* src, float* dst, size_t count)
+		{
+			for (size_t idx = 0; idx < count; ++idx)
+				dst[idx] = float(src[idx]);
+		}
+
+		void mix_add(const float* src, float* dst, float gain, size_t count)
+		{
+			for (size_t idx = 0; idx < count; ++idx)
+				dst[idx] += src[idx] * gain;
+		}
+	}
+
+#ifdef AUDIO_KERNELS_X86
+
+	// ----------------
+	// SSE4.1 kernels
+	// ----------------
+
+	namespace sse41 {
+		AUDIO_KERNEL_TARGET("sse4.1")
+		void int16_to_float(const int16_t* src, float* dst, size_t count)
+		{
+			const __m128 scale = _mm_set1_ps(1.0f / INT16_SCALE);
+			const __m128 offset = _mm_set1_ps(0.5f / INT16_SCALE);
+			size_t idx = 0;
+			for (; idx + 8 <= count; idx += 8) {
+				__m128i packed = _mm_loadu_si128((const __m128i*)(src + idx));
+				__m128 lo = _mm_cvtepi32_ps(_mm_cvtepi16_epi32(packed));
+				__m128 hi = _mm_cvtepi32_ps(_mm_cvtepi16_epi32(_mm_srli_si128(packed, 8)));
+				_mm_storeu_ps(dst + idx, _mm_add_ps(_mm_mul_ps(lo, scale), offset));
+				_mm_storeu_ps(dst + idx + 4, _mm_add_ps(_mm_mul_ps(hi, scale), offset));
+			}
+			scalar::int16_to_float(src + idx, dst + idx, count - idx);
+		}
+
+		AUDIO_KERNEL_TARGET("sse4.1")
+		void float_to_int16(const float* src, int16_t* dst, size_t count)
+		{
+			const __m128 scale = _mm_set1_ps(INT16_SCALE);
+			const __m128 offset = _mm_set1_ps(0.5f);
+			const __m128 one = _mm_set1_ps(1.0f);
+			const __m128 minus_one = _mm_set1_ps(-1.0f);
+			size_t idx = 0;
+			for (; idx + 8 <= count; idx += 8) {
+				__m128 lo = _mm_max_ps(minus_one, _mm_min_ps(one, _mm_loadu_ps(src + idx)));
+				__m128 hi = _mm_max_ps(minus_one, _mm_min_ps(one, _mm_loadu_ps(src + idx + 4)));
+				__m128i lo_int = _mm_cvttps_epi32(_mm_sub_ps(_mm_mul_ps(lo, scale), offset));
+				__m128i hi_int = _mm_cvttps_epi32(_mm_sub_ps(_mm_mul_ps(hi, scale), offset));
+				_mm_storeu_si128((__m128i*)(dst + idx), _mm_packs_epi32(lo_int, hi_int));
+			}
+			scalar::float_to_int16(src + idx, dst + idx, count - idx);
+		}
+
+		AUDIO_KERNEL_TARGET("sse4.1")
+		inline __m128 int24_block_to_float(const uint8_t* src, __m128 scale, __m128 offset)
+		{
+			// Move each 3 byte sample into the top of a 32 bit lane then shift down to sign extend
+			const __m128i spread = _mm_setr_epi8(-1, 0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11);
+			__m128i values = _mm_srai_epi32(_mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)src), spread), 8);
+			return _mm_add_ps(_mm_mul_ps(_mm_cvtepi32_ps(values), scale), offset);
+		}
+
+		AUDIO_KERNEL_TARGET("sse4.1")
+		void int24_to_float(const uint8_t* src, float* dst, size_t count)
+		{
+			const __m128 scale = _mm_set1_ps(1.0f / INT24_SCALE);
+			const __m128 offset = _mm_set1_ps(0.5f / INT24_SCALE);
+			size_t idx = 0;
+
+			// Each load reads 16 bytes but only consumes 12, so stop while a full load is still in bounds
+			for (; idx + 6 <= count; idx += 4) {
+				_mm_storeu_ps(dst + idx, int24_block_to_float(src + idx * 3, scale, offset));
+			}
+			scalar::int24_to_float(src + idx * 3, dst + idx, count - idx);
+		}
+
+		AUDIO_KERNEL_TARGET("sse4.1")
+		inline __m128i float_block_to_int24(__m128 values, __m128 scale, __m128 offset)
+		{
+			const __m128 one = _mm_set1_ps(1.0f);
+			const __m128 minus_one = _mm_set1_ps(-1.0f);
+			values = _mm_max_ps(minus_one, _mm_min_ps(one, values));
+			__m128i ints = _mm_cvttps_epi32(_mm_sub_ps(_mm_mul_ps(values, scale), offset));
+			ints = _mm_min_epi32(_mm_set1_epi32(INT24_MAX), _mm_max_epi32(_mm_set1_epi32(INT24_MIN), ints));
+
+			// Pack the low 3 bytes of each lane into the first 12 bytes
+			const __m128i pack = _mm_setr_epi8(0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1);
+			return _mm_shuffle_epi8(ints, pack);
+		}
+
+		AUDIO_KERNEL_TARGET("sse4.1")
+		inline void store_int24_block(__m128i packed, uint8_t* dst)
+		{
+			_mm_storel_epi64((__m128i*)dst, packed);
+			int32_t tail = _mm_cvtsi128_si32(_mm_srli_si128(packed, 8));
+			std::memcpy(dst + 8, &tail, 4);
+		}
+
+		AUDIO_KERNEL_TARGET("sse4.1")
+		void float_to_int24(const float* src, uint8_t* dst, size_t count)
+		{
+			const __m128 scale = _mm_set1_ps(INT24_SCALE);
+			const __m128 offset = _mm_set1_ps(0.5f);
+			size_t idx = 0;
+			for (; idx + 4 <= count; idx += 4) {
+				store_int24_block(float_block_to_int24(_mm_loadu_ps(src + idx), scale, offset), dst + idx * 3);
+			}
+			scalar::float_to_int24(src + idx, dst + idx * 3, count - idx);
+		}
+
+		AUDIO_KERNEL_TARGET("sse4.1")
+		void int32_to_float(const int32_t* src, float* dst, size_t count)
+		{
+			// Single precision can't represent the 0.5 offset at this magnitude so it is dropped
+			const __m128 scale = _mm_set1_ps(float(1.0 / INT32_SCALE));
+			size_t idx = 0;
+			for (; idx + 4 <= count; idx += 4) {
+				__m128 values = _mm_cvtepi32_ps(_mm_loadu_si128((const __m128i*)(src + idx)));
+				_mm_storeu_ps(dst + idx, _mm_mul_ps(values, scale));
+			}
+			scalar::int32_to_float(src + idx, dst + idx, count - idx);
+		}
+
+		AUDIO_KERNEL_TARGET("sse4.1")
+		void float_to_int32(const float* src, int32_t* dst, size_t count)
+		{
+			const __m128 scale = _mm_set1_ps(float(INT32_SCALE));
+			const __m128 max_value = _mm_set1_ps(INT32_MAX_FLOAT);
+			const __m128 one = _mm_set1_ps(1.0f);
+			const __m128 minus_one = _mm_set1_ps(-1.0f);
+			size_t idx = 0;
+			for (; idx + 4 <= count; idx += 4) {
+				__m128 values = _mm_max_ps(minus_one, _mm_min_ps(one, _mm_loadu_ps(src + idx)));
+				values = _mm_min_ps(max_value, _mm_mul_ps(values, scale));
+				_mm_storeu_si128((__m128i*)(dst + idx), _mm_cvttps_epi32(values));
+			}
+			scalar::float_to_int32(src + idx, dst + idx, count - idx);
+		}
+
+		AUDIO_KERNEL_TARGET("sse4.1")
+		void float_to_double(const float* src, double* dst, size_t count)
+		{
+			size_t idx = 0;
+			for (; idx + 4 <= count; idx += 4) {
+				__m128 values = _mm_loadu_ps(src + idx);
+				_mm_storeu_pd(dst + idx, _mm_cvtps_pd(values));
+				_mm_storeu_pd(dst + idx + 2, _mm_cvtps_pd(_mm_movehl_ps(values, values)));
+			}
+			scalar::float_to_double(src + idx, dst + idx, count - idx);
+		}
+
+		AUDIO_KERNEL_TARGET("sse4.1")
+		void double_to_float(const double* src, float* dst, size_t count)
+		{
+			size_t idx = 0;
+			for (; idx + 4 <= count; idx += 4) {
+				__m128 lo = _mm_cvtpd_ps(_mm_loadu_pd(src + idx));
+				__m128 hi = _mm_cvtpd_ps(_mm_loadu_pd(src + idx + 2));
+				_mm_storeu_ps(dst + idx, _mm_movelh_ps(lo, hi));
+			}
+			scalar::double_to_float(src + idx, dst + idx, count - idx);
+		}
+
+		AUDIO_KERNEL_TARGET("sse4.1")
+		void mix_add(const float* src, float* dst, float gain, size_t count)
+		{
+			const __m128 gains = _mm_set1_ps(gain);
+			size_t idx = 0;
+			for (; idx + 4 <= count; idx += 4) {
+				_mm_storeu_ps(dst + idx, _mm_add_ps(_mm_loadu_ps(dst + idx), _mm_mul_ps(_mm_loadu_ps(src + idx), gains)));
+			}
+			scalar::mix_add(src + idx, dst + idx, gain, count - idx);
+		}
+	}
+
+	// ----------------
+	// AVX2 kernels
+	// ----------------
+
+	namespace avx2 {
+		AUDIO_KERNEL_TARGET("avx2")
+		void int16_to_float(const int16_t* src, float* dst, size_t count)
+		{
+			const __m256 scale = _mm256_set1_ps(1.0f / INT16_SCALE);
+			const __m256 offset = _mm256_set1_ps(0.5f / INT16_SCALE);
+			size_t idx = 0;
+			for (; idx + 16 <= count; idx += 16) {
+				__m256 lo = _mm256_cvtepi32_ps(_mm256_cvtepi16_epi32(_mm_loadu_si128((const __m128i*)(src + idx))));
+				__m256 hi = _mm256_cvtepi32_ps(_mm256_cvtepi16_epi32(_mm_loadu_si128((const __m128i*)(src + idx + 8))));
+				_mm256_storeu_ps(dst + idx, _mm256_add_ps(_mm256_mul_ps(lo, scale), offset));
+				_mm256_storeu_ps(dst + idx + 8, _mm256_add_ps(_mm256_mul_ps(hi, scale), offset));
+			}
+			sse41::int16_to_float(src + idx, dst + idx, count - idx);
+		}
+
+		AUDIO_KERNEL_TARGET("avx2")
+		void float_to_int16(const float* src, int16_t* dst, size_t count)
+		{
+			const __m256 scale = _mm256_set1_ps(INT16_SCALE);
+			const __m256 offset = _mm256_set1_ps(0.5f);
+			const __m256 one = _mm256_set1_ps(1.0f);
+			const __m256 minus_one = _mm256_set1_ps(-1.0f);
+			size_t idx = 0;
+			for (; idx + 16 <= count; idx += 16) {
+				__m256 lo = _mm256_max_ps(minus_one, _mm256_min_ps(one, _mm256_loadu_ps(src + idx)));
+				__m256 hi = _mm256_max_ps(minus_one, _mm256_min_ps(one, _mm256_loadu_ps(src + idx + 8)));
+				__m256i lo_int = _mm256_cvttps_epi32(_mm256_sub_ps(_mm256_mul_ps(lo, scale), offset));
+				__m256i hi_int = _mm256_cvttps_epi32(_mm256_sub_ps(_mm256_mul_ps(hi, scale), offset));
+
+				// Packing works per 128 bit lane so the 64 bit quarters need reordering afterwards
+				__m256i packed = _mm256_permute4x64_epi64(_mm256_packs_epi32(lo_int, hi_int), 0xD8);
+				_mm256_storeu_si256((__m256i*)(dst + idx), packed);
+			}
+			sse41::float_to_int16(src + idx, dst + idx, count - idx);
+		}
+
+		AUDIO_KERNEL_TARGET("avx2")
+		void int24_to_float(const uint8_t* src, float* dst, size_t count)
+		{
+			const __m256i spread = _mm256_setr_epi8(
+				-1, 0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11,
+				-1, 0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11);
+			const __m256 scale = _mm256_set1_ps(1.0f / INT24_SCALE);
+			const __m256 offset = _mm256_set1_ps(0.5f / INT24_SCALE);
+			size_t idx = 0;
+
+			// The upper load starts 12 bytes in and reads 16, so keep 28 bytes in bounds
+			for (; idx + 10 <= count; idx += 8) {
+				const uint8_t* block = src + idx * 3;
+				__m256i bytes = _mm256_inserti128_si256(_mm256_castsi128_si256(_mm_loadu_si128((const __m128i*)block)), _mm_loadu_si128((const __m128i*)(block + 12)), 1);
+				__m256i values = _mm256_srai_epi32(_mm256_shuffle_epi8(bytes, spread), 8);
+				_mm256_storeu_ps(dst + idx, _mm256_add_ps(_mm256_mul_ps(_mm256_cvtepi32_ps(values), scale), offset));
+			}
+			sse41::int24_to_float(src + idx * 3, dst + idx, count - idx);
+		}
+
+		AUDIO_KERNEL_TARGET("avx2")
+		void float_to_int24(const float* src, uint8_t* dst, size_t count)
+		{
+			const __m256 scale = _mm256_set1_ps(INT24_SCALE);
+			const __m256 offset = _mm256_set1_ps(0.5f);
+			const __m256 one = _mm256_set1_ps(1.0f);
+			const __m256 minus_one = _mm256_set1_ps(-1.0f);
+			const __m256i pack = _mm256_setr_epi8(
+				0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1,
+				0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1);
+			size_t idx = 0;
+			for (; idx + 8 <= count; idx += 8) {
+				__m256 values = _mm256_max_ps(minus_one, _mm256_min_ps(one, _mm256_loadu_ps(src + idx)));
+				__m256i ints = _mm256_cvttps_epi32(_mm256_sub_ps(_mm256_mul_ps(values, scale), offset));
+				ints = _mm256_min_epi32(_mm256_set1_epi32(INT24_MAX), _mm256_max_epi32(_mm256_set1_epi32(INT24_MIN), ints));
+				__m256i packed = _mm256_shuffle_epi8(ints, pack);
+
+				uint8_t* block = dst + idx * 3;
+				sse41::store_int24_block(_mm256_castsi256_si128(packed), block);
+				sse41::store_int24_block(_mm256_extracti128_si256(packed, 1), block + 12);
+			}
+			sse41::float_to_int24(src + idx, dst + idx * 3, count - idx);
+		}
+
+		AUDIO_KERNEL_TARGET("avx2")
+		void int32_to_float(const int32_t* src, float* dst, size_t count)
+		{
+			const __m256 scale = _mm256_set1_ps(float(1.0 / INT32_SCALE));
+			size_t idx = 0;
+			for (; idx + 8 <= count; idx += 8) {
+				__m256 values = _mm256_cvtepi32_ps(_mm256_loadu_si256((const __m256i*)(src + idx)));
+				_mm256_storeu_ps(dst + idx, _mm256_mul_ps(values, scale));
+			}
+			sse41::int32_to_float(src + idx, dst + idx, count - idx);
+		}
+
+		AUDIO_KERNEL_TARGET("avx2")
+		void float_to_int32(const float* src, int32_t* dst, size_t count)
+		{
+			const __m256 scale = _mm256_set1_ps(float(INT32_SCALE));
+			const __m256 max_value = _mm256_set1_ps(INT32_MAX_FLOAT);
+			const __m256 one = _mm256_set1_ps(1.0f);
+			const __m256 minus_one = _mm256_set1_ps(-1.0f);
+			size_t idx = 0;
+			for (; idx + 8 <= count; idx += 8) {
+				__m256 values = _mm256_max_ps(minus_one, _mm256_min_ps(one, _mm256_loadu_ps(src + idx)));
+				values = _mm256_min_ps(max_value, _mm256_mul_ps(values, scale));
+				_mm256_storeu_si256((__m256i*)(dst + idx), _mm256_cvttps_epi32(values));
+			}
+			sse41::float_to_int32(src + idx, dst + idx, count - idx);
+		}
+
+		AUDIO_KERNEL_TARGET("avx2")
+		void float_to_double(const float* src, double* dst, size_t count)
+		{
+			size_t idx = 0;
+			for (; idx + 8 <= count; idx += 8) {
+				_mm256_storeu_pd(dst + idx, _mm256_cvtps_pd(_mm_loadu_ps(src + idx)));
+				_mm256_storeu_pd(dst + idx + 4, _mm256_cvtps_pd(_mm_loadu_ps(src + idx + 4)));
+			}
+			sse41::float_to_double(src + idx, dst + idx, count - idx);
+		}
+
+		AUDIO_KERNEL_TARGET("avx2")
+		void double_to_float(const double* src, float* dst, size_t count)
+		{
+			size_t idx = 0;
+			for (; idx + 8 <= count; idx += 8) {
+				_mm_storeu_ps(dst + idx, _mm256_cvtpd_ps(_mm256_loadu_pd(src + idx)));
+				_mm_storeu_ps(dst + idx + 4, _mm256_cvtpd_ps(_mm256_loadu_pd(src + idx + 4)));
+			}
+			sse41::double_to_float(src + idx, dst + idx, count - idx);
+		}
+
+		AUDIO_KERNEL_TARGET("avx2")
+		void mix_add(const float* src, float* dst, float gain, size_t count)
+		{
+			const __m256 gains = _mm256_set1_ps(gain);
+			size_t idx = 0;
+			for (; idx + 8 <= count; idx += 8) {
+				_mm256_storeu_ps(dst + idx, _mm256_add_ps(_mm256_loadu_ps(dst + idx), _mm256_mul_ps(_mm256_loadu_ps(src + idx), gains)));
+			}
+			sse41::mix_add(src + idx, dst + idx, gain, count - idx);
+		}
+	}
+
+#endif
+
+	// ----------------
+	// Dispatch
+	// ----------------
+
+	namespace {
+		InstructionSet detect()
+		{
+#if defined(AUDIO_KERNELS_X86) && defined(_MSC_VER)
+			int info[4];
+			__cpuid(info, 0);
+			int max_leaf = info[0];
+			__cpuid(info, 1);
+			bool sse41 = (info[2] & (1 << 19)) != 0;
+			bool os_avx = (info[2] & (1 << 27)) != 0 && (info[2] & (1 << 28)) != 0 && (_xgetbv(0) & 0x6) == 0x6;
+			bool avx2 = false;
+			if (max_leaf >= 7 && os_avx) {
+				__cpuidex(info, 7, 0);
+				avx2 = (info[1] & (1 << 5)) != 0;
+			}
+			if (avx2)
+				return InstructionSet::AVX2;
+			if (sse41)
+				return InstructionSet::SSE41;
+#elif defined(AUDIO_KERNELS_X86)
+			__builtin_cpu_init();
+			if (__builtin_cpu_supports("avx2"))
+				return InstructionSet::AVX2;
+			if (__builtin_cpu_supports("sse4.1"))
+				return InstructionSet::SSE41;
+#endif
+			return InstructionSet::Scalar;
+		}
+
+		std::atomic<InstructionSet>& active()
+		{
+			static std::atomic<InstructionSet> instruction_set(detected_instruction_set());
+			return instruction_set;
+		}
+	}
+
+	InstructionSet detected_instruction_set()
+	{
+		static const InstructionSet detected = detect();
+		return detected;
+	}
+
+	InstructionSet active_instruction_set()
+	{
+		return active().load(std::memory_order_relaxed);
+	}
+
+	void set_instruction_set(InstructionSet instruction_set)
+	{
+		active().store(std::min(instruction_set, detected_instruction_set()), std::memory_order_relaxed);
+	}
+
+	const char* instruction_set_name(InstructionSet instruction_set)
+	{
+		switch (instruction_set) {
+		case InstructionSet::AVX2:
+			return "AVX2";
+		case InstructionSet::SSE41:
+			return "SSE4.1";
+		default:
+			return "Scalar";
+		}
+	}
+
+	size_t sample_format_bytes(SampleFormat format)
+	{
+		switch (format) {
+		case SampleFormat::Int16:
+			return 2;
+		case SampleFormat::Int24:
+			return 3;
+		default:
+			return 4;
+		}
+	}
+
+// Picks the implementation of a kernel for the active instruction set
+#ifdef AUDIO_KERNELS_X86
+#define DISPATCH_KERNEL(kernel, ...) \
+	switch (active_instruction_set()) { \
+	case InstructionSet::AVX2: avx2::kernel(__VA_ARGS__); break; \
+	case InstructionSet::SSE41: sse41::kernel(__VA_ARGS__); break; \
+	default: scalar::kernel(__VA_ARGS__); break; \
+	}
+#else
+#define DISPATCH_KERNEL(kernel, ...) scalar::kernel(__VA_ARGS__);
+#endif
+
+	void to_float(SampleFormat format, const void* src, float* dst, size_t count)
+	{
+		switch (format) {
+		case SampleFormat::Int16:
+			DISPATCH_KERNEL(int16_to_float, (const int16_t*)src, dst, count)
+			break;
+		case SampleFormat::Int24:
+			DISPATCH_KERNEL(int24_to_float, (const uint8_t*)src, dst, count)
+			break;
+		case SampleFormat::Int32:
+			DISPATCH_KERNEL(int32_to_float, (const int32_t*)src, dst, count)
+			break;
+		default:
+			std::memcpy(dst, src, count * sizeof(float));
+			break;
+		}
+	}
+
+	void from_float(SampleFormat format, const float* src, void* dst, size_t count)
+	{
+		switch (format) {
+		case SampleFormat::Int16:
+			DISPATCH_KERNEL(float_to_int16, src, (int16_t*)dst, count)
+			break;
+		case SampleFormat::Int24:
+			DISPATCH_KERNEL(float_to_int24, src, (uint8_t*)dst, count)
+			break;
+		case SampleFormat::Int32:
+			DISPATCH_KERNEL(float_to_int32, src, (int32_t*)dst, count)
+			break;
+		default:
+			std::memcpy(dst, src, count * sizeof(float));
+			break;
+		}
+	}
+
+	void to_double(const float* src, double* dst, size_t count)
+	{
+		DISPATCH_KERNEL(float_to_double, src, dst, count)
+	}
+
+	void from_double(const double* src, float* dst, size_t count)
+	{
+		DISPATCH_KERNEL(double_to_float, src, dst, count)
+	}
+
+	void mix_add(const float* src, float* dst, float gain, size_t count)
+	{
+		DISPATCH_KERNEL(mix_add, src, dst, gain, count)
+	}
+}
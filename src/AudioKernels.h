@@ -0,0 +1,48 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+// Vectorised sample processing kernels shared by the audio components.
+// Each kernel has scalar, SSE4.1 and AVX2 implementations - the fastest one the CPU supports is picked at runtime.
+namespace AudioKernels {
+
+	enum class InstructionSet {
+		Scalar = 0,
+		SSE41,
+		AVX2
+	};
+
+	// Sample formats devices and payloads can carry. Int24 samples are packed little-endian 3 byte values.
+	enum class SampleFormat {
+		Float32 = 0,
+		Int16,
+		Int24,
+		Int32
+	};
+
+	// Best instruction set supported by this CPU
+	InstructionSet detected_instruction_set();
+
+	// Instruction set the kernels currently dispatch to
+	InstructionSet active_instruction_set();
+
+	// Overrides dispatch, mainly for benchmarking. Requests above the detected instruction set are clamped
+	void set_instruction_set(InstructionSet instruction_set);
+
+	const char* instruction_set_name(InstructionSet instruction_set);
+
+	size_t sample_format_bytes(SampleFormat format);
+
+	// Convert count samples between integer formats and floats in the [-1, 1] range.
+	// Scaling matches RtAudio's converter so switching from its conversion doesn't change levels.
+	void to_float(SampleFormat format, const void* src, float* dst, size_t count);
+	void from_float(SampleFormat format, const float* src, void* dst, size_t count);
+
+	// Widen count floats to doubles and narrow them back, for plugins that process in double precision
+	void to_double(const float* src, double* dst, size_t count);
+	void from_double(const double* src, float* dst, size_t count);
+
+	// dst[i] += src[i] * gain
+	void mix_add(const float* src, float* dst, float gain, size_t count);
+}
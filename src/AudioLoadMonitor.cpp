@@ -0,0 +1,108 @@
+#include "AudioLoadMonitor.h"
+#include <algorithm>
+
+AudioLoadMonitor::AudioLoadMonitor() :
+	m_window_max(0),
+	m_lifetime_max(0),
+	m_previous_counts(AUDIO_LOAD_BUCKETS, 0),
+	m_window_counts(AUDIO_LOAD_BUCKETS, 0)
+{
+	for (auto& bucket : m_buckets)
+		bucket.store(0, std::memory_order_relaxed);
+}
+
+void AudioLoadMonitor::record(clock::duration elapsed, size_t frames, double samplerate)
+{
+	if (!frames || samplerate <= 0.0)
+		return;
+
+	double period_ns = double(frames) * 1e9 / samplerate;
+	double elapsed_ns = double(std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count());
+	uint64_t load = uint64_t(elapsed_ns * AUDIO_LOAD_FULL_SCALE / period_ns);
+
+	m_buckets[bucket_index(load)].fetch_add(1, std::memory_order_relaxed);
+
+	// Only this thread raises the maxima. The reporter may reset the window max between the load and the exchange, so retry
+	uint64_t window_max = m_window_max.load(std::memory_order_relaxed);
+	while (load > window_max && !m_window_max.compare_exchange_weak(window_max, load, std::memory_order_relaxed)) {}
+	if (load > m_lifetime_max.load(std::memory_order_relaxed))
+		m_lifetime_max.store(load, std::memory_order_relaxed);
+}
+
+AudioLoadMonitor::Summary AudioLoadMonitor::summarize_window()
+{
+	Summary summary{ 0, 0.0, 0.0, 0.0 };
+	for (size_t bucket = 0; bucket < AUDIO_LOAD_BUCKETS; ++bucket) {
+		uint64_t count = m_buckets[bucket].load(std::memory_order_relaxed);
+		m_window_counts[bucket] = count - m_previous_counts[bucket];
+		m_previous_counts[bucket] = count;
+		summary.blocks += m_window_counts[bucket];
+	}
+
+	uint64_t max = m_window_max.exchange(0, std::memory_order_relaxed);
+	if (!summary.blocks)
+		return summary;
+
+	summary.p50 = percentile(m_window_counts, summary.blocks, 0.5);
+	summary.p99 = percentile(m_window_counts, summary.blocks, 0.99);
+	summary.max = double(max) * 100.0 / AUDIO_LOAD_FULL_SCALE;
+	return summary;
+}
+
+void AudioLoadMonitor::lifetime_counts(std::vector<uint64_t>& counts) const
+{
+	counts.resize(AUDIO_LOAD_BUCKETS);
+	for (size_t bucket = 0; bucket < AUDIO_LOAD_BUCKETS; ++bucket)
+		counts[bucket] = m_buckets[bucket].load(std::memory_order_relaxed);
+}
+
+uint64_t AudioLoadMonitor::lifetime_max() const
+{
+	return m_lifetime_max.load(std::memory_order_relaxed);
+}
+
+double AudioLoadMonitor::bucket_lower_percent(size_t bucket)
+{
+	return double(bucket_lower(bucket)) * 100.0 / AUDIO_LOAD_FULL_SCALE;
+}
+
+double AudioLoadMonitor::bucket_upper_percent(size_t bucket)
+{
+	return double(bucket_lower(bucket + 1)) * 100.0 / AUDIO_LOAD_FULL_SCALE;
+}
+
+size_t AudioLoadMonitor::bucket_index(uint64_t load)
+{
+	if (load < AUDIO_LOAD_SUB_BUCKETS)
+		return size_t(load);
+
+	// Position of the top bit picks the octave, the next three bits pick the step inside it
+	size_t exponent = 0;
+	for (uint64_t value = load; value > 1; value >>= 1)
+		++exponent;
+	size_t step = size_t(load >> (exponent - 3)) & (AUDIO_LOAD_SUB_BUCKETS - 1);
+	return std::min<size_t>((exponent - 2) * AUDIO_LOAD_SUB_BUCKETS + step, AUDIO_LOAD_BUCKETS - 1);
+}
+
+uint64_t AudioLoadMonitor::bucket_lower(size_t bucket)
+{
+	if (bucket < AUDIO_LOAD_SUB_BUCKETS)
+		return bucket;
+
+	size_t exponent = bucket / AUDIO_LOAD_SUB_BUCKETS + 2;
+	size_t step = bucket % AUDIO_LOAD_SUB_BUCKETS;
+	return uint64_t(AUDIO_LOAD_SUB_BUCKETS + step) << (exponent - 3);
+}
+
+double AudioLoadMonitor::percentile(const std::vector<uint64_t>& window, uint64_t blocks, double fraction) const
+{
+	// Report the middle of the bucket holding the requested rank
+	uint64_t rank = uint64_t(fraction * double(blocks - 1));
+	uint64_t seen = 0;
+	for (size_t bucket = 0; bucket < AUDIO_LOAD_BUCKETS; ++bucket) {
+		seen += window[bucket];
+		if (seen > rank)
+			return (bucket_lower_percent(bucket) + bucket_upper_percent(bucket)) * 0.5;
+	}
+	return bucket_lower_percent(AUDIO_LOAD_BUCKETS - 1);
+}
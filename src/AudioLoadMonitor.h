@@ -0,0 +1,82 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Loads are recorded in hundredths of a percent of the block period (10000 = the whole deadline).
+// Buckets are logarithmic with 8 linear steps per power of two, giving ~12% resolution up to a few hundred times the period.
+#define AUDIO_LOAD_FULL_SCALE 10000
+#define AUDIO_LOAD_SUB_BUCKETS 8
+#define AUDIO_LOAD_BUCKETS 160
+
+// Lock-free histogram of how much of each block deadline a component spends processing.
+// record() must only be called from the thread doing the processing, the summaries only from one reporting thread.
+class AudioLoadMonitor
+{
+public:
+	typedef std::chrono::steady_clock clock;
+
+	// Load percentages over the blocks recorded since the previous summary
+	struct Summary {
+		uint64_t blocks;
+		double p50;
+		double p99;
+		double max;
+	};
+
+	// Times a block from construction to destruction
+	class Scope
+	{
+	public:
+		Scope(AudioLoadMonitor& monitor, size_t frames, double samplerate) :
+			m_monitor(monitor),
+			m_frames(frames),
+			m_samplerate(samplerate),
+			m_start(clock::now())
+		{
+		}
+
+		~Scope()
+		{
+			m_monitor.record(clock::now() - m_start, m_frames, m_samplerate);
+		}
+
+	private:
+		AudioLoadMonitor& m_monitor;
+		size_t m_frames;
+		double m_samplerate;
+		clock::time_point m_start;
+	};
+
+	AudioLoadMonitor();
+
+	// Processing thread. Never blocks or allocates
+	void record(clock::duration elapsed, size_t frames, double samplerate);
+
+	// Reporting thread
+	Summary summarize_window();
+
+	// Lifetime block count per bucket, for dumping the whole histogram
+	void lifetime_counts(std::vector<uint64_t>& counts) const;
+	uint64_t lifetime_max() const;
+
+	// Load range in percent covered by a bucket
+	static double bucket_lower_percent(size_t bucket);
+	static double bucket_upper_percent(size_t bucket);
+
+private:
+	static size_t bucket_index(uint64_t load);
+	static uint64_t bucket_lower(size_t bucket);
+	double percentile(const std::vector<uint64_t>& window, uint64_t blocks, double fraction) const;
+
+	std::atomic<uint64_t> m_buckets[AUDIO_LOAD_BUCKETS];
+	std::atomic<uint64_t> m_window_max;
+	std::atomic<uint64_t> m_lifetime_max;
+
+	// Owned by the reporting thread
+	std::vector<uint64_t> m_previous_counts;
+	std::vector<uint64_t> m_window_counts;
+};
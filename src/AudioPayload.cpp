@@ -0,0 +1,247 @@
+#include "AudioPayload.h"
+#include "AudioCodec.h"
+#include <algorithm>
+#include <cstring>
+
+namespace {
+	void put_u16(uint8_t* dst, uint16_t value)
+	{
+		dst[0] = uint8_t(value);
+		dst[1] = uint8_t(value >> 8);
+	}
+
+	void put_u32(uint8_t* dst, uint32_t value)
+	{
+		for (size_t byte = 0; byte < 4; ++byte)
+			dst[byte] = uint8_t(value >> (byte * 8));
+	}
+
+	void put_u64(uint8_t* dst, uint64_t value)
+	{
+		for (size_t byte = 0; byte < 8; ++byte)
+			dst[byte] = uint8_t(value >> (byte * 8));
+	}
+
+	uint16_t get_u16(const uint8_t* src)
+	{
+		return uint16_t(src[0] | (src[1] << 8));
+	}
+
+	uint32_t get_u32(const uint8_t* src)
+	{
+		uint32_t value = 0;
+		for (size_t byte = 0; byte < 4; ++byte)
+			value |= uint32_t(src[byte]) << (byte * 8);
+		return value;
+	}
+
+	uint64_t get_u64(const uint8_t* src)
+	{
+		uint64_t value = 0;
+		for (size_t byte = 0; byte < 8; ++byte)
+			value |= uint64_t(src[byte]) << (byte * 8);
+		return value;
+	}
+
+	void write_header(const AudioPayload::Header& header, AudioPayload::Codec codec, uint8_t* dst)
+	{
+		dst[0] = AUDIO_PAYLOAD_MAGIC_0;
+		dst[1] = AUDIO_PAYLOAD_MAGIC_1;
+		dst[2] = header.version;
+		dst[3] = uint8_t(header.sample_type);
+		dst[4] = uint8_t(header.layout);
+		dst[5] = uint8_t(codec);
+		put_u16(dst + 6, header.channels);
+		put_u32(dst + 8, header.frames);
+		put_u32(dst + 12, header.samplerate);
+		put_u32(dst + 16, header.sequence);
+		put_u64(dst + 20, header.timestamp);
+	}
+
+	unsigned codec_bits(AudioKernels::SampleFormat sample_type)
+	{
+		return (sample_type == AudioKernels::SampleFormat::Int16) ? 16 : 24;
+	}
+
+	// Packed little-endian integer samples to and from the widened values the codec works on
+	void unpack_samples(AudioKernels::SampleFormat sample_type, const uint8_t* src, int32_t* dst, size_t count)
+	{
+		if (sample_type == AudioKernels::SampleFormat::Int16) {
+			for (size_t idx = 0; idx < count; ++idx)
+				dst[idx] = int16_t(get_u16(src + idx * 2));
+		}
+		else {
+			for (size_t idx = 0; idx < count; ++idx) {
+				const uint8_t* sample = src + idx * 3;
+				dst[idx] = int32_t(uint32_t(sample[0] | (sample[1] << 8) | (sample[2] << 16)) << 8) >> 8;
+			}
+		}
+	}
+
+	void pack_samples(AudioKernels::SampleFormat sample_type, const int32_t* src, uint8_t* dst, size_t count)
+	{
+		if (sample_type == AudioKernels::SampleFormat::Int16) {
+			for (size_t idx = 0; idx < count; ++idx)
+				put_u16(dst + idx * 2, uint16_t(src[idx]));
+		}
+		else {
+			for (size_t idx = 0; idx < count; ++idx) {
+				uint8_t* sample = dst + idx * 3;
+				sample[0] = uint8_t(src[idx]);
+				sample[1] = uint8_t(src[idx] >> 8);
+				sample[2] = uint8_t(src[idx] >> 16);
+			}
+		}
+	}
+
+	// Scratch space for the lossless path, reused between blocks on the same thread
+	thread_local std::vector<uint8_t> packed_scratch;
+	thread_local std::vector<int32_t> integer_scratch;
+}
+
+namespace AudioPayload {
+
+	bool supports_lossless(AudioKernels::SampleFormat sample_type)
+	{
+		return sample_type == AudioKernels::SampleFormat::Int16 || sample_type == AudioKernels::SampleFormat::Int24;
+	}
+
+	size_t encoded_size(const Header& header)
+	{
+		return AUDIO_PAYLOAD_HEADER_SIZE + size_t(header.channels) * header.frames * AudioKernels::sample_format_bytes(header.sample_type);
+	}
+
+	void encode(const Header& header, const float* const* channel_buffers, std::vector<uint8_t>& out)
+	{
+		size_t channel_bytes = size_t(header.frames) * AudioKernels::sample_format_bytes(header.sample_type);
+		if (header.codec == Codec::Lossless && supports_lossless(header.sample_type)) {
+			// Quantise exactly as the uncompressed body would, then compress the integers
+			size_t count = size_t(header.channels) * header.frames;
+			packed_scratch.resize(size_t(header.channels) * channel_bytes);
+			integer_scratch.resize(count);
+			for (size_t channel = 0; channel < header.channels; ++channel)
+				AudioKernels::from_float(header.sample_type, channel_buffers[channel], packed_scratch.data() + channel * channel_bytes, header.frames);
+			unpack_samples(header.sample_type, packed_scratch.data(), integer_scratch.data(), count);
+
+			out.resize(AUDIO_PAYLOAD_HEADER_SIZE);
+			write_header(header, Codec::Lossless, out.data());
+			AudioCodec::encode(integer_scratch.data(), header.channels, header.frames, codec_bits(header.sample_type), out);
+			return;
+		}
+
+		out.resize(encoded_size(header));
+		uint8_t* dst = out.data();
+		write_header(header, Codec::None, dst);
+
+		// One bulk conversion per channel
+		uint8_t* body = dst + AUDIO_PAYLOAD_HEADER_SIZE;
+		for (size_t channel = 0; channel < header.channels; ++channel) {
+			if (header.sample_type == AudioKernels::SampleFormat::Float32)
+				std::memcpy(body + channel * channel_bytes, channel_buffers[channel], channel_bytes);
+			else
+				AudioKernels::from_float(header.sample_type, channel_buffers[channel], body + channel * channel_bytes, header.frames);
+		}
+	}
+
+	bool decode_header(const uint8_t* data, size_t size, Header& header)
+	{
+		if (!data || size < AUDIO_PAYLOAD_HEADER_SIZE)
+			return false;
+		if (data[0] != AUDIO_PAYLOAD_MAGIC_0 || data[1] != AUDIO_PAYLOAD_MAGIC_1 || data[2] != AUDIO_PAYLOAD_VERSION)
+			return false;
+		if (data[3] > uint8_t(AudioKernels::SampleFormat::Int32) || data[4] != uint8_t(Layout::Planar) || data[5] > uint8_t(Codec::Lossless))
+			return false;
+
+		header.version = data[2];
+		header.sample_type = AudioKernels::SampleFormat(data[3]);
+		header.layout = Layout(data[4]);
+		header.codec = Codec(data[5]);
+		header.channels = get_u16(data + 6);
+		header.frames = get_u32(data + 8);
+		header.samplerate = get_u32(data + 12);
+		header.sequence = get_u32(data + 16);
+		header.timestamp = get_u64(data + 20);
+		if (!header.channels || !header.frames)
+			return false;
+		if (header.channels > AUDIO_PAYLOAD_MAX_CHANNELS || header.frames > AUDIO_PAYLOAD_MAX_FRAMES || size_t(header.channels) * header.frames > AUDIO_PAYLOAD_MAX_SAMPLES)
+			return false;
+
+		// Compressed bodies vary in size and are checked while decoding, but can't be shorter than every channel constant
+		if (header.codec == Codec::Lossless)
+			return supports_lossless(header.sample_type) && size - AUDIO_PAYLOAD_HEADER_SIZE >= AudioCodec::min_encoded_size(header.channels, codec_bits(header.sample_type));
+		return size == encoded_size(header);
+	}
+
+	void begin_batch(std::vector<uint8_t>& out)
+	{
+		out.resize(AUDIO_BATCH_HEADER_SIZE);
+		out[0] = AUDIO_PAYLOAD_MAGIC_0;
+		out[1] = AUDIO_BATCH_MAGIC_1;
+		out[2] = AUDIO_PAYLOAD_VERSION;
+		out[3] = 0;
+		put_u16(out.data() + 4, 0);
+	}
+
+	size_t append_to_batch(std::vector<uint8_t>& batch, const uint8_t* payload, size_t size)
+	{
+		size_t offset = batch.size();
+		batch.resize(offset + 4 + size);
+		put_u32(batch.data() + offset, uint32_t(size));
+		std::memcpy(batch.data() + offset + 4, payload, size);
+
+		uint16_t count = uint16_t(get_u16(batch.data() + 4) + 1);
+		put_u16(batch.data() + 4, count);
+		return count;
+	}
+
+	bool split_batch(const uint8_t* data, size_t size, std::vector<Span>& spans)
+	{
+		spans.clear();
+		if (!data || size < AUDIO_BATCH_HEADER_SIZE || data[0] != AUDIO_PAYLOAD_MAGIC_0 || data[1] != AUDIO_BATCH_MAGIC_1) {
+			if (data && size)
+				spans.push_back({ data, size });
+			return true;
+		}
+		if (data[2] != AUDIO_PAYLOAD_VERSION)
+			return false;
+
+		size_t count = get_u16(data + 4);
+		size_t offset = AUDIO_BATCH_HEADER_SIZE;
+		for (size_t idx = 0; idx < count; ++idx) {
+			if (size - offset < 4)
+				break;
+			size_t length = get_u32(data + offset);
+			offset += 4;
+			if (size - offset < length)
+				break;
+			spans.push_back({ data + offset, length });
+			offset += length;
+		}
+		if (spans.size() != count) {
+			spans.clear();
+			return false;
+		}
+		return true;
+	}
+
+	bool decode_body(const Header& header, const uint8_t* data, size_t size, float* dst)
+	{
+		const uint8_t* body = data + AUDIO_PAYLOAD_HEADER_SIZE;
+		size_t count = size_t(header.channels) * header.frames;
+		if (header.codec == Codec::Lossless) {
+			integer_scratch.resize(count);
+			if (!AudioCodec::decode(body, size - AUDIO_PAYLOAD_HEADER_SIZE, header.channels, header.frames, codec_bits(header.sample_type), integer_scratch.data()))
+				return false;
+			packed_scratch.resize(count * AudioKernels::sample_format_bytes(header.sample_type));
+			pack_samples(header.sample_type, integer_scratch.data(), packed_scratch.data(), count);
+			AudioKernels::to_float(header.sample_type, packed_scratch.data(), dst, count);
+			return true;
+		}
+
+		if (header.sample_type == AudioKernels::SampleFormat::Float32)
+			std::memcpy(dst, body, count * sizeof(float));
+		else
+			AudioKernels::to_float(header.sample_type, body, dst, count);
+		return true;
+	}
+}
@@ -0,0 +1,89 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include "AudioKernels.h"
+
+// Packed audio frame carried in ByteList plugs.
+// A fixed little-endian header followed by the sample body:
+//   0  magic 'S' 'A'        2  version          3  sample type (AudioKernels::SampleFormat)
+//   4  layout               5  codec            6  channels (u16)   8  frames (u32)
+//   12 samplerate (u32)     16 sequence (u32)   20 timestamp in ns (u64)
+// The timestamp is the system clock time the first frame was captured, which machines share through NTP or PTP.
+// Adding a receiver's playout delay to it gives the frame's presentation time.
+// Planar bodies hold every frame of channel 0, then channel 1 and so on.
+// Lossless bodies are an AudioCodec bitstream of the same integer samples and only apply to Int16 and Int24.
+#define AUDIO_PAYLOAD_MAGIC_0 'S'
+#define AUDIO_PAYLOAD_MAGIC_1 'A'
+#define AUDIO_PAYLOAD_VERSION 1
+#define AUDIO_PAYLOAD_HEADER_SIZE 28
+
+// Largest block a receiver accepts. Headers beyond these are rejected before anything is allocated for them
+#define AUDIO_PAYLOAD_MAX_CHANNELS 256
+#define AUDIO_PAYLOAD_MAX_FRAMES 16384
+#define AUDIO_PAYLOAD_MAX_SAMPLES (1 << 20)
+
+// Several payloads can share one plug value as a batch:
+//   0  magic 'S' 'B'        2  version          3  reserved         4  payload count (u16)
+// followed by each payload prefixed with its size (u32)
+#define AUDIO_BATCH_MAGIC_1 'B'
+#define AUDIO_BATCH_HEADER_SIZE 6
+#define AUDIO_BATCH_MAX_PAYLOADS 0xffff
+
+namespace AudioPayload {
+
+	enum class Layout : uint8_t {
+		Planar = 0
+	};
+
+	enum class Codec : uint8_t {
+		None = 0,
+		Lossless
+	};
+
+	struct Header {
+		uint8_t version = AUDIO_PAYLOAD_VERSION;
+		AudioKernels::SampleFormat sample_type = AudioKernels::SampleFormat::Float32;
+		Layout layout = Layout::Planar;
+		Codec codec = Codec::None;
+		uint16_t channels = 0;
+		uint32_t frames = 0;
+		uint32_t samplerate = 0;
+		uint32_t sequence = 0;
+		uint64_t timestamp = 0;
+	};
+
+	// Whether a sample type can be carried by the lossless codec
+	bool supports_lossless(AudioKernels::SampleFormat sample_type);
+
+	// Total uncompressed payload size for a header, including the header itself
+	size_t encoded_size(const Header& header);
+
+	// Packs channel_buffers[0 .. header.channels) of header.frames floats each into out, quantising to header.sample_type.
+	// A lossless codec falls back to an uncompressed body for sample types it doesn't support
+	void encode(const Header& header, const float* const* channel_buffers, std::vector<uint8_t>& out);
+
+	// Reads and validates the header. Returns false for unknown versions, bad magic, a block beyond the AUDIO_PAYLOAD_MAX_
+	// limits or a size that doesn't match the body
+	bool decode_header(const uint8_t* data, size_t size, Header& header);
+
+	struct Span {
+		const uint8_t* data;
+		size_t size;
+	};
+
+	// Starts an empty batch in out
+	void begin_batch(std::vector<uint8_t>& out);
+
+	// Adds a payload to a batch started with begin_batch. Returns the number of payloads now in the batch
+	size_t append_to_batch(std::vector<uint8_t>& batch, const uint8_t* payload, size_t size);
+
+	// Splits a plug value into its payloads. A plain payload gives a single span.
+	// Returns false, leaving spans empty, if a batch is truncated or malformed
+	bool split_batch(const uint8_t* data, size_t size, std::vector<Span>& spans);
+
+	// Unpacks the body of a payload whose header has been decoded into planar floats. dst must hold channels * frames samples.
+	// Returns false if a compressed body is corrupt
+	bool decode_body(const Header& header, const uint8_t* data, size_t size, float* dst);
+}
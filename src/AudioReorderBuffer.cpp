@@ -0,0 +1,191 @@
+#include "AudioReorderBuffer.h"
+
+#include <algorithm>
+#include <cstring>
+
+AudioReorderBuffer::AudioReorderBuffer() :
+	m_slots(AUDIO_REORDER_WINDOW * 2),
+	m_started(false),
+	m_expected(0),
+	m_highest(0),
+	m_last_good_view{ nullptr, 0, 0, 0, 0, 0 },
+	m_concealed_run(0),
+	m_concealment_gain(1.0f)
+{
+	m_stats.received = 0;
+	m_stats.lost = 0;
+	m_stats.concealed = 0;
+	m_stats.reordered = 0;
+	m_stats.late = 0;
+	m_stats.duplicates = 0;
+	m_stats.resyncs = 0;
+}
+
+void AudioReorderBuffer::reset()
+{
+	for (auto& entry : m_slots)
+		entry.filled = false;
+	m_started = false;
+	m_concealed_run = 0;
+	m_concealment_gain = 1.0f;
+}
+
+const AudioReorderBuffer::Stats& AudioReorderBuffer::stats() const
+{
+	return m_stats;
+}
+
+AudioReorderBuffer::Slot& AudioReorderBuffer::slot(uint32_t sequence)
+{
+	return m_slots[sequence % m_slots.size()];
+}
+
+void AudioReorderBuffer::push(const AudioBlockView& block)
+{
+	if (!block.frames || !block.samples)
+		return;
+	m_stats.received.fetch_add(1, std::memory_order_relaxed);
+
+	// Local blocks have no meaningful sequence, so order them by arrival
+	uint32_t sequence = block.samplerate ? block.sequence : (m_started ? m_highest + 1 : 0);
+	if (!m_started) {
+		m_started = true;
+		m_expected = m_highest = sequence;
+	}
+
+	// Wrapping difference, so sequence numbers can roll over
+	int32_t ahead = int32_t(sequence - m_expected);
+	if (ahead < -AUDIO_REORDER_RESYNC_BLOCKS || ahead >= AUDIO_REORDER_RESYNC_BLOCKS) {
+		m_stats.resyncs.fetch_add(1, std::memory_order_relaxed);
+		for (auto& entry : m_slots)
+			entry.filled = false;
+		m_expected = m_highest = sequence;
+		ahead = 0;
+	}
+	else if (ahead < 0) {
+		m_stats.late.fetch_add(1, std::memory_order_relaxed);
+		return;
+	}
+	else if (ahead >= int32_t(m_slots.size())) {
+		// A gap too long to hold on to - everything up to the window before this block is gone
+		uint32_t skipped = uint32_t(ahead) - uint32_t(m_slots.size()) + 1;
+		m_stats.lost.fetch_add(skipped, std::memory_order_relaxed);
+		for (uint32_t idx = 0; idx < skipped; ++idx)
+			slot(m_expected + idx).filled = false;
+		m_expected += skipped;
+	}
+
+	Slot& entry = slot(sequence);
+	if (entry.filled && entry.view.sequence == sequence) {
+		m_stats.duplicates.fetch_add(1, std::memory_order_relaxed);
+		return;
+	}
+	if (int32_t(sequence - m_highest) < 0)
+		m_stats.reordered.fetch_add(1, std::memory_order_relaxed);
+	else
+		m_highest = sequence;
+
+	size_t count = block.channels * block.frames;
+	entry.samples.resize(count);
+	std::memcpy(entry.samples.data(), block.samples, count * sizeof(AUDIO_BUFFER_T));
+	entry.view = block;
+	entry.view.samples = entry.samples.data();
+	entry.view.sequence = sequence;
+	entry.filled = true;
+}
+
+AudioBlockView AudioReorderBuffer::pop()
+{
+	AudioBlockView block{ nullptr, 0, 0, 0, 0, 0 };
+	if (!m_started)
+		return block;
+
+	while (true) {
+		Slot& entry = slot(m_expected);
+		if (entry.filled && entry.view.sequence == m_expected) {
+			entry.filled = false;
+			m_expected++;
+
+			// Fade back in from wherever the concealment left off
+			if (m_concealed_run)
+				crossfade_from_tail(entry.samples.data(), entry.view.channels, entry.view.frames);
+			m_concealed_run = 0;
+			m_concealment_gain = 1.0f;
+			remember(entry.view);
+			return entry.view;
+		}
+
+		// Wait for the missing block until the window has moved past it
+		if (int32_t(m_highest - m_expected) < AUDIO_REORDER_WINDOW)
+			return block;
+
+		// Nothing can be concealed before the first good block, so skip straight over those
+		m_stats.lost.fetch_add(1, std::memory_order_relaxed);
+		block = conceal();
+		m_expected++;
+		if (block.frames)
+			return block;
+	}
+}
+
+AudioBlockView AudioReorderBuffer::conceal()
+{
+	AudioBlockView block{ nullptr, 0, 0, 0, 0, 0 };
+	if (!m_last_good_view.frames)
+		return block;
+
+	size_t channels = m_last_good_view.channels;
+	size_t frames = m_last_good_view.frames;
+	float start_gain = m_concealment_gain;
+	float end_gain = (m_concealed_run + 1 < AUDIO_PLC_MAX_BLOCKS) ? start_gain * AUDIO_PLC_DECAY : 0.0f;
+	m_concealed_run++;
+	m_concealment_gain = end_gain;
+
+	// Repeat the last good block under a gain ramp so the level decays smoothly across blocks
+	m_concealment.resize(channels * frames);
+	float step = (end_gain - start_gain) / float(frames);
+	for (size_t channel = 0; channel < channels; ++channel) {
+		const AUDIO_BUFFER_T* src = m_last_good.data() + channel * frames;
+		AUDIO_BUFFER_T* dst = m_concealment.data() + channel * frames;
+		for (size_t frame = 0; frame < frames; ++frame)
+			dst[frame] = src[frame] * (start_gain + step * float(frame));
+	}
+	crossfade_from_tail(m_concealment.data(), channels, frames);
+	for (size_t channel = 0; channel < channels && channel < m_tail.size(); ++channel)
+		m_tail[channel] = m_concealment[channel * frames + frames - 1];
+	m_stats.concealed.fetch_add(1, std::memory_order_relaxed);
+
+	// Stamp it where the missing block would have been so scheduled playout stays in place
+	block = m_last_good_view;
+	block.samples = m_concealment.data();
+	block.sequence = m_expected;
+	if (block.samplerate && block.timestamp)
+		block.timestamp += uint64_t(m_expected - m_last_good_view.sequence) * frames * 1000000000 / block.samplerate;
+	return block;
+}
+
+void AudioReorderBuffer::crossfade_from_tail(AUDIO_BUFFER_T* samples, size_t channels, size_t frames)
+{
+	size_t fade = std::min<size_t>(AUDIO_PLC_CROSSFADE_FRAMES, frames);
+	for (size_t channel = 0; channel < channels && channel < m_tail.size(); ++channel) {
+		AUDIO_BUFFER_T* dst = samples + channel * frames;
+		AUDIO_BUFFER_T hold = m_tail[channel];
+		for (size_t frame = 0; frame < fade; ++frame) {
+			float weight = float(frame + 1) / float(fade + 1);
+			dst[frame] = hold + (dst[frame] - hold) * weight;
+		}
+	}
+}
+
+void AudioReorderBuffer::remember(const AudioBlockView& block)
+{
+	size_t count = block.channels * block.frames;
+	m_last_good.resize(count);
+	std::memcpy(m_last_good.data(), block.samples, count * sizeof(AUDIO_BUFFER_T));
+	m_last_good_view = block;
+	m_last_good_view.samples = m_last_good.data();
+
+	m_tail.resize(block.channels);
+	for (size_t channel = 0; channel < block.channels; ++channel)
+		m_tail[channel] = block.samples[channel * block.frames + block.frames - 1];
+}
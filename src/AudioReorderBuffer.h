@@ -0,0 +1,80 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <vector>
+#include "AudioBlock.h"
+
+// Blocks that arrive up to this many sequence numbers early wait for the ones before them
+#define AUDIO_REORDER_WINDOW 4
+
+// Sequence jumps further than this either way are treated as the sender restarting
+#define AUDIO_REORDER_RESYNC_BLOCKS 64
+
+// Concealment repeats the last good block, scaling it by this much more on every consecutive lost block,
+// and goes silent after AUDIO_PLC_MAX_BLOCKS of them
+#define AUDIO_PLC_DECAY 0.5f
+#define AUDIO_PLC_MAX_BLOCKS 4
+
+// Length of the crossfade from the last played sample into a concealed or resumed block
+#define AUDIO_PLC_CROSSFADE_FRAMES 64
+
+// Puts network blocks back into sequence order and conceals the ones that never arrive.
+// Blocks are pushed as they arrive and popped in order. A missing block is waited for until a block
+// AUDIO_REORDER_WINDOW sequence numbers past it arrives, then replaced with a decaying repeat of the last good block.
+// Seams between concealed and real audio are crossfaded from the last sample played.
+// Push and pop from one thread. The counters can be read from any thread.
+class AudioReorderBuffer
+{
+public:
+	struct Stats {
+		std::atomic<uint64_t> received;
+		std::atomic<uint64_t> lost;			// blocks that never arrived in time
+		std::atomic<uint64_t> concealed;	// blocks synthesised in place of lost ones
+		std::atomic<uint64_t> reordered;	// blocks that arrived out of order but in time to be played
+		std::atomic<uint64_t> late;			// blocks that arrived after their slot was played or concealed
+		std::atomic<uint64_t> duplicates;
+		std::atomic<uint64_t> resyncs;
+	};
+
+	AudioReorderBuffer();
+
+	// Copies a block in. Blocks without a sequence (samplerate 0, not from the network) pass straight through in order
+	void push(const AudioBlockView& block);
+
+	// Next block in sequence order, real or concealed. Returns an empty view when waiting on a missing block.
+	// The view stays valid until the next push or pop
+	AudioBlockView pop();
+
+	// Forgets every buffered block and the expected sequence
+	void reset();
+
+	const Stats& stats() const;
+
+private:
+	struct Slot {
+		std::vector<AUDIO_BUFFER_T> samples;
+		AudioBlockView view;
+		bool filled = false;
+	};
+
+	Slot& slot(uint32_t sequence);
+	AudioBlockView conceal();
+	void crossfade_from_tail(AUDIO_BUFFER_T* samples, size_t channels, size_t frames);
+	void remember(const AudioBlockView& block);
+
+	std::vector<Slot> m_slots;
+	bool m_started;
+	uint32_t m_expected;
+	uint32_t m_highest;
+
+	// Last good block and the last sample played on each channel, for concealment and seams
+	std::vector<AUDIO_BUFFER_T> m_last_good;
+	AudioBlockView m_last_good_view;
+	std::vector<AUDIO_BUFFER_T> m_tail;
+	std::vector<AUDIO_BUFFER_T> m_concealment;
+	size_t m_concealed_run;
+	float m_concealment_gain;
+
+	Stats m_stats;
+};
@@ -0,0 +1,168 @@
+#pragma once
+
+#include <atomic>
+#include <algorithm>
+#include <cstddef>
+#include <cstring>
+#include <memory>
+#include <vector>
+
+#define AUDIO_CACHE_LINE_SIZE 64
+
+// Wait-free single-producer/single-consumer ring buffer holding planar (one region per channel) audio.
+// All channels share the same read/write indices so a block of frames is published for every channel at once.
+// Only one thread may call the write side (write, write_silence) and only one thread may call the read side (read, discard).
+template<typename T>
+class AudioRingBuffer
+{
+public:
+	AudioRingBuffer() :
+		m_channels(0),
+		m_capacity(0),
+		m_mask(0)
+	{
+		m_write_index.value.store(0, std::memory_order_relaxed);
+		m_read_index.value.store(0, std::memory_order_relaxed);
+	}
+
+	AudioRingBuffer(size_t channels, size_t min_frames) : AudioRingBuffer()
+	{
+		resize(channels, min_frames);
+	}
+
+	// Allocates storage for at least min_frames per channel. Not thread safe - only call while no reader/writer is active.
+	void resize(size_t channels, size_t min_frames)
+	{
+		size_t capacity = 1;
+		while (capacity < min_frames)
+			capacity <<= 1;
+
+		m_channels = channels;
+		m_capacity = capacity;
+		m_mask = capacity - 1;
+		m_samples.assign(m_channels * m_capacity, T(0));
+		reset();
+	}
+
+	// Not thread safe - only call while no reader/writer is active.
+	void reset()
+	{
+		m_write_index.value.store(0, std::memory_order_relaxed);
+		m_read_index.value.store(0, std::memory_order_relaxed);
+	}
+
+	size_t channels() const { return m_channels; }
+	size_t capacity() const { return m_capacity; }
+
+	size_t read_available() const
+	{
+		return m_write_index.value.load(std::memory_order_acquire) - m_read_index.value.load(std::memory_order_relaxed);
+	}
+
+	size_t write_available() const
+	{
+		return m_capacity - (m_write_index.value.load(std::memory_order_relaxed) - m_read_index.value.load(std::memory_order_acquire));
+	}
+
+	// Writes up to frames frames. Channel c is read from src + c * src_stride.
+	// Returns the number of frames written, which is less than frames if the buffer is full.
+	size_t write(const T* src, size_t frames, size_t src_stride)
+	{
+		return write(src, frames, src_stride, m_channels);
+	}
+
+	// As above, but only src_channels channels are read from src. Any remaining channels are written as silence.
+	size_t write(const T* src, size_t frames, size_t src_stride, size_t src_channels)
+	{
+		const size_t write_idx = m_write_index.value.load(std::memory_order_relaxed);
+		frames = std::min(frames, m_capacity - (write_idx - m_read_index.value.load(std::memory_order_acquire)));
+		if (!frames)
+			return 0;
+
+		const size_t start = write_idx & m_mask;
+		const size_t first = std::min(frames, m_capacity - start);
+		const size_t copied_channels = std::min(src_channels, m_channels);
+		for (size_t channel = 0; channel < copied_channels; ++channel) {
+			T* dst = channel_data(channel);
+			const T* channel_src = src + channel * src_stride;
+			std::memcpy(dst + start, channel_src, first * sizeof(T));
+			std::memcpy(dst, channel_src + first, (frames - first) * sizeof(T));
+		}
+		for (size_t channel = copied_channels; channel < m_channels; ++channel) {
+			T* dst = channel_data(channel);
+			std::fill_n(dst + start, first, T(0));
+			std::fill_n(dst, frames - first, T(0));
+		}
+
+		m_write_index.value.store(write_idx + frames, std::memory_order_release);
+		return frames;
+	}
+
+	// Writes up to frames frames of silence. Returns the number of frames written.
+	size_t write_silence(size_t frames)
+	{
+		const size_t write_idx = m_write_index.value.load(std::memory_order_relaxed);
+		frames = std::min(frames, m_capacity - (write_idx - m_read_index.value.load(std::memory_order_acquire)));
+		if (!frames)
+			return 0;
+
+		const size_t start = write_idx & m_mask;
+		const size_t first = std::min(frames, m_capacity - start);
+		for (size_t channel = 0; channel < m_channels; ++channel) {
+			T* dst = channel_data(channel);
+			std::fill_n(dst + start, first, T(0));
+			std::fill_n(dst, frames - first, T(0));
+		}
+
+		m_write_index.value.store(write_idx + frames, std::memory_order_release);
+		return frames;
+	}
+
+	// Reads up to frames frames. Channel c is written to dst + c * dst_stride.
+	// Returns the number of frames read, which is less than frames if the buffer doesn't hold enough data.
+	size_t read(T* dst, size_t frames, size_t dst_stride)
+	{
+		const size_t read_idx = m_read_index.value.load(std::memory_order_relaxed);
+		frames = std::min(frames, m_write_index.value.load(std::memory_order_acquire) - read_idx);
+		if (!frames)
+			return 0;
+
+		const size_t start = read_idx & m_mask;
+		const size_t first = std::min(frames, m_capacity - start);
+		for (size_t channel = 0; channel < m_channels; ++channel) {
+			const T* src = channel_data(channel);
+			T* channel_dst = dst + channel * dst_stride;
+			std::memcpy(channel_dst, src + start, first * sizeof(T));
+			std::memcpy(channel_dst + first, src, (frames - first) * sizeof(T));
+		}
+
+		m_read_index.value.store(read_idx + frames, std::memory_order_release);
+		return frames;
+	}
+
+	// Drops up to frames frames from the read side. Returns the number of frames dropped.
+	size_t discard(size_t frames)
+	{
+		const size_t read_idx = m_read_index.value.load(std::memory_order_relaxed);
+		frames = std::min(frames, m_write_index.value.load(std::memory_order_acquire) - read_idx);
+		m_read_index.value.store(read_idx + frames, std::memory_order_release);
+		return frames;
+	}
+
+private:
+	T* channel_data(size_t channel) { return m_samples.data() + channel * m_capacity; }
+	const T* channel_data(size_t channel) const { return m_samples.data() + channel * m_capacity; }
+
+	// Indices live on their own cache lines so the producer and consumer don't false-share
+	struct alignas(AUDIO_CACHE_LINE_SIZE) PaddedIndex {
+		std::atomic<size_t> value;
+	};
+
+	PaddedIndex m_write_index;
+	PaddedIndex m_read_index;
+
+	size_t m_channels;
+	size_t m_capacity;
+	size_t m_mask;
+	std::vector<T> m_samples;
+};
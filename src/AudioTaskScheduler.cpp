@@ -0,0 +1,249 @@
+#include "AudioTaskScheduler.h"
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+void AudioTaskScheduler::Graph::build(const std::vector<std::vector<uint32_t>>& predecessors)
+{
+	successors.assign(predecessors.size(), std::vector<uint32_t>());
+	predecessor_counts.assign(predecessors.size(), 0);
+	roots.clear();
+	for (uint32_t task = 0; task < predecessors.size(); ++task) {
+		predecessor_counts[task] = static_cast<uint32_t>(predecessors[task].size());
+		for (auto predecessor : predecessors[task])
+			successors[predecessor].push_back(task);
+		if (predecessors[task].empty())
+			roots.push_back(task);
+	}
+}
+
+size_t AudioTaskScheduler::Graph::size() const
+{
+	return predecessor_counts.size();
+}
+
+
+// ---
+
+AudioTaskScheduler::Deque::Deque(size_t capacity) :
+	m_mask(0),
+	m_top(0),
+	m_bottom(0)
+{
+	// Every task is queued at most once per block, so the ring never has to grow
+	size_t size = 1;
+	while (size < capacity)
+		size <<= 1;
+	m_tasks = std::make_unique<std::atomic<uint32_t>[]>(size);
+	m_mask = size - 1;
+}
+
+void AudioTaskScheduler::Deque::push(uint32_t task)
+{
+	int64_t bottom = m_bottom.load(std::memory_order_relaxed);
+	m_tasks[bottom & m_mask].store(task, std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_release);
+	m_bottom.store(bottom + 1, std::memory_order_relaxed);
+}
+
+bool AudioTaskScheduler::Deque::pop(uint32_t& task)
+{
+	int64_t bottom = m_bottom.load(std::memory_order_relaxed) - 1;
+	m_bottom.store(bottom, std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+	int64_t top = m_top.load(std::memory_order_relaxed);
+
+	if (top > bottom) {
+		m_bottom.store(bottom + 1, std::memory_order_relaxed);
+		return false;
+	}
+
+	task = m_tasks[bottom & m_mask].load(std::memory_order_relaxed);
+	if (top < bottom)
+		return true;
+
+	// Last task left, so a thief may be after it too
+	bool won = m_top.compare_exchange_strong(top, top + 1, std::memory_order_seq_cst, std::memory_order_relaxed);
+	m_bottom.store(bottom + 1, std::memory_order_relaxed);
+	return won;
+}
+
+bool AudioTaskScheduler::Deque::steal(uint32_t& task)
+{
+	int64_t top = m_top.load(std::memory_order_acquire);
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+	int64_t bottom = m_bottom.load(std::memory_order_acquire);
+	if (top >= bottom)
+		return false;
+
+	task = m_tasks[top & m_mask].load(std::memory_order_relaxed);
+	return m_top.compare_exchange_strong(top, top + 1, std::memory_order_seq_cst, std::memory_order_relaxed);
+}
+
+
+// ---
+
+#if defined(_WIN32)
+AudioTaskScheduler::Semaphore::Semaphore() : m_handle(CreateSemaphore(nullptr, 0, LONG_MAX, nullptr)) {}
+AudioTaskScheduler::Semaphore::~Semaphore() { CloseHandle(m_handle); }
+void AudioTaskScheduler::Semaphore::post() { ReleaseSemaphore(m_handle, 1, nullptr); }
+void AudioTaskScheduler::Semaphore::wait() { WaitForSingleObject(m_handle, INFINITE); }
+#elif defined(__APPLE__)
+AudioTaskScheduler::Semaphore::Semaphore() : m_handle(dispatch_semaphore_create(0)) {}
+AudioTaskScheduler::Semaphore::~Semaphore() { dispatch_release(m_handle); }
+void AudioTaskScheduler::Semaphore::post() { dispatch_semaphore_signal(m_handle); }
+void AudioTaskScheduler::Semaphore::wait() { dispatch_semaphore_wait(m_handle, DISPATCH_TIME_FOREVER); }
+#else
+AudioTaskScheduler::Semaphore::Semaphore() { sem_init(&m_handle, 0, 0); }
+AudioTaskScheduler::Semaphore::~Semaphore() { sem_destroy(&m_handle); }
+void AudioTaskScheduler::Semaphore::post() { sem_post(&m_handle); }
+void AudioTaskScheduler::Semaphore::wait() { while (sem_wait(&m_handle) == -1 && errno == EINTR) {} }
+#endif
+
+
+// ---
+
+AudioTaskScheduler::AudioTaskScheduler(size_t workers, size_t max_tasks, int caller_priority) :
+	m_graph(nullptr),
+	m_function(nullptr),
+	m_context(nullptr),
+	m_pending(std::make_unique<std::atomic<uint32_t>[]>(max_tasks)),
+	m_remaining(0),
+	m_block(0),
+	m_sleeping(0),
+	m_stop(false)
+{
+	// Deque 0 belongs to whichever thread calls run
+	for (size_t idx = 0; idx <= workers; ++idx)
+		m_deques.push_back(std::make_unique<Deque>(max_tasks));
+	for (size_t idx = 1; idx <= workers; ++idx) {
+		m_threads.emplace_back(&AudioTaskScheduler::worker_loop, this, idx);
+
+		// A worker above the caller could hold up the very callback it is meant to help. Below a caller that isn't
+		// real-time, workers stay at normal priority
+		if (caller_priority > 0)
+			raise_thread_priority(m_threads.back().native_handle(), caller_priority - 1);
+	}
+}
+
+AudioTaskScheduler::~AudioTaskScheduler()
+{
+	// Each worker waits at most once more before it sees m_stop
+	m_stop = true;
+	for (size_t idx = 0; idx < m_threads.size(); ++idx)
+		m_wakeup.post();
+	for (auto& thread : m_threads)
+		thread.join();
+}
+
+void AudioTaskScheduler::run(const Graph& graph, TaskFunction function, void* context)
+{
+	if (!graph.size())
+		return;
+
+	m_graph = &graph;
+	m_function = function;
+	m_context = context;
+	for (size_t task = 0; task < graph.size(); ++task)
+		m_pending[task].store(graph.predecessor_counts[task], std::memory_order_relaxed);
+	m_remaining.store(static_cast<uint32_t>(graph.size()), std::memory_order_release);
+
+	// Roots go on our own deque. Workers steal them from there and spread out along the branches
+	for (auto root = graph.roots.rbegin(); root != graph.roots.rend(); ++root)
+		m_deques[0]->push(*root);
+
+	// Sleepers registered before this point get a post each. Any later one sees the new block and doesn't sleep
+	m_block.fetch_add(1);
+	for (size_t sleepers = m_sleeping.exchange(0); sleepers; --sleepers)
+		m_wakeup.post();
+
+	work(0);
+}
+
+size_t AudioTaskScheduler::workers() const
+{
+	return m_threads.size();
+}
+
+bool AudioTaskScheduler::raise_thread_priority(std::thread::native_handle_type thread, int priority)
+{
+#ifdef _WIN32
+	return SetThreadPriority(thread, THREAD_PRIORITY_ABOVE_NORMAL) != 0;
+#else
+	sched_param param{};
+	param.sched_priority = std::min(std::max(priority, sched_get_priority_min(SCHED_FIFO)), sched_get_priority_max(SCHED_FIFO));
+	return pthread_setschedparam(thread, SCHED_FIFO, &param) == 0;
+#endif
+}
+
+void AudioTaskScheduler::worker_loop(size_t index)
+{
+	uint64_t seen = m_block.load();
+	while (!m_stop.load()) {
+		// Blocks usually follow each other closely, so spin a little before paying for a wakeup
+		auto spin_until = std::chrono::steady_clock::now() + std::chrono::microseconds(AUDIO_SCHEDULER_SPIN_MICROSECONDS);
+		while (m_block.load() == seen && !m_stop.load() && std::chrono::steady_clock::now() < spin_until)
+			std::this_thread::yield();
+
+		if (m_block.load() == seen) {
+			sleep(seen);
+			continue;
+		}
+
+		seen = m_block.load();
+		work(index);
+	}
+}
+
+void AudioTaskScheduler::sleep(uint64_t seen)
+{
+	m_sleeping.fetch_add(1);
+	if (m_block.load() != seen || m_stop.load()) {
+		// Take the registration back, unless run() already counted it and has a post on the way
+		size_t sleeping = m_sleeping.load();
+		while (sleeping && !m_sleeping.compare_exchange_weak(sleeping, sleeping - 1)) {}
+		if (sleeping)
+			return;
+	}
+	m_wakeup.wait();
+}
+
+void AudioTaskScheduler::work(size_t index)
+{
+	uint32_t task = 0;
+	while (m_remaining.load(std::memory_order_acquire)) {
+		if (find_task(index, task))
+			execute(index, task);
+		else
+			std::this_thread::yield();
+	}
+}
+
+bool AudioTaskScheduler::find_task(size_t index, uint32_t& task)
+{
+	if (m_deques[index]->pop(task))
+		return true;
+	for (size_t offset = 1; offset < m_deques.size(); ++offset) {
+		if (m_deques[(index + offset) % m_deques.size()]->steal(task))
+			return true;
+	}
+	return false;
+}
+
+void AudioTaskScheduler::execute(size_t index, uint32_t task)
+{
+	m_function(m_context, task);
+
+	// Whoever finishes a merge's last input runs the merge, so nothing ever waits on a barrier
+	for (auto successor : m_graph->successors[task]) {
+		if (m_pending[successor].fetch_sub(1, std::memory_order_acq_rel) == 1)
+			m_deques[index]->push(successor);
+	}
+	m_remaining.fetch_sub(1, std::memory_order_acq_rel);
+}
@@ -0,0 +1,115 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <thread>
+#include <vector>
+#if defined(__APPLE__)
+#include <dispatch/dispatch.h>
+#elif !defined(_WIN32)
+#include <semaphore.h>
+#endif
+
+// How long an idle worker keeps looking for the next block before going to sleep
+#define AUDIO_SCHEDULER_SPIN_MICROSECONDS 200
+
+// Real-time priority for helper threads when the audio thread's own isn't known. Audio callbacks usually run above it
+#define AUDIO_HELPER_THREAD_PRIORITY 10
+
+// Runs a dependency graph of tasks once per block on the calling thread and a fixed pool of workers.
+// Each thread keeps its ready tasks on its own work-stealing deque and steals from the others once it runs dry.
+// A task becomes ready as soon as the last task feeding it finishes, so threads only ever wait where branches merge.
+// run() is meant to be called from one thread at a time, typically an audio callback. It never allocates or locks,
+// and always finishes the block on the calling thread, even if no worker wakes up in time. Waking workers that went
+// to sleep costs one semaphore post each, which is a system call but never waits.
+class AudioTaskScheduler
+{
+public:
+	// Task i runs after every task listed in predecessors[i]. Built once and reused for every block
+	struct Graph {
+		std::vector<std::vector<uint32_t>> successors;
+		std::vector<uint32_t> predecessor_counts;
+		std::vector<uint32_t> roots;
+
+		void build(const std::vector<std::vector<uint32_t>>& predecessors);
+		size_t size() const;
+	};
+
+	typedef void (*TaskFunction)(void* context, uint32_t task);
+
+	// workers extra threads on top of the caller. 0 runs every task on the calling thread.
+	// caller_priority is the real-time priority of the thread calling run(), or 0 if it isn't real-time.
+	// Workers run one level below it so they can never preempt it
+	AudioTaskScheduler(size_t workers, size_t max_tasks, int caller_priority);
+	~AudioTaskScheduler();
+
+	// Runs every task in graph exactly once in dependency order. Returns once the last one has finished
+	void run(const Graph& graph, TaskFunction function, void* context);
+
+	size_t workers() const;
+
+	// Gives a thread real-time priority (SCHED_FIFO levels, clamped to the valid range). On Windows any priority maps
+	// to THREAD_PRIORITY_ABOVE_NORMAL, below the THREAD_PRIORITY_HIGHEST real-time audio callbacks get
+	static bool raise_thread_priority(std::thread::native_handle_type thread, int priority = AUDIO_HELPER_THREAD_PRIORITY);
+
+private:
+	// Chase-Lev deque of task indices. The owning thread pushes and pops at the bottom, everyone else steals from the top
+	class Deque
+	{
+	public:
+		explicit Deque(size_t capacity);
+		void push(uint32_t task);
+		bool pop(uint32_t& task);
+		bool steal(uint32_t& task);
+
+	private:
+		std::unique_ptr<std::atomic<uint32_t>[]> m_tasks;
+		size_t m_mask;
+		alignas(64) std::atomic<int64_t> m_top;
+		alignas(64) std::atomic<int64_t> m_bottom;
+	};
+
+	// Counting semaphore. post() never blocks, so run() can wake workers from an audio callback
+	class Semaphore
+	{
+	public:
+		Semaphore();
+		~Semaphore();
+		void post();
+		void wait();
+
+	private:
+#if defined(_WIN32)
+		void* m_handle;
+#elif defined(__APPLE__)
+		dispatch_semaphore_t m_handle;
+#else
+		sem_t m_handle;
+#endif
+	};
+
+	void worker_loop(size_t index);
+	void sleep(uint64_t seen);
+	void work(size_t index);
+	bool find_task(size_t index, uint32_t& task);
+	void execute(size_t index, uint32_t task);
+
+	std::vector<std::unique_ptr<Deque>> m_deques;
+	std::vector<std::thread> m_threads;
+
+	// The block being run. Only valid while m_remaining is non-zero
+	const Graph* m_graph;
+	TaskFunction m_function;
+	void* m_context;
+	std::unique_ptr<std::atomic<uint32_t>[]> m_pending;
+	alignas(64) std::atomic<uint32_t> m_remaining;
+
+	// Workers wake up for each new block. Those that slept through one simply leave it to the others.
+	// m_sleeping counts workers owed a post on m_wakeup, which run() takes over and posts
+	alignas(64) std::atomic<uint64_t> m_block;
+	std::atomic<size_t> m_sleeping;
+	std::atomic<bool> m_stop;
+	Semaphore m_wakeup;
+};
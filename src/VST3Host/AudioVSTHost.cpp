@@ -11,30 +11,92 @@
 
 #include "WindowController.h"
 #include "VSTPlugProvider.h"
+#include "../AudioKernels.h"
+#include "../AudioTaskScheduler.h"
 
 using namespace showtime;
 using namespace Steinberg;
 using namespace Steinberg::Vst;
 using namespace Steinberg::Vst::EditorHost;
 
-
 AudioVSTHost::AudioVSTHost(const char* name, const char* vst_path, Vst::HostApplication* plugin_context) :
 	AudioComponentBase(AUDIOVSTHOST_COMPONENT_TYPE, name),
 	m_module(nullptr),
 	m_plugProvider(nullptr),
+	m_audioEffect(nullptr),
+	m_vstPlug(nullptr),
 	m_processContext(std::make_shared<ProcessContext>()),
-	m_elapsed_samples(0)
+	m_elapsed_samples(0),
+	m_latency_frames(0),
+	m_latency_published(false),
+	m_latency_out(std::make_shared<ZstOutputPlug>("OUT_latency", ZstValueType::IntList)),
+	m_process_stop(false),
+	m_process_paused(false),
+	m_process_busy(false),
+	m_dropped_blocks(0),
+	m_reported_dropped_blocks(0),
+	m_process_failures(0),
+	m_reported_process_failures(0),
+	m_processing_state(ProcessingState::Unprepared),
+	m_bypass_in(std::make_shared<ZstInputPlug>("IN_bypass", ZstValueType::FloatList, 1)),
+	m_bypassed(false)
 {
 	m_processSetup.processMode = kRealtime;
 	m_processSetup.symbolicSampleSize = kSample32;
-	m_processSetup.maxSamplesPerBlock = 2048;
+	m_processSetup.maxSamplesPerBlock = AUDIOVSTHOST_MAX_BLOCK_FRAMES;
 	m_processSetup.sampleRate = 44100;
 
-	m_processData.numSamples = 512;
+	// Buffers are prepared for the largest block. Each process call then says how much of them it uses
+	m_processData.numSamples = m_processSetup.maxSamplesPerBlock;
 	m_processData.symbolicSampleSize = kSample32;
 	m_processData.processContext = m_processContext.get();
 
+	enable_mixing(AUDIOVSTHOST_MIX_SOURCES);
 	load_VST(vst_path, plugin_context);
+	start_processing_thread();
+}
+
+AudioVSTHost::~AudioVSTHost()
+{
+	// A sink's callback or the processing thread may still be running the plugin until both are stopped
+	leave_graph();
+	stop_processing_thread();
+	suspend_processing();
+	deactivate();
+}
+
+void AudioVSTHost::on_registered()
+{
+	AudioComponentBase::on_registered();
+	add_child(m_latency_out.get());
+	add_child(m_bypass_in.get());
+}
+
+void AudioVSTHost::on_tick()
+{
+	AudioComponentBase::on_tick();
+	publish_processed_blocks();
+
+	uint64_t dropped = m_dropped_blocks.load(std::memory_order_relaxed);
+	if (dropped != m_reported_dropped_blocks) {
+		Log::entity(Log::Level::warn, "VST processing fell behind, {} blocks dropped", dropped - m_reported_dropped_blocks);
+		m_reported_dropped_blocks = dropped;
+	}
+
+	uint64_t failures = m_process_failures.load(std::memory_order_relaxed);
+	if (failures != m_reported_process_failures) {
+		Log::entity(Log::Level::error, "VST processing failed {} times ({} bit samples)", failures - m_reported_process_failures, (m_processSetup.symbolicSampleSize == kSample64) ? 64 : 32);
+		m_reported_process_failures = failures;
+	}
+
+	if (!m_latency_published && m_audioEffect) {
+		// Latency in frames and in milliseconds
+		m_latency_out->raw_value()->clear();
+		m_latency_out->append_int(int(m_latency_frames));
+		m_latency_out->append_int(int(uint64_t(m_latency_frames) * 1000 / uint64_t(m_processSetup.sampleRate)));
+		m_latency_out->fire();
+		m_latency_published = true;
+	}
 }
 
 void AudioVSTHost::load_VST(const std::string& path, Vst::HostApplication* plugin_context) {
@@ -118,9 +180,10 @@ void AudioVSTHost::load_VST(const std::string& path, Vst::HostApplication* plugi
 			 if (!res)
 				 Log::entity(Log::Level::debug, "Failed to set bus properties");
 
-			prepareProcessing();
-			if (m_vstPlug->setActive(true) != kResultTrue)
-				Log::entity(Log::Level::error, "Couldn't activate VST component");
+			select_sample_size();
+			if (prepareProcessing())
+				activate();
+			update_latency();
 		}
 	}
 }
@@ -133,11 +196,103 @@ bool AudioVSTHost::prepareProcessing()
 	tresult setupResult = m_audioEffect->setupProcessing(m_processSetup);
 	if (setupResult == kResultOk)
 	{
-		m_processData.prepare(*m_vstPlug, m_processData.numSamples, m_processSetup.symbolicSampleSize);
+		m_processData.prepare(*m_vstPlug, m_processSetup.maxSamplesPerBlock, m_processSetup.symbolicSampleSize);
+		size_t input_channels = m_processData.inputs ? size_t(m_processData.inputs->numChannels) : 0;
+		size_t output_channels = m_processData.outputs ? size_t(m_processData.outputs->numChannels) : 0;
+		if (m_processData.outputs)
+			prepare_outgoing_audio(output_channels, AUDIOVSTHOST_QUEUE_FRAMES, uint32_t(m_processSetup.sampleRate));
+		if (m_processData.inputs)
+			prepare_mixing(input_channels, AUDIOVSTHOST_DEFAULT_BLOCK_FRAMES);
+
+		// Everything the processing thread touches is allocated up front
+		m_input_queue.resize(input_channels, AUDIOVSTHOST_QUEUE_FRAMES);
+		m_output_queue.resize(output_channels, AUDIOVSTHOST_QUEUE_FRAMES);
+		m_process_input.assign(input_channels * AUDIOVSTHOST_QUEUE_FRAMES, 0.0f);
+		m_rebuffered_output.assign(output_channels * AUDIOVSTHOST_QUEUE_FRAMES, 0.0f);
+		m_publish_output.assign(output_channels * AUDIOVSTHOST_QUEUE_FRAMES, 0.0f);
+		m_processing_state = ProcessingState::Inactive;
+		return true;
 	}
+	Log::entity(Log::Level::error, "VST processing setup failed");
 	return false;
 }
 
+bool AudioVSTHost::activate()
+{
+	if (m_processing_state != ProcessingState::Inactive)
+		return m_processing_state != ProcessingState::Unprepared;
+	if (m_vstPlug->setActive(true) != kResultTrue) {
+		Log::entity(Log::Level::error, "Couldn't activate VST component");
+		return false;
+	}
+	m_processing_state = ProcessingState::Active;
+	return true;
+}
+
+void AudioVSTHost::deactivate()
+{
+	if (m_processing_state != ProcessingState::Active)
+		return;
+	m_vstPlug->setActive(false);
+	m_processing_state = ProcessingState::Inactive;
+}
+
+bool AudioVSTHost::begin_processing()
+{
+	if (m_processing_state == ProcessingState::Processing)
+		return true;
+	if (m_processing_state != ProcessingState::Active)
+		return false;
+
+	// Some plugins return kNotImplemented here and process regardless
+	tresult result = m_audioEffect->setProcessing(true);
+	if (result != kResultOk && result != kNotImplemented) {
+		m_process_failures.fetch_add(1, std::memory_order_relaxed);
+		return false;
+	}
+	m_processing_state = ProcessingState::Processing;
+	return true;
+}
+
+void AudioVSTHost::suspend_processing()
+{
+	if (m_processing_state != ProcessingState::Processing)
+		return;
+	m_audioEffect->setProcessing(false);
+	m_processing_state = ProcessingState::Active;
+}
+
+bool AudioVSTHost::reconfigure(uint32_t samplerate)
+{
+	Log::entity(Log::Level::debug, "Setting VST up again for {} Hz", samplerate);
+
+	// Nothing may run the plugin while it is set up. Blocks queued at the old samplerate are dropped
+	pause_processing(true);
+	suspend_processing();
+	deactivate();
+	m_processSetup.sampleRate = samplerate;
+	bool active = false;
+	if (m_audioEffect->setupProcessing(m_processSetup) == kResultOk) {
+		if (m_processData.outputs)
+			prepare_outgoing_audio(m_processData.outputs->numChannels, AUDIOVSTHOST_QUEUE_FRAMES, samplerate);
+		active = activate();
+	}
+	else {
+		Log::entity(Log::Level::error, "VST processing setup failed at {} Hz", samplerate);
+	}
+	update_latency();
+	pause_processing(graph_owner() != nullptr);
+	return active;
+}
+
+void AudioVSTHost::set_bypass(ZstInputPlug* plug)
+{
+	bool bypassed = plug->size() && plug->float_at(0) != 0.0f;
+	if (bypassed != m_bypassed.load(std::memory_order_relaxed))
+		Log::entity(Log::Level::debug, "VST {}", bypassed ? "bypassed" : "no longer bypassed");
+	m_bypassed.store(bypassed, std::memory_order_relaxed);
+}
+
 
 void AudioVSTHost::createViewAndShow(Vst::IEditController* controller)
 {
@@ -169,71 +324,335 @@ void AudioVSTHost::createViewAndShow(Vst::IEditController* controller)
 
 void AudioVSTHost::compute(showtime::ZstInputPlug* plug)
 {
-	bool processed_VST = false;
-	if (plug == incoming_audio()) {
-		if (!m_audioEffect)
+	if (is_audio_input(plug)) {
+		// Inside a graph the plugin is fed by the sink's callback, so the message copy of the same audio is ignored
+		if (!m_audioEffect || graph_owner())
 			return;
 
-		// Read floats from plug into VST buffer
+		if (mixing_enabled()) {
+			queue_mix_source(plug);
+			for (auto block = next_mixed_block(); block.frames; block = next_mixed_block())
+				queue_block(block);
+		}
+		else {
+			unpack_plug_audio(plug);
+			for (auto block = next_unpacked_block(); block.frames; block = next_unpacked_block())
+				queue_block(block);
+		}
+
+		// Whatever the processing thread has finished since goes out now rather than waiting for the next tick
+		publish_processed_blocks();
+	}
+	else if (plug == m_bypass_in.get()) {
+		set_bypass(plug);
+	}
+	else {
+		AudioComponentBase::compute(plug);
+	}
+}
+
+void AudioVSTHost::start_processing_thread()
+{
+	if (!m_audioEffect)
+		return;
+	m_process_thread = boost::thread(&AudioVSTHost::process_loop, this);
+
+	// Plugin DSP shouldn't have to wait behind networking, logging or the UI. Needs elevated rights on some systems
+	if (!AudioTaskScheduler::raise_thread_priority(m_process_thread.native_handle()))
+		Log::entity(Log::Level::debug, "Couldn't raise the VST processing thread's priority");
+}
 
-		if (m_processData.inputs) {
-			for (size_t channel = 0; channel < 2; ++channel) {
-				size_t channel_start_offset = floor(plug->size() * 0.5) * channel;
-				size_t channel_sample = channel_start_offset + floor(plug->size() * 0.5);
-				std::copy(plug->raw_value()->float_buffer() + channel_start_offset, plug->raw_value()->float_buffer() + channel_sample, m_processData.inputs->channelBuffers32[channel]);
+void AudioVSTHost::stop_processing_thread()
+{
+	{
+		std::lock_guard<std::mutex> lock(m_process_mtx);
+		m_process_stop = true;
+	}
+	m_process_wakeup.notify_all();
+	if (m_process_thread.joinable())
+		m_process_thread.join();
+}
+
+void AudioVSTHost::process_loop()
+{
+	std::unique_lock<std::mutex> lock(m_process_mtx);
+	while (true) {
+		bool woken = m_process_wakeup.wait_for(lock, AUDIOVSTHOST_IDLE_TIMEOUT, [this]() { return m_process_stop || (!m_process_paused && m_input_blocks.read_available()); });
+		if (m_process_stop)
+			return;
+
+		// Idle with nobody else running the plugin, so processing can be switched off until the next block
+		if (!woken && (m_process_paused || m_processing_state != ProcessingState::Processing))
+			continue;
+
+		// The lock is only held between batches, so queueing never waits on the plugin
+		m_process_busy = true;
+		lock.unlock();
+		if (woken)
+			process_queued_blocks();
+		else
+			suspend_processing();
+		lock.lock();
+		m_process_busy = false;
+		m_process_idle.notify_all();
+	}
+}
+
+void AudioVSTHost::process_queued_blocks()
+{
+	while (m_input_blocks.read_available()) {
+		QueuedBlock queued = m_input_blocks.front();
+		m_input_queue.read(m_process_input.data(), queued.frames, queued.frames);
+		m_input_blocks.pop();
+
+		AudioBlockView block{ m_process_input.data(), m_input_queue.channels(), queued.frames, uint32_t(m_processSetup.sampleRate), 0, queued.timestamp };
+		process_block(block);
+	}
+}
+
+void AudioVSTHost::pause_processing(bool paused)
+{
+	std::unique_lock<std::mutex> lock(m_process_mtx);
+	m_process_paused = paused;
+	if (paused) {
+		// Once the thread is idle and paused nothing else reads the input queue, so stale blocks can be dropped from here
+		m_process_idle.wait(lock, [this]() { return !m_process_busy; });
+		while (m_input_blocks.pop()) {}
+		m_input_queue.discard(m_input_queue.read_available());
+	}
+	else {
+		m_process_wakeup.notify_all();
+	}
+}
+
+void AudioVSTHost::set_graph_owner(AudioComponentBase* sink, bool exclusive)
+{
+	// Only one thread may run the plugin, so the processing thread stands down while a sink's callback drives it
+	AudioComponentBase::set_graph_owner(sink, exclusive);
+	pause_processing(sink != nullptr);
+}
+
+void AudioVSTHost::queue_block(const AudioBlockView& block)
+{
+	if (!block.frames)
+		return;
+
+	// The plugin runs at the samplerate of whatever it is fed
+	if (block.samplerate && block.samplerate != uint32_t(m_processSetup.sampleRate))
+		reconfigure(block.samplerate);
+
+	// Samples go in before the block that describes them, so the processing thread never sees one without the other
+	if (block.frames > m_input_queue.write_available() || !m_input_blocks.write_available()) {
+		m_dropped_blocks.fetch_add(1, std::memory_order_relaxed);
+		return;
+	}
+	m_input_queue.write(block.samples, block.frames, block.frames, block.channels);
+	m_input_blocks.push(QueuedBlock{ uint32_t(block.frames), block.timestamp });
+
+	{
+		std::lock_guard<std::mutex> lock(m_process_mtx);
+	}
+	m_process_wakeup.notify_one();
+}
+
+void AudioVSTHost::publish_processed_blocks()
+{
+	while (m_output_blocks.read_available()) {
+		QueuedBlock processed = m_output_blocks.front();
+		m_output_queue.read(m_publish_output.data(), processed.frames, processed.frames);
+		m_output_blocks.pop();
+		publish_audio(m_publish_output.data(), m_output_queue.channels(), processed.frames, processed.timestamp);
+	}
+}
+
+void AudioVSTHost::process_block(const AudioBlockView& block)
+{
+	if (!block.frames || !m_processData.outputs)
+		return;
+
+	AudioLoadMonitor::Scope load_scope(m_load_monitor, block.frames, m_processSetup.sampleRate);
+
+	// The plugin delays the audio by its latency, so the output starts with audio captured that much earlier
+	uint64_t latency_ns = uint64_t(m_latency_frames) * 1000000000 / uint64_t(m_processSetup.sampleRate);
+	uint64_t timestamp = (block.timestamp > latency_ns) ? block.timestamp - latency_ns : block.timestamp;
+
+	// Process calls take any number of frames up to maxSamplesPerBlock, so blocks that fit go through in one call
+	// at the upstream cadence without adding latency. Only longer ones are split
+	size_t max_frames = size_t(m_processSetup.maxSamplesPerBlock);
+	size_t channels = m_processData.outputs->numChannels;
+	for (size_t offset = 0; offset < block.frames; offset += max_frames) {
+		size_t frames = std::min(max_frames, block.frames - offset);
+		if (!process_VST(block, offset, frames))
+			return;
+		for (size_t channel = 0; channel < channels; ++channel)
+			read_VST_output(channel, frames, m_rebuffered_output.data() + channel * block.frames + offset);
+	}
+
+	if (block.frames > m_output_queue.write_available() || !m_output_blocks.write_available()) {
+		m_dropped_blocks.fetch_add(1, std::memory_order_relaxed);
+		return;
+	}
+	m_output_queue.write(m_rebuffered_output.data(), block.frames, block.frames);
+	m_output_blocks.push(QueuedBlock{ uint32_t(block.frames), timestamp });
+}
+
+size_t AudioVSTHost::graph_channels() const
+{
+	return (m_audioEffect && m_processData.outputs) ? m_processData.outputs->numChannels : 0;
+}
+
+size_t AudioVSTHost::graph_max_frames() const
+{
+	return size_t(m_processSetup.maxSamplesPerBlock);
+}
+
+uint32_t AudioVSTHost::graph_samplerate() const
+{
+	return uint32_t(m_processSetup.sampleRate);
+}
+
+bool AudioVSTHost::set_graph_samplerate(uint32_t samplerate)
+{
+	// Setting the plugin up again needs every other thread off it, which a sink's callback can't be
+	if (!m_audioEffect || graph_owner())
+		return false;
+	return reconfigure(samplerate);
+}
+
+size_t AudioVSTHost::render_graph_block(const AudioBlockView& input, AUDIO_BUFFER_T* output, size_t frames)
+{
+	AudioLoadMonitor::Scope load_scope(m_load_monitor, frames, m_processSetup.sampleRate);
+	if (!process_VST(input, 0, frames))
+		return 0;
+
+	size_t channels = m_processData.outputs->numChannels;
+	for (size_t channel = 0; channel < channels; ++channel)
+		read_VST_output(channel, frames, output + channel * frames);
+	return channels;
+}
+
+void AudioVSTHost::update_latency()
+{
+	uint32_t latency = m_audioEffect ? m_audioEffect->getLatencySamples() : 0;
+	if (latency != m_latency_frames)
+		Log::entity(Log::Level::debug, "VST latency is {} frames", latency);
+	m_latency_frames = latency;
+	m_latency_published = false;
+}
+
+bool AudioVSTHost::process_VST(const AudioBlockView& block, size_t offset, size_t frames)
+{
+	frames = std::min(frames, size_t(m_processSetup.maxSamplesPerBlock));
+	m_processData.numSamples = int32(frames);
+
+	// Read floats from the block into VST buffer
+	size_t copied_frames = (block.frames > offset) ? std::min(block.frames - offset, frames) : 0;
+	if (m_processData.inputs) {
+		size_t vst_channels = m_processData.inputs->numChannels;
+		size_t copied_channels = std::min(block.channels, vst_channels);
+		bool double_precision = m_processSetup.symbolicSampleSize == kSample64;
+		for (size_t channel = 0; channel < vst_channels; ++channel) {
+			size_t channel_frames = (channel < copied_channels) ? copied_frames : 0;
+			const AUDIO_BUFFER_T* src = channel_frames ? block.channel(channel) + offset : nullptr;
+			if (double_precision) {
+				Sample64* dst = m_processData.inputs->channelBuffers64[channel];
+				AudioKernels::to_double(src, dst, channel_frames);
+				std::fill(dst + channel_frames, dst + frames, 0.0);
+			}
+			else {
+				Sample32* dst = m_processData.inputs->channelBuffers32[channel];
+				std::copy_n(src, channel_frames, dst);
+				std::fill(dst + channel_frames, dst + frames, 0.0f);
 			}
 		}
+	}
 
-		// Set process context info
-		int samplesize = floor(double(plug->size()) * 0.5);
-		m_elapsed_samples += samplesize;//floor(plug->size() * 0.5);
-		
-		m_processContext->state = ProcessContext::kPlaying;// | ProcessContext::kRecording | ProcessContext::kCycleActive;
-		m_processContext->sampleRate = m_processSetup.sampleRate;
-		m_processContext->projectTimeSamples = m_elapsed_samples;
+	// Set process context info
+	m_elapsed_samples += frames;
+	
+	m_processContext->state = ProcessContext::kPlaying;// | ProcessContext::kRecording | ProcessContext::kCycleActive;
+	m_processContext->sampleRate = m_processSetup.sampleRate;
+	m_processContext->projectTimeSamples = m_elapsed_samples;
 
-		m_processContext->state |= ProcessContext::kSystemTimeValid;
-		m_processContext->systemTime = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+	m_processContext->state |= ProcessContext::kSystemTimeValid;
+	m_processContext->systemTime = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
 
-		m_processContext->state |= ProcessContext::kContTimeValid;
-		m_processContext->continousTimeSamples += m_elapsed_samples;
+	m_processContext->state |= ProcessContext::kContTimeValid;
+	m_processContext->continousTimeSamples += m_elapsed_samples;
 
-		m_processContext->state |= ProcessContext::kTempoValid;
-		m_processContext->tempo = 120;
+	m_processContext->state |= ProcessContext::kTempoValid;
+	m_processContext->tempo = 120;
 
-		m_processContext->state |= ProcessContext::kTimeSigValid;
-		m_processContext->timeSigNumerator = 4;
-		m_processContext->timeSigDenominator = 4;
+	m_processContext->state |= ProcessContext::kTimeSigValid;
+	m_processContext->timeSigNumerator = 4;
+	m_processContext->timeSigDenominator = 4;
 
-		m_processContext->state |= ProcessContext::kProjectTimeMusicValid;
-		m_processContext->projectTimeMusic = double(m_processContext->projectTimeSamples) / (60.0 / double(m_processContext->tempo)) * double(m_processContext->sampleRate);
+	m_processContext->state |= ProcessContext::kProjectTimeMusicValid;
+	m_processContext->projectTimeMusic = double(m_processContext->projectTimeSamples) / (60.0 / double(m_processContext->tempo)) * double(m_processContext->sampleRate);
 
-		// Start processing VST data
-		m_audioEffect->setProcessing(true);
-		tresult result = m_audioEffect->process(m_processData);
-		if (result != kResultOk){
-			if (m_processSetup.symbolicSampleSize == kSample32)
-				Log::entity(Log::Level::error, "IAudioProcessor::process (..with kSample32..) failed.");
+	// Check VST produced output we can publish. Callers only get here once outputs are prepared
+	if (!m_processData.outputs) {
+		m_process_failures.fetch_add(1, std::memory_order_relaxed);
+		return false;
+	}
+
+	// Processing stays on from one block to the next. Switching it on and off around every call makes many plugins
+	// reset their state or allocate
+	if (m_bypassed.load(std::memory_order_relaxed)) {
+		suspend_processing();
+		bypass_VST(frames);
+		return true;
+	}
+	if (!begin_processing())
+		return false;
+
+	// Runs in a sink's callback when part of a graph, so failures are only counted here
+	if (m_audioEffect->process(m_processData) != kResultOk)
+		m_process_failures.fetch_add(1, std::memory_order_relaxed);
+	return true;
+}
+
+void AudioVSTHost::bypass_VST(size_t frames)
+{
+	// Input channels go straight to the matching outputs. Outputs without an input are silent
+	size_t output_channels = m_processData.outputs->numChannels;
+	size_t input_channels = m_processData.inputs ? size_t(m_processData.inputs->numChannels) : 0;
+	for (size_t channel = 0; channel < output_channels; ++channel) {
+		if (m_processSetup.symbolicSampleSize == kSample64) {
+			Sample64* dst = m_processData.outputs->channelBuffers64[channel];
+			if (channel < input_channels)
+				std::copy_n(m_processData.inputs->channelBuffers64[channel], frames, dst);
 			else
-				Log::entity(Log::Level::error, "IAudioProcessor::process (..with kSample64..) failed.");
-		}
-		m_audioEffect->setProcessing(false);
-		
-		// Copy VST data into plug
-		if (m_processData.outputs) {
-			processed_VST = true;
-			for (size_t channel = 0; channel < 2; ++channel) {
-				for (size_t out_sample = 0; out_sample < m_processData.numSamples; out_sample++) {
-					outgoing_audio()->append_float(m_processData.outputs->channelBuffers32[channel][out_sample]);
-				}
-			}
+				std::fill_n(dst, frames, 0.0);
 		}
 		else {
-			Log::entity(Log::Level::error, "Can't publish output VST samples. Output buffer is null");
+			Sample32* dst = m_processData.outputs->channelBuffers32[channel];
+			if (channel < input_channels)
+				std::copy_n(m_processData.inputs->channelBuffers32[channel], frames, dst);
+			else
+				std::fill_n(dst, frames, 0.0f);
 		}
-		
-		// Only publish to the performance if we did work
-		if(processed_VST)
-			outgoing_audio()->fire();
 	}
 }
+
+void AudioVSTHost::read_VST_output(size_t channel, size_t frames, AUDIO_BUFFER_T* dst) const
+{
+	// Published audio is always float, whatever precision the plugin runs at
+	if (m_processSetup.symbolicSampleSize == kSample64)
+		AudioKernels::from_double(m_processData.outputs->channelBuffers64[channel], dst, frames);
+	else
+		std::copy_n(m_processData.outputs->channelBuffers32[channel], frames, dst);
+}
+
+void AudioVSTHost::select_sample_size()
+{
+	// VST3 has no way to ask for a preferred precision. A plugin that implements a double precision path is assumed to
+	// run it natively and would only convert internally if fed floats, so it gets doubles whenever it offers them
+	bool doubles = m_audioEffect->canProcessSampleSize(kSample64) == kResultTrue;
+	if (!doubles && m_audioEffect->canProcessSampleSize(kSample32) != kResultTrue)
+		Log::entity(Log::Level::warn, "VST reports no supported sample size, trying 32 bit");
+
+	m_processSetup.symbolicSampleSize = doubles ? kSample64 : kSample32;
+	m_processData.symbolicSampleSize = m_processSetup.symbolicSampleSize;
+	Log::entity(Log::Level::debug, "VST processes {} bit samples", doubles ? 64 : 32);
+}
@@ -3,7 +3,12 @@
 #include <showtime/ZstExports.h>
 #include <showtime/entities/ZstComponent.h>
 #include <showtime/entities/ZstPlug.h>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
 #include <memory>
+#include <mutex>
+#include <boost/lockfree/spsc_queue.hpp>
 #include <boost/thread.hpp>
 
 #include "public.sdk/source/vst/hosting/plugprovider.h"
@@ -15,11 +20,28 @@
 #include <public.sdk/source/vst/hosting/processdata.h>
 
 #include "../AudioComponentBase.h"
+#include "../AudioRingBuffer.h"
 #include "WindowController.h"
 
 
 #define AUDIOVSTHOST_COMPONENT_TYPE "vsthost"
 
+// IN_audio plus IN_mix_1 .. IN_mix_3
+#define AUDIOVSTHOST_MIX_SOURCES 4
+
+// Largest block handed to the plugin in one process call. Longer incoming blocks are split
+#define AUDIOVSTHOST_MAX_BLOCK_FRAMES 2048
+
+// Block size the mixer starts with, before IN_audio has delivered anything
+#define AUDIOVSTHOST_DEFAULT_BLOCK_FRAMES 512
+
+// Frames and blocks the queues to and from the processing thread hold. Blocks that don't fit are dropped
+#define AUDIOVSTHOST_QUEUE_FRAMES (AUDIOVSTHOST_MAX_BLOCK_FRAMES * 4)
+#define AUDIOVSTHOST_QUEUE_BLOCKS 64
+
+// Processing is switched off once no block has come through for this long, and back on with the next one
+#define AUDIOVSTHOST_IDLE_TIMEOUT std::chrono::seconds(2)
+
 // Forwards
 namespace VST3 {
 	namespace Hosting {
@@ -44,15 +66,77 @@ class AudioVSTHost :
 {
 public:
 	ZST_PLUGIN_EXPORT AudioVSTHost(const char* name, const char* vst_path, Steinberg::Vst::HostApplication* plugin_context);
+	ZST_PLUGIN_EXPORT ~AudioVSTHost();
+	ZST_PLUGIN_EXPORT virtual void on_registered() override;
+	ZST_PLUGIN_EXPORT virtual void on_tick() override;
+
+	// The plugin runs as a processor in the sink device's callback when it is part of an in-process graph
+	size_t graph_channels() const override;
+	size_t graph_max_frames() const override;
+	size_t render_graph_block(const AudioBlockView& input, AUDIO_BUFFER_T* output, size_t frames) override;
+	void set_graph_owner(AudioComponentBase* sink, bool exclusive) override;
+	uint32_t graph_samplerate() const override;
+	bool set_graph_samplerate(uint32_t samplerate) override;
 
 private:
 	void load_VST(const std::string& path, Steinberg::Vst::HostApplication* plugin_context);
 	void createViewAndShow(Steinberg::Vst::IEditController* controller);
 	void compute(showtime::ZstInputPlug* plug) override;
 
+	// Processing thread. compute decodes and mixes incoming audio on the poll thread and queues each block,
+	// m_process_thread runs it through the plugin and queues the output, and the poll thread publishes it
+	struct QueuedBlock {
+		uint32_t frames;
+		uint64_t timestamp;
+	};
+	typedef boost::lockfree::spsc_queue<QueuedBlock, boost::lockfree::capacity<AUDIOVSTHOST_QUEUE_BLOCKS>> BlockQueue;
+	void start_processing_thread();
+	void stop_processing_thread();
+	void process_loop();
+	void process_queued_blocks();
+	void pause_processing(bool paused);
+	void queue_block(const AudioBlockView& block);
+	void publish_processed_blocks();
+
+	// Processing thread. Runs one block through the plugin and queues the output
+	void process_block(const AudioBlockView& block);
+
+	// Runs frames of block starting at offset through the plugin, at most maxSamplesPerBlock of them.
+	// Returns false if there is no output to read
+	bool process_VST(const AudioBlockView& block, size_t offset, size_t frames);
+
+	// Plugin latency in frames, reported on OUT_latency and taken off the timestamps of processed blocks
+	void update_latency();
+
 	// VST setup
 	bool prepareProcessing();
 
+	// Plugins run at 32 or 64 bit. Audio is converted at the boundary into the buffers prepareProcessing allocates,
+	// so plugs always carry floats
+	void select_sample_size();
+	void read_VST_output(size_t channel, size_t frames, AUDIO_BUFFER_T* dst) const;
+
+	// Plugin lifecycle. The plugin is set up and activated once, and processing is switched on with the first block
+	// and left on across blocks. It is only switched off when the host is bypassed, runs out of blocks for
+	// AUDIOVSTHOST_IDLE_TIMEOUT, has to be set up again for another samplerate, or goes away.
+	// begin_processing and suspend_processing are called by whichever thread runs the plugin at the time,
+	// everything else on the poll thread while neither the processing thread nor a sink's callback can run it
+	enum class ProcessingState {
+		Unprepared,
+		Inactive,
+		Active,
+		Processing
+	};
+	bool activate();
+	void deactivate();
+	bool begin_processing();
+	void suspend_processing();
+	bool reconfigure(uint32_t samplerate);
+
+	// Bypassed audio passes through untouched with processing switched off
+	void set_bypass(showtime::ZstInputPlug* plug);
+	void bypass_VST(size_t frames);
+
 	// VST interface
 	std::shared_ptr<VST3::Hosting::Module> m_module;
 	Steinberg::IPtr<Steinberg::Vst::PlugProvider> m_plugProvider;
@@ -69,4 +153,39 @@ private:
 	Steinberg::Vst::EditorHost::WindowPtr m_window;
 
 	long long m_elapsed_samples;
+
+	// Output of each block gathered from its process calls, on the processing thread
+	std::vector<AUDIO_BUFFER_T> m_rebuffered_output;
+
+	AudioRingBuffer<AUDIO_BUFFER_T> m_input_queue;
+	BlockQueue m_input_blocks;
+	AudioRingBuffer<AUDIO_BUFFER_T> m_output_queue;
+	BlockQueue m_output_blocks;
+	std::vector<AUDIO_BUFFER_T> m_process_input;
+	std::vector<AUDIO_BUFFER_T> m_publish_output;
+
+	boost::thread m_process_thread;
+	std::mutex m_process_mtx;
+	std::condition_variable m_process_wakeup;
+	std::condition_variable m_process_idle;
+	bool m_process_stop;
+	bool m_process_paused;
+	bool m_process_busy;
+
+	// Blocks that didn't fit either queue, reported from on_tick
+	std::atomic<uint64_t> m_dropped_blocks;
+	uint64_t m_reported_dropped_blocks;
+
+	// Failed setProcessing and process calls. They can happen in a sink's callback, so they are only counted there
+	// and reported from on_tick
+	std::atomic<uint64_t> m_process_failures;
+	uint64_t m_reported_process_failures;
+
+	uint32_t m_latency_frames;
+	bool m_latency_published;
+	std::shared_ptr<showtime::ZstOutputPlug> m_latency_out;
+
+	ProcessingState m_processing_state;
+	std::shared_ptr<showtime::ZstInputPlug> m_bypass_in;
+	std::atomic<bool> m_bypassed;
 };
@@ -29,6 +29,7 @@ namespace showtime {
 			//vst_data_path.append(PLUGIN_NAME).append(MIDI_MAP_DIR);
 		 	if(fs::exists(vst_data_path))
 				vst_factory->scan_vst_path(vst_data_path.string());
+			audio_factory->load_device_config(data_path.string());
 		 }
 		 else {
 		 	Log::app(Log::Level::warn, "ShowtimeAudioPlugin: No plugin data path set. Can't load content");
@@ -0,0 +1,107 @@
+#include <boost/test/unit_test.hpp>
+#include "AudioCodec.h"
+
+#include <cmath>
+#include <cstdint>
+#include <random>
+#include <vector>
+
+namespace {
+	int32_t max_sample(unsigned bits) { return (int32_t(1) << (bits - 1)) - 1; }
+	int32_t min_sample(unsigned bits) { return -(int32_t(1) << (bits - 1)); }
+
+	std::vector<int32_t> round_trip(const std::vector<int32_t>& planar, size_t channels, size_t frames, unsigned bits, size_t* encoded_size = nullptr)
+	{
+		std::vector<uint8_t> encoded;
+		AudioCodec::encode(planar.data(), channels, frames, bits, encoded);
+		if (encoded_size)
+			*encoded_size = encoded.size();
+
+		std::vector<int32_t> decoded(channels * frames, 0x7fffffff);
+		BOOST_REQUIRE(AudioCodec::decode(encoded.data(), encoded.size(), channels, frames, bits, decoded.data()));
+		return decoded;
+	}
+
+	// One channel each of silence, a sine, full-scale noise and alternating extremes
+	std::vector<int32_t> mixed_block(size_t frames, unsigned bits)
+	{
+		std::mt19937 random(1234);
+		std::uniform_int_distribution<int32_t> noise(min_sample(bits), max_sample(bits));
+		std::vector<int32_t> planar(4 * frames, 0);
+		for (size_t frame = 0; frame < frames; ++frame) {
+			planar[frames + frame] = int32_t(std::lround(std::sin(frame * 0.05) * max_sample(bits) * 0.8));
+			planar[2 * frames + frame] = noise(random);
+			planar[3 * frames + frame] = (frame & 1) ? max_sample(bits) : min_sample(bits);
+		}
+		return planar;
+	}
+}
+
+BOOST_AUTO_TEST_SUITE(AudioCodecSuite)
+
+BOOST_AUTO_TEST_CASE(round_trips_every_channel_type)
+{
+	for (unsigned bits : { 16u, 24u }) {
+		for (size_t frames : { size_t(1), size_t(63), size_t(512), size_t(1000) }) {
+			auto planar = mixed_block(frames, bits);
+			auto decoded = round_trip(planar, 4, frames, bits);
+			BOOST_CHECK_EQUAL_COLLECTIONS(decoded.begin(), decoded.end(), planar.begin(), planar.end());
+		}
+	}
+}
+
+BOOST_AUTO_TEST_CASE(compresses_predictable_audio)
+{
+	size_t frames = 512;
+	std::vector<int32_t> sine(frames);
+	for (size_t frame = 0; frame < frames; ++frame)
+		sine[frame] = int32_t(std::lround(std::sin(frame * 0.01) * 20000));
+
+	size_t encoded_size = 0;
+	auto decoded = round_trip(sine, 1, frames, 16, &encoded_size);
+	BOOST_CHECK_EQUAL_COLLECTIONS(decoded.begin(), decoded.end(), sine.begin(), sine.end());
+	BOOST_CHECK_LT(encoded_size, frames);	// under half the size of raw 16 bit samples
+
+	// Silence needs no more than the constant every channel has to carry
+	std::vector<int32_t> silence(2 * frames, 0);
+	round_trip(silence, 2, frames, 24, &encoded_size);
+	BOOST_CHECK_GE(encoded_size, AudioCodec::min_encoded_size(2, 24));
+	BOOST_CHECK_LE(encoded_size, AudioCodec::min_encoded_size(2, 24) + 2);
+}
+
+BOOST_AUTO_TEST_CASE(rejects_truncated_data)
+{
+	size_t frames = 256;
+	auto planar = mixed_block(frames, 16);
+	std::vector<uint8_t> encoded;
+	AudioCodec::encode(planar.data(), 4, frames, 16, encoded);
+
+	std::vector<int32_t> decoded(4 * frames);
+	for (size_t size = 0; size < encoded.size(); ++size)
+		BOOST_CHECK_MESSAGE(!AudioCodec::decode(encoded.data(), size, 4, frames, 16, decoded.data()), "decoded " << size << " of " << encoded.size() << " bytes");
+}
+
+BOOST_AUTO_TEST_CASE(keeps_corrupt_output_in_range)
+{
+	// Flipped bits may still decode, but never to samples outside the bit depth
+	size_t frames = 256;
+	auto planar = mixed_block(frames, 16);
+	std::vector<uint8_t> encoded;
+	AudioCodec::encode(planar.data(), 4, frames, 16, encoded);
+
+	std::mt19937 random(99);
+	std::vector<int32_t> decoded(4 * frames);
+	for (int trial = 0; trial < 500; ++trial) {
+		auto corrupt = encoded;
+		for (int flip = 0; flip < 4; ++flip)
+			corrupt[random() % corrupt.size()] ^= uint8_t(1 << (random() % 8));
+		if (!AudioCodec::decode(corrupt.data(), corrupt.size(), 4, frames, 16, decoded.data()))
+			continue;
+		for (auto sample : decoded) {
+			BOOST_REQUIRE_GE(sample, min_sample(16));
+			BOOST_REQUIRE_LE(sample, max_sample(16));
+		}
+	}
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,245 @@
+#include <boost/test/unit_test.hpp>
+#include "AudioPayload.h"
+#include "AudioCodec.h"
+
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+namespace {
+	AudioPayload::Header make_header(AudioKernels::SampleFormat sample_type, AudioPayload::Codec codec, uint16_t channels, uint32_t frames)
+	{
+		AudioPayload::Header header;
+		header.sample_type = sample_type;
+		header.codec = codec;
+		header.channels = channels;
+		header.frames = frames;
+		header.samplerate = 48000;
+		header.sequence = 7;
+		header.timestamp = 123456789012345ull;
+		return header;
+	}
+
+	std::vector<uint8_t> make_payload(const AudioPayload::Header& header, std::vector<float>& planar)
+	{
+		planar.resize(size_t(header.channels) * header.frames);
+		for (size_t idx = 0; idx < planar.size(); ++idx)
+			planar[idx] = float(std::sin(idx * 0.01) * 0.5);
+
+		std::vector<const float*> channels;
+		for (size_t channel = 0; channel < header.channels; ++channel)
+			channels.push_back(planar.data() + channel * header.frames);
+
+		std::vector<uint8_t> payload;
+		AudioPayload::encode(header, channels.data(), payload);
+		return payload;
+	}
+
+	// A payload of the right size for the header, without caring what the body holds
+	std::vector<uint8_t> raw_payload(uint16_t channels, uint32_t frames)
+	{
+		auto header = make_header(AudioKernels::SampleFormat::Int16, AudioPayload::Codec::None, 1, 1);
+		std::vector<float> planar;
+		auto payload = make_payload(header, planar);
+		payload[6] = uint8_t(channels);
+		payload[7] = uint8_t(channels >> 8);
+		for (int byte = 0; byte < 4; ++byte)
+			payload[8 + byte] = uint8_t(frames >> (8 * byte));
+		payload.resize(AUDIO_PAYLOAD_HEADER_SIZE + size_t(channels) * frames * 2);
+		return payload;
+	}
+}
+
+BOOST_AUTO_TEST_SUITE(AudioPayloadSuite)
+
+BOOST_AUTO_TEST_CASE(round_trips_every_sample_type)
+{
+	struct Case { AudioKernels::SampleFormat sample_type; AudioPayload::Codec codec; float tolerance; };
+	const Case cases[] = {
+		{ AudioKernels::SampleFormat::Float32, AudioPayload::Codec::None, 0.0f },
+		{ AudioKernels::SampleFormat::Int16, AudioPayload::Codec::None, 1.0f / 16384 },
+		{ AudioKernels::SampleFormat::Int24, AudioPayload::Codec::None, 1.0f / 4194304 },
+		{ AudioKernels::SampleFormat::Int16, AudioPayload::Codec::Lossless, 1.0f / 16384 },
+		{ AudioKernels::SampleFormat::Int24, AudioPayload::Codec::Lossless, 1.0f / 4194304 }
+	};
+
+	for (const auto& test : cases) {
+		auto header = make_header(test.sample_type, test.codec, 3, 480);
+		std::vector<float> planar;
+		auto payload = make_payload(header, planar);
+
+		AudioPayload::Header decoded;
+		BOOST_REQUIRE(AudioPayload::decode_header(payload.data(), payload.size(), decoded));
+		BOOST_CHECK(decoded.sample_type == test.sample_type);
+		BOOST_CHECK(decoded.codec == test.codec);
+		BOOST_CHECK_EQUAL(decoded.channels, 3);
+		BOOST_CHECK_EQUAL(decoded.frames, 480u);
+		BOOST_CHECK_EQUAL(decoded.samplerate, 48000u);
+		BOOST_CHECK_EQUAL(decoded.sequence, 7u);
+		BOOST_CHECK_EQUAL(decoded.timestamp, 123456789012345ull);
+
+		std::vector<float> samples(planar.size());
+		BOOST_REQUIRE(AudioPayload::decode_body(decoded, payload.data(), payload.size(), samples.data()));
+		for (size_t idx = 0; idx < samples.size(); ++idx)
+			BOOST_REQUIRE_LE(std::fabs(samples[idx] - planar[idx]), test.tolerance);
+	}
+}
+
+BOOST_AUTO_TEST_CASE(lossless_falls_back_for_float)
+{
+	auto header = make_header(AudioKernels::SampleFormat::Float32, AudioPayload::Codec::Lossless, 2, 64);
+	std::vector<float> planar;
+	auto payload = make_payload(header, planar);
+
+	AudioPayload::Header decoded;
+	BOOST_REQUIRE(AudioPayload::decode_header(payload.data(), payload.size(), decoded));
+	BOOST_CHECK(decoded.codec == AudioPayload::Codec::None);
+	BOOST_CHECK_EQUAL(payload.size(), AudioPayload::encoded_size(decoded));
+}
+
+BOOST_AUTO_TEST_CASE(rejects_malformed_headers)
+{
+	auto header = make_header(AudioKernels::SampleFormat::Int16, AudioPayload::Codec::None, 2, 64);
+	std::vector<float> planar;
+	const auto payload = make_payload(header, planar);
+	AudioPayload::Header decoded;
+	BOOST_REQUIRE(AudioPayload::decode_header(payload.data(), payload.size(), decoded));
+
+	BOOST_CHECK(!AudioPayload::decode_header(nullptr, 0, decoded));
+	BOOST_CHECK(!AudioPayload::decode_header(payload.data(), AUDIO_PAYLOAD_HEADER_SIZE - 1, decoded));
+	BOOST_CHECK(!AudioPayload::decode_header(payload.data(), payload.size() - 1, decoded));
+
+	auto longer = payload;
+	longer.push_back(0);
+	BOOST_CHECK(!AudioPayload::decode_header(longer.data(), longer.size(), decoded));
+
+	// Magic, version, sample type, layout and codec bytes
+	const std::pair<size_t, uint8_t> corruptions[] = { { 0, 'X' }, { 1, 'B' }, { 2, AUDIO_PAYLOAD_VERSION + 1 }, { 3, 4 }, { 4, 1 }, { 5, 2 } };
+	for (const auto& corruption : corruptions) {
+		auto corrupt = payload;
+		corrupt[corruption.first] = corruption.second;
+		BOOST_CHECK_MESSAGE(!AudioPayload::decode_header(corrupt.data(), corrupt.size(), decoded), "byte " << corruption.first);
+	}
+
+	auto empty = raw_payload(0, 64);
+	BOOST_CHECK(!AudioPayload::decode_header(empty.data(), empty.size(), decoded));
+	empty = raw_payload(2, 0);
+	BOOST_CHECK(!AudioPayload::decode_header(empty.data(), empty.size(), decoded));
+}
+
+BOOST_AUTO_TEST_CASE(rejects_oversized_blocks)
+{
+	AudioPayload::Header decoded;
+	auto payload = raw_payload(AUDIO_PAYLOAD_MAX_CHANNELS, 1);
+	BOOST_CHECK(AudioPayload::decode_header(payload.data(), payload.size(), decoded));
+	payload = raw_payload(AUDIO_PAYLOAD_MAX_CHANNELS + 1, 1);
+	BOOST_CHECK(!AudioPayload::decode_header(payload.data(), payload.size(), decoded));
+
+	payload = raw_payload(1, AUDIO_PAYLOAD_MAX_FRAMES);
+	BOOST_CHECK(AudioPayload::decode_header(payload.data(), payload.size(), decoded));
+	payload = raw_payload(1, AUDIO_PAYLOAD_MAX_FRAMES + 1);
+	BOOST_CHECK(!AudioPayload::decode_header(payload.data(), payload.size(), decoded));
+
+	// Both within their own limits, but too many samples together
+	uint16_t channels = AUDIO_PAYLOAD_MAX_SAMPLES / AUDIO_PAYLOAD_MAX_FRAMES;
+	payload = raw_payload(channels, AUDIO_PAYLOAD_MAX_FRAMES);
+	BOOST_CHECK(AudioPayload::decode_header(payload.data(), payload.size(), decoded));
+	payload = raw_payload(channels + 1, AUDIO_PAYLOAD_MAX_FRAMES);
+	BOOST_CHECK(!AudioPayload::decode_header(payload.data(), payload.size(), decoded));
+}
+
+BOOST_AUTO_TEST_CASE(rejects_short_lossless_bodies)
+{
+	// Silence compresses to the smallest body possible
+	auto header = make_header(AudioKernels::SampleFormat::Int24, AudioPayload::Codec::Lossless, 4, 256);
+	std::vector<float> silence(4 * 256, 0.0f);
+	std::vector<const float*> channels;
+	for (size_t channel = 0; channel < 4; ++channel)
+		channels.push_back(silence.data() + channel * 256);
+	std::vector<uint8_t> payload;
+	AudioPayload::encode(header, channels.data(), payload);
+
+	size_t min_size = AUDIO_PAYLOAD_HEADER_SIZE + AudioCodec::min_encoded_size(4, 24);
+	BOOST_REQUIRE_GE(payload.size(), min_size);
+
+	AudioPayload::Header decoded;
+	BOOST_REQUIRE(AudioPayload::decode_header(payload.data(), payload.size(), decoded));
+	std::vector<float> samples(4 * 256, 1.0f);
+	BOOST_REQUIRE(AudioPayload::decode_body(decoded, payload.data(), payload.size(), samples.data()));
+	for (auto sample : samples)
+		BOOST_REQUIRE_SMALL(sample, 1e-6f);
+
+	BOOST_CHECK(!AudioPayload::decode_header(payload.data(), min_size - 1, decoded));
+
+	// A body cut short but still past the minimum passes the header check and is caught while decoding
+	auto noisy = make_header(AudioKernels::SampleFormat::Int16, AudioPayload::Codec::Lossless, 2, 256);
+	std::vector<float> planar;
+	payload = make_payload(noisy, planar);
+	BOOST_REQUIRE(AudioPayload::decode_header(payload.data(), payload.size() - 1, decoded));
+	samples.resize(2 * 256);
+	BOOST_CHECK(!AudioPayload::decode_body(decoded, payload.data(), payload.size() - 1, samples.data()));
+}
+
+BOOST_AUTO_TEST_CASE(splits_batches)
+{
+	std::vector<std::vector<uint8_t>> payloads;
+	std::vector<float> planar;
+	for (uint32_t sequence = 0; sequence < 3; ++sequence) {
+		auto header = make_header(AudioKernels::SampleFormat::Float32, AudioPayload::Codec::None, 1, 32 + sequence);
+		header.sequence = sequence;
+		payloads.push_back(make_payload(header, planar));
+	}
+
+	std::vector<uint8_t> batch;
+	AudioPayload::begin_batch(batch);
+	for (size_t idx = 0; idx < payloads.size(); ++idx)
+		BOOST_CHECK_EQUAL(AudioPayload::append_to_batch(batch, payloads[idx].data(), payloads[idx].size()), idx + 1);
+
+	std::vector<AudioPayload::Span> spans;
+	BOOST_REQUIRE(AudioPayload::split_batch(batch.data(), batch.size(), spans));
+	BOOST_REQUIRE_EQUAL(spans.size(), payloads.size());
+	for (size_t idx = 0; idx < spans.size(); ++idx) {
+		BOOST_REQUIRE_EQUAL(spans[idx].size, payloads[idx].size());
+		BOOST_CHECK(std::memcmp(spans[idx].data, payloads[idx].data(), spans[idx].size) == 0);
+	}
+
+	// A plain payload is a batch of one
+	BOOST_REQUIRE(AudioPayload::split_batch(payloads[0].data(), payloads[0].size(), spans));
+	BOOST_REQUIRE_EQUAL(spans.size(), 1u);
+	BOOST_CHECK(spans[0].data == payloads[0].data());
+
+	std::vector<uint8_t> empty;
+	AudioPayload::begin_batch(empty);
+	BOOST_CHECK(AudioPayload::split_batch(empty.data(), empty.size(), spans));
+	BOOST_CHECK(spans.empty());
+}
+
+BOOST_AUTO_TEST_CASE(rejects_truncated_batches)
+{
+	std::vector<float> planar;
+	auto payload = make_payload(make_header(AudioKernels::SampleFormat::Int16, AudioPayload::Codec::None, 2, 16), planar);
+	std::vector<uint8_t> batch;
+	AudioPayload::begin_batch(batch);
+	AudioPayload::append_to_batch(batch, payload.data(), payload.size());
+	AudioPayload::append_to_batch(batch, payload.data(), payload.size());
+
+	// Every cut, whether inside a size prefix or a payload, loses the last payload
+	std::vector<AudioPayload::Span> spans;
+	for (size_t size = AUDIO_BATCH_HEADER_SIZE; size < batch.size(); ++size) {
+		spans.push_back({ nullptr, 0 });
+		BOOST_CHECK_MESSAGE(!AudioPayload::split_batch(batch.data(), size, spans), "split " << size << " of " << batch.size() << " bytes");
+		BOOST_CHECK(spans.empty());
+	}
+
+	// A count claiming more payloads than are there
+	auto overcounted = batch;
+	overcounted[4] = 3;
+	BOOST_CHECK(!AudioPayload::split_batch(overcounted.data(), overcounted.size(), spans));
+
+	auto future = batch;
+	future[2] = AUDIO_PAYLOAD_VERSION + 1;
+	BOOST_CHECK(!AudioPayload::split_batch(future.data(), future.size(), spans));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,179 @@
+#include <boost/test/unit_test.hpp>
+#include "AudioReorderBuffer.h"
+
+#include <cmath>
+#include <vector>
+
+namespace {
+	// Network blocks of constant value so each one can be recognised after it comes out, stamped back to back at 48kHz
+	struct Blocks {
+		std::vector<AUDIO_BUFFER_T> samples;
+
+		AudioBlockView make(uint32_t sequence, float value, size_t channels = 2, size_t frames = 128)
+		{
+			samples.assign(channels * frames, value);
+			return AudioBlockView{ samples.data(), channels, frames, 48000, sequence, 1000000000ull + sequence * frames * 1000000000ull / 48000 };
+		}
+	};
+
+	float peak(const AudioBlockView& block)
+	{
+		float level = 0.0f;
+		for (size_t idx = 0; idx < block.channels * block.frames; ++idx)
+			level = std::max(level, std::fabs(block.samples[idx]));
+		return level;
+	}
+}
+
+BOOST_AUTO_TEST_SUITE(AudioReorderBufferSuite)
+
+BOOST_AUTO_TEST_CASE(passes_blocks_in_order)
+{
+	AudioReorderBuffer buffer;
+	Blocks blocks;
+	BOOST_CHECK_EQUAL(buffer.pop().frames, 0u);
+
+	for (uint32_t sequence = 10; sequence < 20; ++sequence) {
+		buffer.push(blocks.make(sequence, float(sequence)));
+		auto block = buffer.pop();
+		BOOST_REQUIRE_EQUAL(block.frames, 128u);
+		BOOST_CHECK_EQUAL(block.sequence, sequence);
+		BOOST_CHECK_EQUAL(block.samples[0], float(sequence));
+		BOOST_CHECK_EQUAL(buffer.pop().frames, 0u);
+	}
+	BOOST_CHECK_EQUAL(buffer.stats().received.load(), 10u);
+	BOOST_CHECK_EQUAL(buffer.stats().lost.load(), 0u);
+}
+
+BOOST_AUTO_TEST_CASE(reorders_within_window)
+{
+	AudioReorderBuffer buffer;
+	Blocks blocks;
+	buffer.push(blocks.make(0, 0.0f));
+	buffer.push(blocks.make(2, 2.0f));
+	buffer.push(blocks.make(1, 1.0f));
+
+	for (uint32_t sequence = 0; sequence < 3; ++sequence) {
+		auto block = buffer.pop();
+		BOOST_REQUIRE_EQUAL(block.frames, 128u);
+		BOOST_CHECK_EQUAL(block.sequence, sequence);
+		BOOST_CHECK_EQUAL(block.samples[0], float(sequence));
+	}
+	BOOST_CHECK_EQUAL(buffer.stats().reordered.load(), 1u);
+	BOOST_CHECK_EQUAL(buffer.stats().concealed.load(), 0u);
+}
+
+BOOST_AUTO_TEST_CASE(counts_duplicates_and_late_blocks)
+{
+	AudioReorderBuffer buffer;
+	Blocks blocks;
+	buffer.push(blocks.make(0, 0.0f));
+	buffer.push(blocks.make(1, 1.0f));
+	buffer.push(blocks.make(1, 1.0f));
+	BOOST_CHECK_EQUAL(buffer.stats().duplicates.load(), 1u);
+
+	buffer.pop();
+	buffer.pop();
+	buffer.push(blocks.make(0, 0.0f));
+	BOOST_CHECK_EQUAL(buffer.stats().late.load(), 1u);
+	BOOST_CHECK_EQUAL(buffer.pop().frames, 0u);
+}
+
+BOOST_AUTO_TEST_CASE(waits_then_conceals_missing_block)
+{
+	AudioReorderBuffer buffer;
+	Blocks blocks;
+	buffer.push(blocks.make(0, 0.5f));
+	buffer.pop();
+
+	// Block 1 is missing. Until the window has moved past it, pop waits
+	for (uint32_t sequence = 2; sequence < 1 + AUDIO_REORDER_WINDOW; ++sequence) {
+		buffer.push(blocks.make(sequence, 0.5f));
+		BOOST_CHECK_EQUAL(buffer.pop().frames, 0u);
+	}
+	buffer.push(blocks.make(1 + AUDIO_REORDER_WINDOW, 0.5f));
+
+	auto concealed = buffer.pop();
+	BOOST_REQUIRE_EQUAL(concealed.frames, 128u);
+	BOOST_CHECK_EQUAL(concealed.channels, 2u);
+	BOOST_CHECK_EQUAL(concealed.sequence, 1u);
+	BOOST_CHECK_EQUAL(concealed.timestamp, 1000000000ull + 128 * 1000000000ull / 48000);
+	BOOST_CHECK_GT(peak(concealed), 0.0f);
+	BOOST_CHECK_LE(peak(concealed), 0.5f);
+	BOOST_CHECK_EQUAL(buffer.stats().lost.load(), 1u);
+	BOOST_CHECK_EQUAL(buffer.stats().concealed.load(), 1u);
+
+	for (uint32_t sequence = 2; sequence <= 1 + AUDIO_REORDER_WINDOW; ++sequence)
+		BOOST_CHECK_EQUAL(buffer.pop().sequence, sequence);
+
+	// The missing block turning up now is too late to play
+	buffer.push(blocks.make(1, 0.5f));
+	BOOST_CHECK_EQUAL(buffer.stats().late.load(), 1u);
+}
+
+BOOST_AUTO_TEST_CASE(concealment_decays_to_silence)
+{
+	AudioReorderBuffer buffer;
+	Blocks blocks;
+	buffer.push(blocks.make(0, 1.0f));
+	buffer.pop();
+
+	// Jump far enough ahead to conceal a run of AUDIO_PLC_MAX_BLOCKS
+	uint32_t next = 1 + AUDIO_PLC_MAX_BLOCKS + AUDIO_REORDER_WINDOW - 1;
+	buffer.push(blocks.make(next, 1.0f));
+
+	float level = 1.0f;
+	AudioBlockView block{};
+	for (int idx = 0; idx < AUDIO_PLC_MAX_BLOCKS; ++idx) {
+		block = buffer.pop();
+		BOOST_REQUIRE_EQUAL(block.frames, 128u);
+		BOOST_CHECK_LE(peak(block), level);
+		level = peak(block);
+	}
+	// The last one ramps down to silence
+	BOOST_CHECK_SMALL(block.samples[block.frames - 1], 1e-2f);
+	BOOST_CHECK_EQUAL(buffer.stats().concealed.load(), size_t(AUDIO_PLC_MAX_BLOCKS));
+}
+
+BOOST_AUTO_TEST_CASE(resyncs_after_sender_restart)
+{
+	AudioReorderBuffer buffer;
+	Blocks blocks;
+	buffer.push(blocks.make(5000, 0.0f));
+	buffer.pop();
+
+	buffer.push(blocks.make(3, 1.0f));
+	BOOST_CHECK_EQUAL(buffer.stats().resyncs.load(), 1u);
+	auto block = buffer.pop();
+	BOOST_REQUIRE_EQUAL(block.frames, 128u);
+	BOOST_CHECK_EQUAL(block.sequence, 3u);
+}
+
+BOOST_AUTO_TEST_CASE(follows_sequence_wraparound)
+{
+	AudioReorderBuffer buffer;
+	Blocks blocks;
+	const uint32_t sequences[] = { 0xfffffffeu, 0u, 0xffffffffu, 1u };
+	for (auto sequence : sequences)
+		buffer.push(blocks.make(sequence, 1.0f));
+
+	const uint32_t expected[] = { 0xfffffffeu, 0xffffffffu, 0u, 1u };
+	for (auto sequence : expected)
+		BOOST_CHECK_EQUAL(buffer.pop().sequence, sequence);
+	BOOST_CHECK_EQUAL(buffer.stats().resyncs.load(), 0u);
+	BOOST_CHECK_EQUAL(buffer.stats().lost.load(), 0u);
+}
+
+BOOST_AUTO_TEST_CASE(passes_local_blocks_by_arrival)
+{
+	AudioReorderBuffer buffer;
+	std::vector<AUDIO_BUFFER_T> samples(64, 0.25f);
+	for (int idx = 0; idx < 3; ++idx) {
+		// No samplerate, so the sequence field means nothing
+		buffer.push(AudioBlockView{ samples.data(), 1, 64, 0, 99, 0 });
+		BOOST_CHECK_EQUAL(buffer.pop().frames, 64u);
+	}
+	BOOST_CHECK_EQUAL(buffer.stats().duplicates.load(), 0u);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
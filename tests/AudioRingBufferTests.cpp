@@ -0,0 +1,145 @@
+#include <boost/test/unit_test.hpp>
+#include "AudioRingBuffer.h"
+
+#include <thread>
+#include <vector>
+
+BOOST_AUTO_TEST_SUITE(AudioRingBufferSuite)
+
+BOOST_AUTO_TEST_CASE(rounds_capacity_to_power_of_two)
+{
+	AudioRingBuffer<float> buffer(3, 100);
+	BOOST_CHECK_EQUAL(buffer.channels(), 3u);
+	BOOST_CHECK_EQUAL(buffer.capacity(), 128u);
+	BOOST_CHECK_EQUAL(buffer.read_available(), 0u);
+	BOOST_CHECK_EQUAL(buffer.write_available(), 128u);
+}
+
+BOOST_AUTO_TEST_CASE(keeps_channels_apart_across_the_wrap)
+{
+	AudioRingBuffer<float> buffer(2, 16);
+	std::vector<float> src(2 * 10);
+	std::vector<float> dst(2 * 10);
+	float next = 0.0f;
+	float expected = 0.0f;
+
+	// Blocks of 10 against a capacity of 16 wrap at a different offset every time
+	for (int block = 0; block < 20; ++block) {
+		for (size_t frame = 0; frame < 10; ++frame) {
+			src[frame] = next;
+			src[10 + frame] = -next;
+			next += 1.0f;
+		}
+		BOOST_REQUIRE_EQUAL(buffer.write(src.data(), 10, 10), 10u);
+		BOOST_REQUIRE_EQUAL(buffer.read(dst.data(), 10, 10), 10u);
+		for (size_t frame = 0; frame < 10; ++frame) {
+			BOOST_REQUIRE_EQUAL(dst[frame], expected);
+			BOOST_REQUIRE_EQUAL(dst[10 + frame], -expected);
+			expected += 1.0f;
+		}
+	}
+}
+
+BOOST_AUTO_TEST_CASE(stops_when_full_or_empty)
+{
+	AudioRingBuffer<float> buffer(1, 8);
+	std::vector<float> src(12, 1.0f);
+	std::vector<float> dst(12, 0.0f);
+
+	BOOST_CHECK_EQUAL(buffer.read(dst.data(), 4, 4), 0u);
+	BOOST_CHECK_EQUAL(buffer.write(src.data(), 12, 12), 8u);
+	BOOST_CHECK_EQUAL(buffer.write(src.data(), 1, 1), 0u);
+	BOOST_CHECK_EQUAL(buffer.write_silence(1), 0u);
+	BOOST_CHECK_EQUAL(buffer.read(dst.data(), 12, 12), 8u);
+	BOOST_CHECK_EQUAL(dst[7], 1.0f);
+	BOOST_CHECK_EQUAL(dst[8], 0.0f);
+	BOOST_CHECK_EQUAL(buffer.read_available(), 0u);
+}
+
+BOOST_AUTO_TEST_CASE(fills_missing_channels_with_silence)
+{
+	AudioRingBuffer<float> buffer(3, 4);
+	std::vector<float> src(4, 1.0f);
+	std::vector<float> dst(3 * 4, -1.0f);
+
+	// Dirty every channel first so the silence has to be written, not just left over
+	std::vector<float> dirty(3 * 4, 5.0f);
+	buffer.write(dirty.data(), 4, 4);
+	buffer.discard(4);
+
+	BOOST_REQUIRE_EQUAL(buffer.write(src.data(), 4, 4, 1), 4u);
+	BOOST_REQUIRE_EQUAL(buffer.read(dst.data(), 4, 4), 4u);
+	for (size_t frame = 0; frame < 4; ++frame) {
+		BOOST_CHECK_EQUAL(dst[frame], 1.0f);
+		BOOST_CHECK_EQUAL(dst[4 + frame], 0.0f);
+		BOOST_CHECK_EQUAL(dst[8 + frame], 0.0f);
+	}
+}
+
+BOOST_AUTO_TEST_CASE(writes_silence_and_discards)
+{
+	AudioRingBuffer<float> buffer(2, 8);
+	std::vector<float> src(2 * 8, 3.0f);
+	std::vector<float> dst(2 * 8, -1.0f);
+
+	buffer.write(src.data(), 6, 8);
+	BOOST_CHECK_EQUAL(buffer.discard(6), 6u);
+	BOOST_CHECK_EQUAL(buffer.write_silence(5), 5u);
+	BOOST_CHECK_EQUAL(buffer.discard(2), 2u);
+	BOOST_REQUIRE_EQUAL(buffer.read(dst.data(), 8, 8), 3u);
+	for (size_t frame = 0; frame < 3; ++frame) {
+		BOOST_CHECK_EQUAL(dst[frame], 0.0f);
+		BOOST_CHECK_EQUAL(dst[8 + frame], 0.0f);
+	}
+	BOOST_CHECK_EQUAL(buffer.discard(1), 0u);
+
+	buffer.write(src.data(), 4, 8);
+	buffer.reset();
+	BOOST_CHECK_EQUAL(buffer.read_available(), 0u);
+	BOOST_CHECK_EQUAL(buffer.write_available(), 8u);
+}
+
+BOOST_AUTO_TEST_CASE(hands_over_between_threads_in_order)
+{
+	// One producer and one consumer with odd block sizes, so reads and writes interleave at every offset
+	const size_t total = 200000;
+	AudioRingBuffer<float> buffer(2, 64);
+
+	std::thread producer([&buffer, total]() {
+		std::vector<float> block(2 * 7);
+		size_t written = 0;
+		while (written < total) {
+			size_t frames = std::min<size_t>(7, total - written);
+			for (size_t frame = 0; frame < frames; ++frame) {
+				block[frame] = float(written + frame);
+				block[7 + frame] = -float(written + frame);
+			}
+			size_t done = 0;
+			while (done < frames) {
+				// Each channel of what's left starts at the same offset, so the stride stays 7
+				done += buffer.write(block.data() + done, frames - done, 7);
+				if (done < frames)
+					std::this_thread::yield();
+			}
+			written += frames;
+		}
+	});
+
+	std::vector<float> block(2 * 5);
+	size_t read = 0;
+	bool ordered = true;
+	while (read < total) {
+		size_t frames = buffer.read(block.data(), 5, 5);
+		for (size_t frame = 0; frame < frames; ++frame) {
+			ordered &= block[frame] == float(read + frame);
+			ordered &= block[5 + frame] == -float(read + frame);
+		}
+		read += frames;
+		if (!frames)
+			std::this_thread::yield();
+	}
+	producer.join();
+	BOOST_CHECK(ordered);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,3 @@
+// Entry point for the unit tests. Each AudioXTests.cpp adds the suites for one module
+#define BOOST_TEST_MODULE AudioTests
+#include <boost/test/unit_test.hpp>